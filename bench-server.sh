@@ -0,0 +1,60 @@
+#!/bin/sh
+# Compares showing a dialog from a cold start against showing it through a running `--server`.
+#
+#     ./bench-server.sh [count]
+#
+# Runs `count` (default 20) dialogs each way and prints the mean wall time of a run. Each dialog is
+# a `--gauge` reading an empty stdin, so it finishes as soon as it has been shown, with no input
+# needed. With a DEBUG build, the mean of the "first frame shown" times each run logs is printed
+# too. `$IMDIALOG` is the binary to run, `./imdialog` by default.
+
+set -e
+
+count=${1:-20}
+imdialog=${IMDIALOG:-./imdialog}
+socket=${TMPDIR:-/tmp}/imdialog-bench.$$
+log=${TMPDIR:-/tmp}/imdialog-bench.$$.log
+
+now_us() {
+    echo $(($(date +%s%N) / 1000))
+}
+
+# Runs the dialog `count` times with the given arguments before it and prints the results.
+time_runs() {
+    label=$1
+    shift
+    : > "$log"
+    start=$(now_us)
+    run=0
+    while [ $run -lt "$count" ]; do
+        "$imdialog" "$@" --gauge "bench" 0 0 < /dev/null 2>> "$log"
+        run=$((run + 1))
+    done
+    end=$(now_us)
+    awk -v label="$label" -v time=$((end - start)) -v count="$count" '
+        /first frame shown/ { total += $4; shown++ }
+        END {
+            printf "%-6s %8.2f ms per run", label, time / count / 1000
+            if (shown > 0)
+                printf ", first frame shown %.2f ms after start", total / shown
+            printf "\n"
+        }' "$log"
+}
+
+"$imdialog" --server "$socket" 2> /dev/null &
+server=$!
+trap 'kill $server 2> /dev/null; rm -f "$socket" "$log"' EXIT
+
+# Without a server listening, a client would show its dialog itself and time a cold start.
+waited=0
+while [ ! -S "$socket" ]; do
+    if [ $waited -ge 100 ]; then
+        echo "bench-server.sh: the server didn't start" >&2
+        exit 1
+    fi
+    sleep 0.1
+    waited=$((waited + 1))
+done
+
+time_runs cold
+time_runs warm --client "$socket"
@@ -0,0 +1,21 @@
+// imassets.h
+
+#ifndef IMASSETS_H
+#define IMASSETS_H
+
+#include <stddef.h>
+
+// The data files, the shaders and the font, compiled into the binary. The Makefile generates
+// `imassets.cpp`, which holds them, from the files listed in its `ASSETS`.
+
+struct EmbeddedAsset {
+    const char *Filename;
+    // Followed by a NUL that isn't counted in `Size`, so that text can be used as a C string.
+    const unsigned char *Data;
+    size_t Size;
+};
+
+extern const EmbeddedAsset g_EmbeddedAssets[];
+extern const size_t g_EmbeddedAssetCount;
+
+#endif
@@ -0,0 +1,390 @@
+// imbench.cpp
+//
+// Benchmarks of the parts of imdialog that need no window, built by `make bench` from the same
+// modules as imdialog but without SDL or imgui. Each section builds its own synthetic input under
+// `$TMPDIR` and removes it afterwards.
+//
+//     imbench scan    Listing a 100k-entry directory, against the scan imdirscan replaced.
+//     imbench stat    Background scans of a directory whose every entry needs a stat, with
+//                     `$IMDIALOG_STAT_LATENCY_US` simulating a network filesystem.
+//     imbench find    Indexing a 1M-entry tree, then fuzzy matching a query as it's typed.
+//     imbench filter  Filtering menus of 10k, 100k and 1M items as a query is typed.
+
+#include "imdirscan.h"
+#include "imfilter.h"
+#include "imfind.h"
+#include "immenuitems.h"
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <dirent.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// How many times each measurement is repeated; the fastest run is reported.
+#define BENCH_RUN_COUNT                 5
+
+#define BENCH_DIRECTORY_ENTRY_COUNT     100000
+// One entry in this many is a subdirectory, the rest empty files.
+#define BENCH_DIRECTORY_INTERVAL        10
+
+#define INITIAL_DIRECTORY_ENTRY_CAPACITY    4
+
+#define BENCH_STAT_ENTRY_COUNT          5000
+
+// The find tree has this many directories at its top level, this many in each of those, and this
+// many entries in each directory of the second level, about a million in all.
+#define BENCH_FIND_DIRECTORY_COUNT      10
+#define BENCH_FIND_SUBDIRECTORY_COUNT   100
+#define BENCH_FIND_ENTRY_COUNT          1000
+#define BENCH_FIND_QUERY                "sub7file42"
+
+// Typed a character at a time, then replaced by a query that matches nothing, which has to look at
+// every item.
+#define BENCH_FILTER_QUERY              "delta-4"
+#define BENCH_FILTER_MISSING_QUERY      "qz"
+
+static double GetSeconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static void ReportTime(const char *section, const char *label, double seconds) {
+    printf("%-8s %-44s %10.2f ms\n", section, label, seconds * 1000.0);
+}
+
+// Makes a scratch directory for a section's input, returning its path.
+static char *MakeBenchRoot() {
+    const char *tmpdir = getenv("TMPDIR");
+    if (tmpdir == NULL || tmpdir[0] == '\0')
+        tmpdir = "/tmp";
+    char *path = (char *)malloc(PATH_MAX);
+    snprintf(path, PATH_MAX, "%s/imbench.XXXXXX", tmpdir);
+    if (mkdtemp(path) == NULL) {
+        perror("imbench: couldn't make a scratch directory");
+        exit(1);
+    }
+    return path;
+}
+
+static int RemoveBenchPath(const char *path, const struct stat *, int, struct FTW *) {
+    return remove(path);
+}
+
+static void RemoveBenchRoot(char *path) {
+    nftw(path, RemoveBenchPath, 64, FTW_DEPTH | FTW_PHYS);
+    free(path);
+}
+
+// Fills the directory `dir_fd` with `entry_count` entries named after `prefix`, every
+// `directory_interval`th of them a subdirectory and the rest empty files.
+static void MakeBenchEntries(int dir_fd,
+                             const char *prefix,
+                             int entry_count,
+                             int directory_interval) {
+    for (int index = 0; index < entry_count; index++) {
+        char name[NAME_MAX];
+        snprintf(name, sizeof(name), "%s%d", prefix, index);
+        if (index % directory_interval == 0) {
+            if (mkdirat(dir_fd, name, 0755) != 0) {
+                perror("imbench: couldn't make a directory");
+                exit(1);
+            }
+            continue;
+        }
+        int fd = openat(dir_fd, name, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            perror("imbench: couldn't make a file");
+            exit(1);
+        }
+        close(fd);
+    }
+}
+
+static char *GetFullPath(const char *path, size_t path_length, const char *filename) {
+    size_t filename_length = strlen(filename) + 1;
+    char *full_path = (char *)malloc(path_length + filename_length + 2);
+    snprintf(full_path, path_length + filename_length + 2, "%s/%s", path, filename);
+    return full_path;
+}
+
+// The file browser's scan before imdirscan, kept to measure against: `readdir`, then a `stat` of
+// each entry by its full path, and an allocated name per entry with a slash after directories.
+static size_t ScanDirectoryReference(const char *path, char ***entries, size_t *entry_capacity) {
+    size_t path_length = strlen(path);
+    size_t entry_count = 0;
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+        return 0;
+    struct dirent *entry = NULL;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+        char *full_path = GetFullPath(path, path_length, entry->d_name);
+        struct stat stats = { 0 };
+        stat(full_path, &stats);
+        free(full_path);
+
+        size_t filename_length = strlen(entry->d_name);
+        char *directory_entry = (char *)malloc(filename_length + 2);
+        snprintf(directory_entry,
+                 filename_length + 2,
+                 "%s%s",
+                 entry->d_name,
+                 (stats.st_mode & S_IFDIR) ? "/" : "");
+        if (entry_count == *entry_capacity) {
+            if (*entry_capacity == 0)
+                *entry_capacity = INITIAL_DIRECTORY_ENTRY_CAPACITY;
+            else
+                *entry_capacity *= 2;
+            *entries = (char **)realloc(*entries, sizeof(char *) * *entry_capacity);
+        }
+        (*entries)[entry_count++] = directory_entry;
+    }
+    closedir(dir);
+    return entry_count;
+}
+
+static void RunScanBench() {
+    char *root = MakeBenchRoot();
+    int root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    MakeBenchEntries(root_fd, "entry", BENCH_DIRECTORY_ENTRY_COUNT, BENCH_DIRECTORY_INTERVAL);
+    close(root_fd);
+
+    double reference_time = 1e9;
+    char **entries = NULL;
+    size_t entry_capacity = 0;
+    for (int run = 0; run < BENCH_RUN_COUNT; run++) {
+        double start_time = GetSeconds();
+        size_t entry_count = ScanDirectoryReference(root, &entries, &entry_capacity);
+        reference_time = std::min(reference_time, GetSeconds() - start_time);
+        for (size_t index = 0; index < entry_count; index++)
+            free(entries[index]);
+    }
+    free(entries);
+
+    double scan_time = 1e9;
+    DirectoryListing listing;
+    memset(&listing, 0, sizeof(listing));
+    for (int run = 0; run < BENCH_RUN_COUNT; run++) {
+        double start_time = GetSeconds();
+        ScanDirectory(&listing, root);
+        scan_time = std::min(scan_time, GetSeconds() - start_time);
+    }
+    FreeDirectoryListing(&listing);
+
+    char label[64];
+    snprintf(label, sizeof(label), "readdir+stat, %d entries", BENCH_DIRECTORY_ENTRY_COUNT);
+    ReportTime("scan", label, reference_time);
+    snprintf(label, sizeof(label), "ScanDirectory, %d entries", BENCH_DIRECTORY_ENTRY_COUNT);
+    ReportTime("scan", label, scan_time);
+    RemoveBenchRoot(root);
+}
+
+// The benchmarks poll rather than wait to be told there's something new.
+static void IgnoreNotification(void *) {
+}
+
+// Times a background scan of `root` with `stat_thread_count` stat threads, until every entry's
+// type has been looked up.
+static double TimeDirectoryScan(const char *root, int stat_thread_count) {
+    DirectoryListing listing;
+    memset(&listing, 0, sizeof(listing));
+    double start_time = GetSeconds();
+    DirectoryScan *scan = StartDirectoryScan(root, stat_thread_count, false, IgnoreNotification, NULL);
+    bool metadata_updated;
+    while (!TakeDirectoryScanEntries(scan, &listing, &metadata_updated))
+        usleep(100);
+    double time = GetSeconds() - start_time;
+    StopDirectoryScan(scan);
+    FreeDirectoryListing(&listing);
+    return time;
+}
+
+static void RunStatBench() {
+    const char *latency = getenv("IMDIALOG_STAT_LATENCY_US");
+    if (latency == NULL || strtol(latency, NULL, 0) <= 0) {
+        fprintf(stderr, "imbench: `stat` needs $IMDIALOG_STAT_LATENCY_US set\n");
+        exit(1);
+    }
+
+    char *root = MakeBenchRoot();
+    int root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    MakeBenchEntries(root_fd, "entry", BENCH_STAT_ENTRY_COUNT, BENCH_DIRECTORY_INTERVAL);
+    close(root_fd);
+
+    static const int stat_thread_counts[] = { 1, 4, 8, 16 };
+    for (size_t index = 0; index < sizeof(stat_thread_counts) / sizeof(stat_thread_counts[0]);
+         index++) {
+        char label[64];
+        snprintf(label,
+                 sizeof(label),
+                 "%d entries, %s us stats, %d threads",
+                 BENCH_STAT_ENTRY_COUNT,
+                 latency,
+                 stat_thread_counts[index]);
+        ReportTime("stat", label, TimeDirectoryScan(root, stat_thread_counts[index]));
+    }
+    RemoveBenchRoot(root);
+}
+
+static int OpenBenchDirectory(int dir_fd, const char *name) {
+    if (mkdirat(dir_fd, name, 0755) != 0) {
+        perror("imbench: couldn't make a directory");
+        exit(1);
+    }
+    return openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+static void RunFindBench() {
+    char *root = MakeBenchRoot();
+    int root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    for (int top = 0; top < BENCH_FIND_DIRECTORY_COUNT; top++) {
+        char name[NAME_MAX];
+        snprintf(name, sizeof(name), "dir%d", top);
+        int top_fd = OpenBenchDirectory(root_fd, name);
+        for (int sub = 0; sub < BENCH_FIND_SUBDIRECTORY_COUNT; sub++) {
+            snprintf(name, sizeof(name), "sub%d", sub);
+            int sub_fd = OpenBenchDirectory(top_fd, name);
+            MakeBenchEntries(sub_fd, "file", BENCH_FIND_ENTRY_COUNT, BENCH_DIRECTORY_INTERVAL);
+            close(sub_fd);
+        }
+        close(top_fd);
+    }
+    close(root_fd);
+
+    double start_time = GetSeconds();
+    FileIndex *index = StartFileIndex(root, 16, NULL, 0, IgnoreNotification, NULL);
+    while (!IsFileIndexFinished(index))
+        usleep(100);
+    char label[64];
+    snprintf(label, sizeof(label), "index, %zu entries", GetFileIndexEntryCount(index));
+    ReportTime("find", label, GetSeconds() - start_time);
+
+    // Each keystroke is matched to completion, where imdialog would spread it over frames.
+    FuzzyMatcher matcher;
+    InitFuzzyMatcher(&matcher);
+    const char *query = BENCH_FIND_QUERY;
+    for (size_t length = 1; length <= strlen(query); length++) {
+        char typed[FUZZY_MATCH_QUERY_SIZE];
+        snprintf(typed, sizeof(typed), "%.*s", (int)length, query);
+        start_time = GetSeconds();
+        SetFuzzyMatcherQuery(&matcher, typed);
+        while (UpdateFuzzyMatcher(&matcher, index, 1.0)) {
+        }
+        snprintf(label,
+                 sizeof(label),
+                 "type \"%.*s\", %zu matches",
+                 (int)length,
+                 query,
+                 GetFuzzyMatchCount(&matcher));
+        ReportTime("find", label, GetSeconds() - start_time);
+    }
+    FreeFuzzyMatcher(&matcher);
+    StopFileIndex(index);
+    RemoveBenchRoot(root);
+}
+
+// Writes a `--menu-from` file of `item_count` items to `path`.
+static void MakeBenchMenu(const char *path, int item_count) {
+    static const char *const words[] = {
+        "alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf", "hotel",
+    };
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        perror("imbench: couldn't make a menu");
+        exit(1);
+    }
+    for (int index = 0; index < item_count; index++)
+        fprintf(file, "%d\t%s-%d.%d\n", index, words[index % 8], index % 100, index % 7);
+    fclose(file);
+}
+
+static void FilterBenchMenu(TextFilter *filter, const char *query, int item_count) {
+    double start_time = GetSeconds();
+    SetTextFilterQuery(filter, query);
+    char label[64];
+    snprintf(label,
+             sizeof(label),
+             "%d items, type \"%s\", %zu matches",
+             item_count,
+             query,
+             filter->MatchCount);
+    ReportTime("filter", label, GetSeconds() - start_time);
+}
+
+static void RunFilterBench() {
+    static const int item_counts[] = { 10000, 100000, 1000000 };
+    char *root = MakeBenchRoot();
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/menu", root);
+    for (size_t count_index = 0; count_index < sizeof(item_counts) / sizeof(item_counts[0]);
+         count_index++) {
+        int item_count = item_counts[count_index];
+        MakeBenchMenu(path, item_count);
+
+        char label[64];
+        double start_time = GetSeconds();
+        MenuItem *items = NULL;
+        size_t read_item_count = 0, item_capacity = 0;
+        MenuItemFile file;
+        if (!ReadMenuItems(path, '\n', &items, &read_item_count, &item_capacity, &file)) {
+            perror("imbench: couldn't read the menu");
+            exit(1);
+        }
+        snprintf(label, sizeof(label), "%d items, read", item_count);
+        ReportTime("filter", label, GetSeconds() - start_time);
+
+        // As in imdialog, the filter is built on the first keystroke.
+        start_time = GetSeconds();
+        TextFilter filter;
+        InitTextFilter(&filter);
+        for (size_t index = 0; index < read_item_count; index++) {
+            const char *fields[2] = { items[index].Tag, items[index].Item };
+            size_t field_lengths[2] = { items[index].TagLength, items[index].ItemLength };
+            AddTextFilterRecord(&filter, fields, field_lengths, 2);
+        }
+        snprintf(label, sizeof(label), "%d items, build", item_count);
+        ReportTime("filter", label, GetSeconds() - start_time);
+
+        const char *query = BENCH_FILTER_QUERY;
+        for (size_t length = 1; length <= strlen(query); length++) {
+            char typed[sizeof(BENCH_FILTER_QUERY)];
+            snprintf(typed, sizeof(typed), "%.*s", (int)length, query);
+            FilterBenchMenu(&filter, typed, item_count);
+        }
+        FilterBenchMenu(&filter, BENCH_FILTER_MISSING_QUERY, item_count);
+
+        FreeTextFilter(&filter);
+        free(items);
+        FreeMenuItemFile(&file);
+    }
+    RemoveBenchRoot(root);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: imbench scan|stat|find|filter\n");
+        return 1;
+    }
+    if (strcmp(argv[1], "scan") == 0) {
+        RunScanBench();
+    } else if (strcmp(argv[1], "stat") == 0) {
+        RunStatBench();
+    } else if (strcmp(argv[1], "find") == 0) {
+        RunFindBench();
+    } else if (strcmp(argv[1], "filter") == 0) {
+        RunFilterBench();
+    } else {
+        fprintf(stderr, "imbench: no benchmark called `%s`\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}
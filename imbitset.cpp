@@ -0,0 +1,82 @@
+// imbitset.cpp
+
+#include "imbitset.h"
+#include <stdlib.h>
+#include <string.h>
+
+static inline size_t GetWordCount(size_t bit_count) {
+    return (bit_count + 63) / 64;
+}
+
+void InitBitset(Bitset *bitset, size_t bit_count) {
+    // Always allocate at least a word, so that an empty set still has somewhere to point.
+    bitset->Words = (uint64_t *)calloc(GetWordCount(bit_count) + 1, sizeof(uint64_t));
+    bitset->BitCount = bit_count;
+}
+
+void FreeBitset(Bitset *bitset) {
+    free(bitset->Words);
+    bitset->Words = NULL;
+    bitset->BitCount = 0;
+}
+
+void ResizeBitset(Bitset *bitset, size_t bit_count) {
+    size_t old_word_count = GetWordCount(bitset->BitCount), word_count = GetWordCount(bit_count);
+    if (word_count > old_word_count) {
+        bitset->Words = (uint64_t *)realloc(bitset->Words, sizeof(uint64_t) * (word_count + 1));
+        memset(&bitset->Words[old_word_count + 1],
+               0,
+               sizeof(uint64_t) * (word_count - old_word_count));
+    }
+    bitset->BitCount = bit_count;
+}
+
+// Calls `apply(word, mask)` on each word overlapping [begin, end), with `mask` selecting the bits
+// of the word inside the range.
+template<typename Fn>
+static void ApplyToBitRange(Bitset *bitset, size_t begin, size_t end, Fn apply) {
+    if (begin >= end)
+        return;
+    size_t first_word = begin >> 6, last_word = (end - 1) >> 6;
+    uint64_t first_mask = ~(uint64_t)0 << (begin & 63);
+    uint64_t last_mask = ~(uint64_t)0 >> (63 - ((end - 1) & 63));
+    if (first_word == last_word) {
+        apply(&bitset->Words[first_word], first_mask & last_mask);
+        return;
+    }
+    apply(&bitset->Words[first_word], first_mask);
+    for (size_t word = first_word + 1; word < last_word; word++)
+        apply(&bitset->Words[word], ~(uint64_t)0);
+    apply(&bitset->Words[last_word], last_mask);
+}
+
+void SetBitRange(Bitset *bitset, size_t begin, size_t end, bool value) {
+    if (value)
+        ApplyToBitRange(bitset, begin, end, [](uint64_t *word, uint64_t mask) { *word |= mask; });
+    else
+        ApplyToBitRange(bitset, begin, end, [](uint64_t *word, uint64_t mask) { *word &= ~mask; });
+}
+
+void InvertBitRange(Bitset *bitset, size_t begin, size_t end) {
+    ApplyToBitRange(bitset, begin, end, [](uint64_t *word, uint64_t mask) { *word ^= mask; });
+}
+
+size_t CountBits(const Bitset *bitset) {
+    size_t count = 0;
+    for (size_t word = 0; word < GetWordCount(bitset->BitCount); word++)
+        count += __builtin_popcountll(bitset->Words[word]);
+    return count;
+}
+
+size_t FindNextSetBit(const Bitset *bitset, size_t bit) {
+    if (bit >= bitset->BitCount)
+        return bitset->BitCount;
+    size_t word = bit >> 6, word_count = GetWordCount(bitset->BitCount);
+    uint64_t bits = bitset->Words[word] & (~(uint64_t)0 << (bit & 63));
+    while (bits == 0) {
+        if (++word == word_count)
+            return bitset->BitCount;
+        bits = bitset->Words[word];
+    }
+    return (word << 6) + __builtin_ctzll(bits);
+}
@@ -0,0 +1,45 @@
+// imbitset.h
+
+#ifndef IMBITSET_H
+#define IMBITSET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A packed set of bits. Bits past `BitCount` in the last word are always clear.
+struct Bitset {
+    uint64_t *Words;
+    size_t BitCount;
+};
+
+void InitBitset(Bitset *bitset, size_t bit_count);
+void FreeBitset(Bitset *bitset);
+
+// Grows `bitset` to `bit_count` bits. The new bits are clear.
+void ResizeBitset(Bitset *bitset, size_t bit_count);
+
+inline bool TestBit(const Bitset *bitset, size_t bit) {
+    return (bitset->Words[bit >> 6] >> (bit & 63)) & 1;
+}
+
+inline void SetBit(Bitset *bitset, size_t bit) {
+    bitset->Words[bit >> 6] |= (uint64_t)1 << (bit & 63);
+}
+
+inline void ClearBit(Bitset *bitset, size_t bit) {
+    bitset->Words[bit >> 6] &= ~((uint64_t)1 << (bit & 63));
+}
+
+inline void ToggleBit(Bitset *bitset, size_t bit) {
+    bitset->Words[bit >> 6] ^= (uint64_t)1 << (bit & 63);
+}
+
+// These work a word at a time on the bits in [begin, end).
+void SetBitRange(Bitset *bitset, size_t begin, size_t end, bool value);
+void InvertBitRange(Bitset *bitset, size_t begin, size_t end);
+size_t CountBits(const Bitset *bitset);
+
+// Returns the first set bit at or after `bit`, or `BitCount` if there is none.
+size_t FindNextSetBit(const Bitset *bitset, size_t bit);
+
+#endif
@@ -0,0 +1,127 @@
+// imcache.cpp
+
+#include "imcache.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+uint64_t HashBytes(const void *data, size_t size, uint64_t hash) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    for (size_t index = 0; index < size; index++) {
+        hash ^= bytes[index];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Creates `path` and any missing parents.
+static bool MakeDirectories(char *path) {
+    for (char *ptr = path + 1; *ptr != '\0'; ptr++) {
+        if (*ptr != '/')
+            continue;
+        *ptr = '\0';
+        int error = mkdir(path, 0700);
+        *ptr = '/';
+        if (error != 0 && errno != EEXIST)
+            return false;
+    }
+    return mkdir(path, 0700) == 0 || errno == EEXIST;
+}
+
+// Writes the path of imdialog's cache directory into `path`, which holds `PATH_MAX + 1` bytes,
+// creating the directory if need be. Returns false if there's nowhere to cache anything.
+static bool GetCacheDirectory(char *path) {
+    const char *cache_home = getenv("XDG_CACHE_HOME");
+    if (cache_home == NULL || cache_home[0] == '\0') {
+        const char *home = getenv("HOME");
+        if (home == NULL || home[0] == '\0')
+            return false;
+        snprintf(path, PATH_MAX, "%s/.cache/imdialog", home);
+    } else {
+        snprintf(path, PATH_MAX, "%s/imdialog", cache_home);
+    }
+    return MakeDirectories(path);
+}
+
+char *GetCacheFilePath(const char *filename) {
+    char *path = (char *)malloc(PATH_MAX + 1);
+    if (!GetCacheDirectory(path)) {
+        free(path);
+        return NULL;
+    }
+    size_t length = strlen(path);
+    snprintf(&path[length], PATH_MAX - length, "/%s", filename);
+    return path;
+}
+
+void *MapFile(const char *path, size_t *size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    struct stat stats;
+    if (fstat(fd, &stats) != 0 || stats.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    void *data = mmap(NULL, stats.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return NULL;
+    *size = stats.st_size;
+    return data;
+}
+
+void UnmapFile(void *data, size_t size) {
+    munmap(data, size);
+}
+
+void RemoveOtherCacheFiles(const char *prefix, const char *filename) {
+    char path[PATH_MAX + 1];
+    if (!GetCacheDirectory(path))
+        return;
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+        return;
+    size_t prefix_length = strlen(prefix);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, prefix, prefix_length) == 0 &&
+            strcmp(entry->d_name, filename) != 0) {
+            unlinkat(dirfd(dir), entry->d_name, 0);
+        }
+    }
+    closedir(dir);
+}
+
+bool WriteCacheFile(const char *path, const void *data, size_t size) {
+    char temp_path[PATH_MAX + 1];
+    snprintf(temp_path, sizeof(temp_path), "%s.%d.tmp", path, (int)getpid());
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return false;
+
+    const char *ptr = (const char *)data;
+    size_t left = size;
+    while (left > 0) {
+        ssize_t written = write(fd, ptr, left);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            break;
+        ptr += written;
+        left -= written;
+    }
+    if (close(fd) != 0 || left > 0 || rename(temp_path, path) != 0) {
+        unlink(temp_path);
+        return false;
+    }
+    return true;
+}
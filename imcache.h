@@ -0,0 +1,32 @@
+// imcache.h
+
+#ifndef IMCACHE_H
+#define IMCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The starting value for `HashBytes`.
+#define HASH_SEED   0xcbf29ce484222325ULL
+
+// Hashes `data` into `hash` (64-bit FNV-1a), so that several pieces can be hashed together by
+// passing each result on to the next call.
+uint64_t HashBytes(const void *data, size_t size, uint64_t hash);
+
+// Returns the path of `filename` in imdialog's cache directory, `$XDG_CACHE_HOME/imdialog`,
+// creating the directory if need be. Returns NULL if there's nowhere to cache anything. Files in
+// the cache are only ever derived from other files, so they can be deleted at any time.
+char *GetCacheFilePath(const char *filename);
+
+// Maps the whole of the file at `path` read-only. Returns NULL if it doesn't exist or is empty.
+void *MapFile(const char *path, size_t *size);
+void UnmapFile(void *data, size_t size);
+
+// Replaces the file at `path` with `data`, atomically, so that a reader never sees half of it.
+bool WriteCacheFile(const char *path, const void *data, size_t size);
+
+// Deletes every file in the cache whose name starts with `prefix`, apart from `filename`, for
+// kinds of file of which only the latest is worth keeping.
+void RemoveOtherCacheFiles(const char *prefix, const char *filename);
+
+#endif
@@ -1,30 +1,58 @@
 // imdialog.cpp
 
 #include "imgui/imgui.h"
+#include "imgui/imgui_internal.h"
+#include "imassets.h"
+#include "imbitset.h"
+#include "imcache.h"
+#include "imdirscan.h"
+#include "imfilter.h"
+#include "imfind.h"
+#include "imgauge.h"
+#include "imglyphs.h"
+#include "immenuitems.h"
+#include "imsdf.h"
+#include "imserver.h"
+#include "imstreambuffer.h"
+#include "imtextfile.h"
 #include "imgl.h"
 #include <SDL2/SDL.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <algorithm>
+#include <atomic>
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <float.h>
+#include <limits.h>
+#include <new>
+#include <poll.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <thread>
+#include <time.h>
 #include <unistd.h>
 
 #ifdef __linux__
+#include <sys/inotify.h>
 #include <sys/ioctl.h>
 #include <linux/kd.h>
 #include <linux/keyboard.h>
 #endif
 
-#ifdef HAVE_OPENGLES2
-#define FRAMEBUFFER_WIDTH   1920
-#define FRAMEBUFFER_HEIGHT  1080
-#else
-#define FRAMEBUFFER_WIDTH   800
-#define FRAMEBUFFER_HEIGHT  600
-#endif
+// The size of the window. With GLES, the window takes up the whole display, so this is only used if
+// the display mode can't be had.
+#define WINDOW_PIXEL_WIDTH  800
+#define WINDOW_PIXEL_HEIGHT 600
+
+// How far `$IMDIALOG_RENDER_SCALE` can cut down the resolution frames are drawn at.
+#define MIN_RENDER_SCALE    0.25f
 
 #define CHARACTER_SCREEN_WIDTH      80
 #define CHARACTER_SCREEN_HEIGHT     25
@@ -32,17 +60,44 @@
 #define WINDOW_WIDTH    50
 
 #define FONT_FILENAME       "Muli.ttf"
-#define STANDARD_FONT_SIZE  ((float)FRAMEBUFFER_HEIGHT / 16.6666f)
-#define LABEL_FONT_SIZE     ((float)FRAMEBUFFER_HEIGHT / 25.0f)
+// Sized to the height of what's drawn.
+#define STANDARD_FONT_SIZE(height)  ((float)(height) / 16.6666f)
+#define LABEL_FONT_SIZE(height)     ((float)(height) / 25.0f)
+// The font is baked once, as distance fields at this size, and scaled to each of the sizes above.
+#define SDF_FONT_SIZE       32.0f
+// How far, in atlas pixels, the distance fields reach either side of a glyph's edges.
+#define SDF_SPREAD          4
+
+// Bump whenever the layout of a cached font atlas changes.
+#define FONT_ATLAS_CACHE_MAGIC  "IMDFONT3"
+#define FONT_ATLAS_CACHE_PREFIX "font-atlas-"
+// At most this much of the dialogs' text is looked through for characters to bake before the first
+// frame; whatever's left is noted as it's drawn.
+#define PREPARED_TEXT_SIZE      (4 * 1024 * 1024)
+#define PROGRAM_CACHE_MAGIC     "IMDPROG1"
 
 #define LABEL_COLOR     ImVec4(0.5, 0.5, 0.5, 1.0)
 
 #define MAX_TEXT_SIZE   1024
 
-#define INITIAL_DIRECTORY_ENTRY_CAPACITY    4
-
 #define LIST_HEIGHT 5
 
+#define DEFAULT_STAT_THREAD_COUNT   8
+
+// Rows shown by `--textbox` and `--tailbox` when no height is given.
+#define DEFAULT_TEXT_BOX_HEIGHT     16
+
+#define DEFAULT_FIND_DEPTH  16
+// How long type-to-find may spend matching per frame before leaving the rest to later frames.
+#define FIND_MATCH_BUDGET   0.008
+
+// What a dialog escaped out of exits with, as in dialog.
+#define ESCAPE_EXIT_CODE    255
+
+// Widths, in characters, of the optional file browser columns.
+#define SIZE_COLUMN_WIDTH   9
+#define DATE_COLUMN_WIDTH   17
+
 #ifndef KDSKBMUTE
 #define KDSKBMUTE   0x4B51
 #endif
@@ -50,19 +105,53 @@
 #define KDSKBMODE   0x4B45
 #endif
 
-struct MenuItem {
-    const char *Tag;
-    const char *Item;
-};
-
 struct InputUI {
     const char *Text;
     char *Data;
 };
 
+// An inotify watch on the directory the file browser is showing, and the thread that waits on it,
+// which flags `Changed` and wakes the main loop when the directory's contents change.
+struct DirectoryWatch {
+    int FD;
+    // The watch on the directory being shown; events for earlier ones are ignored.
+    std::atomic<int> Descriptor;
+    std::atomic<bool> Changed;
+    // Closing the write end stops the thread.
+    int StopFDs[2];
+    std::thread Thread;
+};
+
+// A listing of the directory the file browser is showing. It is built once when the user enters
+// a directory and kept across frames until the directory changes or the inotify watch on it
+// reports that its contents changed. The listing fills in from a background scan, so `Scan` is
+// non-NULL until every entry has arrived.
+struct DirectorySnapshot {
+    bool Valid;
+    bool AtRoot;
+    char *Path;
+    DirectoryListing Listing;
+    DirectoryView View;
+    // Whether the listing is being filled in with sizes and modification times.
+    bool HasMetadata;
+    DirectoryScan *Scan;
+    uint64_t ScanStartTime;
+    DirectoryWatch *Watch;
+};
+
 struct FileUI {
     char *Path;
     int ItemIndex;
+    DirectorySnapshot Snapshot;
+    // Type-to-find state, used with `--find`. The index covers the tree under the directory the
+    // browser started in and is built in the background while the user types.
+    FileIndex *Index;
+    uint64_t IndexStartTime;
+    bool IndexFinished;
+    FuzzyMatcher Matcher;
+    char FindQuery[FUZZY_MATCH_QUERY_SIZE];
+    uint64_t FindQueryTime;
+    int FindItemIndex;
 };
 
 struct MenuUI {
@@ -70,23 +159,84 @@ struct MenuUI {
     uint32_t MenuHeight;
     MenuItem *Items;
     size_t ItemCount;
+    size_t ItemCapacity;
+    // With `--menu-from` a file, the copy of it the items point into.
+    MenuItemFile File;
+    // With `--menu-from -`, items are read from stdin by `Stream` once the window is up.
+    bool ReadFromStdin;
+    MenuItemStream *Stream;
+    // The selected row, counting only the items that pass the filter.
+    int ItemIndex;
+    // What a checklist or radiolist has chosen: a bit per item for a checklist, or a single item
+    // (`SIZE_MAX` for none) for a radiolist. Shift-selection extends from `AnchorRow`.
+    Bitset Selection;
+    size_t SelectedItem;
+    int AnchorRow;
+    // Type-to-filter state. The items are only added to the filter once a query is first typed.
+    bool FilterInitialized;
+    char FilterQuery[MAX_TEXT_SIZE];
+    TextFilter Filter;
+};
+
+// A file shown with `--textbox` or followed with `--tailbox`. Only the lines in view are read,
+// overlong lines are wrapped, and lines are only indexed as far as the view has reached, so opening
+// a huge log and jumping to its end is instant.
+struct TextBoxUI {
+    const char *Path;
+    TextFile File;
+    // Where the top line of the view starts.
+    uint64_t TopOffset;
+    // Whether the view sticks to the end of the file as it grows, as a tailbox's starts out doing.
+    bool Follow;
+    // A tailbox's inotify watch on the file, and the thread that waits on it.
+    int WatchFD;
+    int WatchDescriptor;
+    std::thread *WatchThread;
+};
+
+// dialog's `--gauge`. Progress arrives on stdin through `Stream`, which only keeps the latest
+// state, so each frame shows whatever came in last however fast the updates are.
+struct GaugeUI {
+    int Percent;
+    char Text[GAUGE_TEXT_SIZE];
+    GaugeStream *Stream;
 };
 
 enum UIType {
     FileUIType,
     InputUIType,
     MenuUIType,
+    ChecklistUIType,
+    RadiolistUIType,
+    TextBoxUIType,
+    TailBoxUIType,
+    GaugeUIType,
 };
 
 union UITypeData {
     FileUI File;
     InputUI Input;
     MenuUI Menu;
+    TextBoxUI TextBox;
+    GaugeUI Gauge;
 };
 
 struct UI {
     uint32_t Width;
     uint32_t Height;
+    // File browser settings, which can be given before any widget.
+    // How many `fstatat`s the file browser may have in flight at once.
+    uint32_t StatThreadCount;
+    DirectorySortMode FileSortMode;
+    bool FileDirectoriesFirst;
+    bool FileSizeColumn;
+    bool FileDateColumn;
+    // Whether `--menu-from` records are NUL-delimited rather than newline-delimited.
+    bool NullDelimited;
+    bool FileFind;
+    uint32_t FileFindDepth;
+    const char **FileFindIgnorePatterns;
+    int FileFindIgnorePatternCount;
     UIType Type;
     UITypeData Data;
 };
@@ -96,122 +246,210 @@ struct UIStatus {
     int ExitCode;
 };
 
-struct ImDialogState {
-    GLuint VertexShader;
-    GLuint FragmentShader;
+// Where every program takes its vertex attributes from, so that they can all share the arrays.
+#define POSITION_ATTRIBUTE      0
+#define TEXTURE_UV_ATTRIBUTE    1
+#define COLOR_ATTRIBUTE         2
+
+// A program for drawing imgui's draw lists, with a fragment shader suited to a kind of texture.
+struct ImDialogProgram {
     GLuint Program;
-    GLuint VBO;
-    GLuint IBO;
-    GLint APosition;
-    GLint ATextureUV;
-    GLint AColor;
     GLint UWindowSize;
     GLint UTexture;
+};
+
+// A font atlas, baked or loaded from the cache, that's waiting to be uploaded.
+struct FontAtlasBake {
+    const void *Pixels;
+    // The mapped cache file that holds `Pixels`, if that's where they came from.
+    void *Cache;
+    size_t CacheSize;
+    size_t GlyphCount;
+    uint64_t StartTime;
+    uint64_t EndTime;
+};
+
+// What drawing a frame took, for tuning.
+struct RenderStats {
+    int DrawCalls;
+    // Program, texture and scissor changes.
+    int StateChanges;
+    size_t UploadSize;
+#ifdef IMDEBUG
+    // Until the GPU is done with it.
+    uint64_t DrawTime;
+#endif
+};
+
+// The content of a frame's draw lists, kept so as to tell whether the next frame looks any
+// different.
+struct FrameRecord {
+    char *Data;
+    size_t Size;
+    size_t Capacity;
+};
+
+struct ImDialogState {
+    // Draws from the font atlas, which holds nothing but alpha.
+    ImDialogProgram FontProgram;
+    // Draws from any other texture, which is taken to be RGBA.
+    ImDialogProgram TextureProgram;
+    StreamBuffer VertexBuffer;
+    StreamBuffer IndexBuffer;
     GLuint FontTexture;
     ImFont *standardFont;
     ImFont *labelFont;
+    GlyphSet Glyphs;
+    // The size of the window, and of what's drawn into it. With a render scale below 1, frames are
+    // drawn into `RenderTexture` at that fraction of the window's size and then scaled up to fill
+    // it, which spares GPUs short on fill rate most of the blending. `RenderFramebuffer` is 0 if
+    // frames are drawn straight into the window.
+    int OutputWidth;
+    int OutputHeight;
+    int RenderWidth;
+    int RenderHeight;
+    GLuint RenderFramebuffer;
+    GLuint RenderTexture;
+    RenderStats LastFrameStats;
+    // The frame on screen and the one just drawn, so that a frame no different from the one on
+    // screen is neither drawn nor swapped in. `ShownFrameRecorded` is false if there's nothing
+    // known about what's on screen.
+    FrameRecord Frames[2];
+    int ShownFrame;
+    bool ShownFrameRecorded;
+    bool FrameRecorded;
+    bool FrameSkipped;
+    uint64_t SkippedFrameCount;
+    // Everything that can be got ready before there's a GL, by `PrepareDialogState`, which may be
+    // running on `PrepareThread`.
+    std::thread *PrepareThread;
+    FontAtlasBake FontBake;
+    char *VertexSource;
+    char *FontFragmentSource;
+    char *TextureFragmentSource;
+    uint64_t PrepareStartTime;
+    uint64_t PrepareEndTime;
 };
 
 static ImDialogState g_ImDialogState;
 
-static char *xstrsep(char **stringp, const char* delim) {
-    char *start = *stringp;
-    char *p = (start != NULL) ? strpbrk(start, delim) : NULL;
-    if (p == NULL) {
-        *stringp = NULL;
-    } else {
-        *p = '\0';
-        *stringp = p + 1;
-    }
-    return start;
-}
+// Background threads wake the main loop, which sleeps in `SDL_WaitEvent`, by pushing an event of
+// this type. At most one is queued at a time.
+static Uint32 g_WakeEventType;
+static std::atomic<bool> g_WakePending;
 
 static float ToPixelSize(uint32_t characterSize) {
-    return (float)characterSize / (float)CHARACTER_SCREEN_WIDTH * (float)FRAMEBUFFER_WIDTH;
+    return (float)characterSize / (float)CHARACTER_SCREEN_WIDTH *
+        (float)g_ImDialogState.RenderWidth;
 }
 
-static char *GetDataFilePath(const char *filename) {
-    char *path = (char *)malloc(PATH_MAX + 1);
-    char *dataHome = getenv("XDG_DATA_HOME");
-    if (dataHome == NULL || dataHome[0] == '\0') {
-        const char *home = getenv("HOME");
-        if (home == NULL)
-            home = ".";
-        snprintf(path, PATH_MAX, "%s/.local/share/imdialog/%s", home, filename);
-    } else {
-        snprintf(path, PATH_MAX, "%s/imdialog/%s", dataHome, filename);
-    }
+// Makes sure the characters of `text` end up in the font atlas. Whatever text a dialog shows goes
+// through here first. A buffer that `ImGui::InputText` edits goes through again right after it,
+// since a typed character is drawn in the same frame.
+static void NoteText(const char *text, const char *text_end = NULL) {
+    AddGlyphs(&g_ImDialogState.Glyphs, text, text_end);
+}
 
-    struct stat stats;
-    if (stat(path, &stats) == 0)
-        return path;
+// The data files are compiled in, so finding one takes no filesystem access at all, unless
+// `$IMDIALOG_DATA_DIR` is set, in which case a copy there takes its place. Returns the path of that
+// copy, if there might be one.
+static char *GetDataFileOverridePath(const char *filename) {
+    const char *directory = getenv("IMDIALOG_DATA_DIR");
+    if (directory == NULL || directory[0] == '\0')
+        return NULL;
+    char *path = (char *)malloc(PATH_MAX + 1);
+    snprintf(path, PATH_MAX, "%s/%s", directory, filename);
+    return path;
+}
 
-    const char *dataDirsLocation = getenv("XDG_DATA_DIRS");
-    if (dataDirsLocation == NULL || dataDirsLocation[0] == '\0')
-        dataDirsLocation = "/usr/local/share/:/usr/share/";
-    char *dataDirs = strdup(dataDirsLocation);
-    char *dataDir;
-    while ((dataDir = xstrsep(&dataDirs, ":")) != NULL) {
-        snprintf(path, PATH_MAX, "%s/imdialog/%s", dataDir, filename);
-        if (stat(path, &stats) == 0)
-            return path;
+static const EmbeddedAsset *GetEmbeddedDataFile(const char *filename) {
+    for (size_t index = 0; index < g_EmbeddedAssetCount; index++) {
+        if (strcmp(g_EmbeddedAssets[index].Filename, filename) == 0)
+            return &g_EmbeddedAssets[index];
     }
-
-    snprintf(path, PATH_MAX, "./%s", filename);
-    if (stat(path, &stats) == 0)
-        return path;
-
-    fprintf(stderr,
-            "error: couldn't find data file `%s`: try installing it to "
-            "`~/.local/share/imdialog/%s` or "
-            "`/usr/local/share/imdialog/%s`\n",
-            filename,
-            filename,
-            filename);
-    exit(1);
+    fprintf(stderr, "error: `%s` wasn't built in\n", filename);
+    abort();
 }
 
-static void Usage() {
-    fprintf(stderr, "usage: imdialog [--no-cancel] [--fselect|--inputbox|--menu] args...\n");
-    exit(EXIT_SUCCESS);
+// Prints how imdialog is used. Returns false, for the parsers to return when their arguments are
+// wrong.
+static bool Usage() {
+    fprintf(stderr,
+            "usage: imdialog --server socket\n"
+            "       imdialog [--client socket] dialog [--and-widget dialog]...\n"
+            "dialog: [--no-cancel] [--stat-threads count] "
+            "[--sort none|name|natural|mtime|size] [--dirs-first] [--size-column] "
+            "[--date-column] [--find] [--find-depth levels] [--find-ignore pattern]... "
+            "[--null] [--fselect|--inputbox|--menu|--menu-from|--checklist|--radiolist|"
+            "--textbox|--tailbox|--gauge] args...\n");
+    return false;
 }
 
-static void ParseUint32(uint32_t *value, int *argc, const char ***argv) {
+static bool ParseUint32(uint32_t *value, int *argc, const char ***argv) {
     if (*argc == 0)
-        Usage();
+        return Usage();
     *value = (uint32_t)strtol((*argv)[0], NULL, 0);
     (*argc)--;
     (*argv)++;
+    return true;
+}
+
+static const char *const g_SortModeNames[DirectorySortModeCount] = {
+    "none", "name", "natural", "mtime", "size",
+};
+
+static bool ParseSortMode(DirectorySortMode *mode, int *argc, const char ***argv) {
+    if (*argc == 0)
+        return Usage();
+    for (int index = 0; index < DirectorySortModeCount; index++) {
+        if (strcmp((*argv)[0], g_SortModeNames[index]) == 0) {
+            *mode = (DirectorySortMode)index;
+            (*argc)--;
+            (*argv)++;
+            return true;
+        }
+    }
+    return Usage();
 }
 
-static void ParseHeightAndWidth(UI *ui, int *argc, const char ***argv) {
-    ParseUint32(&ui->Width, argc, argv);
-    ParseUint32(&ui->Height, argc, argv);
+static bool ParseHeightAndWidth(UI *ui, int *argc, const char ***argv) {
+    return ParseUint32(&ui->Width, argc, argv) && ParseUint32(&ui->Height, argc, argv);
 }
 
-static void ParseFileCommandLine(UI *ui, int *argc, const char ***argv) {
-    if (argc == 0)
-        Usage();
-    ui->Data.File.Path = strdup((*argv)[0]);
+// The dialog parsers below check all their arguments before allocating anything, so that they
+// leave nothing to free when they return false.
+
+static bool ParseFileCommandLine(UI *ui, int *argc, const char ***argv) {
+    if (*argc == 0)
+        return Usage();
+    const char *path = (*argv)[0];
     (*argc)--;
     (*argv)++;
 
-    ui->Data.File.ItemIndex = 0;
-
-    ParseHeightAndWidth(ui, argc, argv);
+    if (!ParseHeightAndWidth(ui, argc, argv))
+        return false;
 
     if (*argc != 0)
-        Usage();
+        return Usage();
+
+    ui->Data.File.Path = strdup(path);
+    ui->Data.File.ItemIndex = 0;
+    ui->Data.File.Snapshot.Watch = NULL;
+    return true;
 }
 
-static void ParseInputCommandLine(UI *ui, int *argc, const char ***argv) {
-    if (argc == 0)
-        Usage();
+static bool ParseInputCommandLine(UI *ui, int *argc, const char ***argv) {
+    if (*argc == 0)
+        return Usage();
     ui->Data.Input.Text = (*argv)[0];
     (*argc)--;
     (*argv)++;
 
-    ParseHeightAndWidth(ui, argc, argv);
+    if (!ParseHeightAndWidth(ui, argc, argv))
+        return false;
+
+    if (*argc > 1)
+        return Usage();
 
     ui->Data.Input.Data = (char *)calloc(MAX_TEXT_SIZE, 1);
     if (*argc > 0) {
@@ -219,73 +457,296 @@ static void ParseInputCommandLine(UI *ui, int *argc, const char ***argv) {
         (*argc)--;
         (*argv)++;
     }
-
-    if (*argc != 0)
-        Usage();
+    return true;
 }
 
-static void ParseMenuCommandLine(UI *ui, int *argc, const char ***argv) {
+static bool ParseMenuCommandLine(UI *ui, int *argc, const char ***argv) {
     if ((*argc) == 0)
-        Usage();
+        return Usage();
     ui->Data.Menu.Text = (*argv)[0];
     (*argc)--;
     (*argv)++;
 
-    ParseHeightAndWidth(ui, argc, argv);
-    ParseUint32(&ui->Data.Menu.MenuHeight, argc, argv);
+    if (!ParseHeightAndWidth(ui, argc, argv) ||
+        !ParseUint32(&ui->Data.Menu.MenuHeight, argc, argv)) {
+        return false;
+    }
 
-    uint32_t max_item_count = ((*argc) + 1) / 2;
-    ui->Data.Menu.Items = (MenuItem *)malloc(sizeof(MenuItem) * max_item_count);
+    if (*argc % 2 != 0)
+        return Usage();
     while (*argc != 0) {
-        if (*argc == 1)
-            Usage();
-
-        MenuItem *item = &ui->Data.Menu.Items[ui->Data.Menu.ItemCount];
-        item->Tag = (*argv)[0];
-        item->Item = (*argv)[1];
-        ui->Data.Menu.ItemCount++;
+        AddMenuItem(&ui->Data.Menu.Items,
+                    &ui->Data.Menu.ItemCount,
+                    &ui->Data.Menu.ItemCapacity,
+                    (*argv)[0],
+                    strlen((*argv)[0]),
+                    (*argv)[1],
+                    strlen((*argv)[1]));
 
         (*argc) -= 2;
         (*argv) += 2;
     }
+    return true;
 }
 
-static UI ParseCommandLine(int argc, const char **argv) {
-    UI ui = { 0 };
-    argc--;
-    argv++;
+// Parses `--checklist` and `--radiolist`, which take a tag, an item and an on/off status per entry.
+static bool ParseChecklistCommandLine(UI *ui, int *argc, const char ***argv) {
+    if ((*argc) == 0)
+        return Usage();
+    ui->Data.Menu.Text = (*argv)[0];
+    (*argc)--;
+    (*argv)++;
+
+    if (!ParseHeightAndWidth(ui, argc, argv) ||
+        !ParseUint32(&ui->Data.Menu.MenuHeight, argc, argv)) {
+        return false;
+    }
+
+    if (*argc % 3 != 0)
+        return Usage();
+    InitBitset(&ui->Data.Menu.Selection, *argc / 3);
+    ui->Data.Menu.SelectedItem = SIZE_MAX;
+    ui->Data.Menu.AnchorRow = -1;
+    while (*argc != 0) {
+        if (strcasecmp((*argv)[2], "on") == 0) {
+            if (ui->Type == ChecklistUIType)
+                SetBit(&ui->Data.Menu.Selection, ui->Data.Menu.ItemCount);
+            else if (ui->Data.Menu.SelectedItem == SIZE_MAX)
+                ui->Data.Menu.SelectedItem = ui->Data.Menu.ItemCount;
+        }
+        AddMenuItem(&ui->Data.Menu.Items,
+                    &ui->Data.Menu.ItemCount,
+                    &ui->Data.Menu.ItemCapacity,
+                    (*argv)[0],
+                    strlen((*argv)[0]),
+                    (*argv)[1],
+                    strlen((*argv)[1]));
+
+        (*argc) -= 3;
+        (*argv) += 3;
+    }
+    return true;
+}
+
+static bool ParseTextBoxCommandLine(UI *ui, int *argc, const char ***argv) {
+    if (*argc == 0)
+        return Usage();
+    const char *path = (*argv)[0];
+    (*argc)--;
+    (*argv)++;
+
+    if (!ParseHeightAndWidth(ui, argc, argv))
+        return false;
+
+    if (*argc != 0)
+        return Usage();
+
+    if (!OpenTextFile(&ui->Data.TextBox.File, path)) {
+        fprintf(stderr, "imdialog: couldn't open `%s`\n", path);
+        return false;
+    }
+    ui->Data.TextBox.Path = path;
+    ui->Data.TextBox.Follow = ui->Type == TailBoxUIType;
+    ui->Data.TextBox.WatchFD = -1;
+    ui->Data.TextBox.WatchDescriptor = -1;
+    return true;
+}
+
+static bool ParseGaugeCommandLine(UI *ui, int *argc, const char ***argv) {
+    if (*argc == 0)
+        return Usage();
+    snprintf(ui->Data.Gauge.Text, GAUGE_TEXT_SIZE, "%s", (*argv)[0]);
+    (*argc)--;
+    (*argv)++;
+
+    if (!ParseHeightAndWidth(ui, argc, argv))
+        return false;
+
+    if (*argc > 0) {
+        uint32_t percent = 0;
+        ParseUint32(&percent, argc, argv);
+        ui->Data.Gauge.Percent = (int)std::min(percent, (uint32_t)100);
+    }
+
+    if (*argc != 0)
+        return Usage();
+    return true;
+}
+
+// Like `--menu`, but with the items read from a file, or from stdin if the path is `-`.
+static bool ParseMenuFromCommandLine(UI *ui, int *argc, const char ***argv) {
+    if ((*argc) == 0)
+        return Usage();
+    ui->Data.Menu.Text = (*argv)[0];
+    (*argc)--;
+    (*argv)++;
+
+    if (!ParseHeightAndWidth(ui, argc, argv) ||
+        !ParseUint32(&ui->Data.Menu.MenuHeight, argc, argv)) {
+        return false;
+    }
+
+    if (*argc != 1)
+        return Usage();
+    const char *path = (*argv)[0];
+    (*argc)--;
+    (*argv)++;
+
+    if (strcmp(path, "-") == 0) {
+        ui->Data.Menu.ReadFromStdin = true;
+        return true;
+    }
+
+#ifdef IMDEBUG
+    uint64_t start_time = SDL_GetPerformanceCounter();
+#endif
+    if (!ReadMenuItems(path,
+                       ui->NullDelimited ? '\0' : '\n',
+                       &ui->Data.Menu.Items,
+                       &ui->Data.Menu.ItemCount,
+                       &ui->Data.Menu.ItemCapacity,
+                       &ui->Data.Menu.File)) {
+        fprintf(stderr, "imdialog: couldn't read menu items from `%s`\n", path);
+        return false;
+    }
+#ifdef IMDEBUG
+    fprintf(stderr,
+            "read %zu menu items from `%s` in %.2f ms\n",
+            ui->Data.Menu.ItemCount,
+            path,
+            (double)(SDL_GetPerformanceCounter() - start_time) * 1000.0 /
+            (double)SDL_GetPerformanceFrequency());
+#endif
+    return true;
+}
 
-    if (strcmp(argv[0], "--no-cancel") == 0) {
-        argc--;
-        argv++;
+// Parses the options shared by all dialogs, up to and including the name of the dialog.
+static bool ParseDialogOptions(UI *ui, int *argc, const char ***argv, bool *menu_from) {
+    while (*argc > 0) {
+        if (strcmp((*argv)[0], "--no-cancel") == 0) {
+            (*argc)--;
+            (*argv)++;
+        } else if (strcmp((*argv)[0], "--stat-threads") == 0) {
+            (*argc)--;
+            (*argv)++;
+            if (!ParseUint32(&ui->StatThreadCount, argc, argv))
+                return false;
+        } else if (strcmp((*argv)[0], "--sort") == 0) {
+            (*argc)--;
+            (*argv)++;
+            if (!ParseSortMode(&ui->FileSortMode, argc, argv))
+                return false;
+        } else if (strcmp((*argv)[0], "--dirs-first") == 0) {
+            ui->FileDirectoriesFirst = true;
+            (*argc)--;
+            (*argv)++;
+        } else if (strcmp((*argv)[0], "--size-column") == 0) {
+            ui->FileSizeColumn = true;
+            (*argc)--;
+            (*argv)++;
+        } else if (strcmp((*argv)[0], "--date-column") == 0) {
+            ui->FileDateColumn = true;
+            (*argc)--;
+            (*argv)++;
+        } else if (strcmp((*argv)[0], "--null") == 0) {
+            ui->NullDelimited = true;
+            (*argc)--;
+            (*argv)++;
+        } else if (strcmp((*argv)[0], "--find") == 0) {
+            ui->FileFind = true;
+            (*argc)--;
+            (*argv)++;
+        } else if (strcmp((*argv)[0], "--find-depth") == 0) {
+            (*argc)--;
+            (*argv)++;
+            if (!ParseUint32(&ui->FileFindDepth, argc, argv))
+                return false;
+        } else if (strcmp((*argv)[0], "--find-ignore") == 0) {
+            if (*argc < 2)
+                return Usage();
+            ui->FileFindIgnorePatterns =
+                (const char **)realloc(ui->FileFindIgnorePatterns,
+                                       sizeof(const char *) * (ui->FileFindIgnorePatternCount + 1));
+            ui->FileFindIgnorePatterns[ui->FileFindIgnorePatternCount++] = (*argv)[1];
+            (*argc) -= 2;
+            (*argv) += 2;
+        } else {
+            break;
+        }
     }
 
-    if (argc == 0)
-        Usage();
-    if (strcmp(argv[0], "--fselect") == 0)
-        ui.Type = FileUIType;
-    else if (strcmp(argv[0], "--inputbox") == 0)
-        ui.Type = InputUIType;
-    else if (strcmp(argv[0], "--menu") == 0)
-        ui.Type = MenuUIType;
+    if (*argc == 0)
+        return Usage();
+    if (strcmp((*argv)[0], "--fselect") == 0)
+        ui->Type = FileUIType;
+    else if (strcmp((*argv)[0], "--inputbox") == 0)
+        ui->Type = InputUIType;
+    else if (strcmp((*argv)[0], "--menu") == 0)
+        ui->Type = MenuUIType;
+    else if (strcmp((*argv)[0], "--menu-from") == 0) {
+        ui->Type = MenuUIType;
+        *menu_from = true;
+    } else if (strcmp((*argv)[0], "--checklist") == 0)
+        ui->Type = ChecklistUIType;
+    else if (strcmp((*argv)[0], "--radiolist") == 0)
+        ui->Type = RadiolistUIType;
+    else if (strcmp((*argv)[0], "--textbox") == 0)
+        ui->Type = TextBoxUIType;
+    else if (strcmp((*argv)[0], "--tailbox") == 0)
+        ui->Type = TailBoxUIType;
+    else if (strcmp((*argv)[0], "--gauge") == 0)
+        ui->Type = GaugeUIType;
     else
-        Usage();
+        return Usage();
+    (*argc)--;
+    (*argv)++;
+    return true;
+}
+
+// Parses the command line of one dialog into `ui`. Returns false, having reported why, if it's
+// wrong.
+static bool ParseCommandLine(int argc, const char **argv, UI *ui) {
+    memset(ui, 0, sizeof(*ui));
+    ui->StatThreadCount = DEFAULT_STAT_THREAD_COUNT;
+    ui->FileFindDepth = DEFAULT_FIND_DEPTH;
     argc--;
     argv++;
 
-    switch (ui.Type) {
+    bool menu_from = false;
+    if (!ParseDialogOptions(ui, &argc, &argv, &menu_from)) {
+        free(ui->FileFindIgnorePatterns);
+        return false;
+    }
+
+    bool parsed = false;
+    switch (ui->Type) {
     case FileUIType:
-        ParseFileCommandLine(&ui, &argc, &argv);
+        parsed = ParseFileCommandLine(ui, &argc, &argv);
         break;
     case InputUIType:
-        ParseInputCommandLine(&ui, &argc, &argv);
+        parsed = ParseInputCommandLine(ui, &argc, &argv);
         break;
     case MenuUIType:
-        ParseMenuCommandLine(&ui, &argc, &argv);
+        if (menu_from)
+            parsed = ParseMenuFromCommandLine(ui, &argc, &argv);
+        else
+            parsed = ParseMenuCommandLine(ui, &argc, &argv);
+        break;
+    case ChecklistUIType:
+    case RadiolistUIType:
+        parsed = ParseChecklistCommandLine(ui, &argc, &argv);
+        break;
+    case TextBoxUIType:
+    case TailBoxUIType:
+        parsed = ParseTextBoxCommandLine(ui, &argc, &argv);
+        break;
+    case GaugeUIType:
+        parsed = ParseGaugeCommandLine(ui, &argc, &argv);
         break;
     }
-
-    return ui;
+    if (!parsed)
+        free(ui->FileFindIgnorePatterns);
+    return parsed;
 }
 
 static void ProcessOKCancelButton(UIStatus *status, const char *data) {
@@ -302,6 +763,59 @@ static void ProcessOKCancelButton(UIStatus *status, const char *data) {
     }
 }
 
+// Safe to call from any thread.
+static void WakeMainLoop(void *data) {
+    if (g_WakePending.exchange(true))
+        return;
+    SDL_Event event;
+    memset(&event, 0, sizeof(event));
+    event.type = g_WakeEventType;
+    SDL_PushEvent(&event);
+}
+
+static bool IsKeyPressed(int key) {
+    return ImGui::IsKeyPressed(ImGui::GetIO().KeyMap[key]);
+}
+
+// Moves `*index` within a list of `count` items in response to the arrow, page, home and end
+// keys. Returns true if the selection moved.
+static bool ProcessListNavigationKeys(int *index, int count, int page_size) {
+    if (count == 0)
+        return false;
+    int new_index = *index;
+    if (IsKeyPressed(ImGuiKey_UpArrow))
+        new_index--;
+    if (IsKeyPressed(ImGuiKey_DownArrow))
+        new_index++;
+    if (IsKeyPressed(ImGuiKey_PageUp))
+        new_index -= page_size;
+    if (IsKeyPressed(ImGuiKey_PageDown))
+        new_index += page_size;
+    if (IsKeyPressed(ImGuiKey_Home))
+        new_index = 0;
+    if (IsKeyPressed(ImGuiKey_End))
+        new_index = count - 1;
+    if (new_index < 0)
+        new_index = 0;
+    if (new_index >= count)
+        new_index = count - 1;
+    if (new_index == *index)
+        return false;
+    *index = new_index;
+    return true;
+}
+
+// Scrolls the current window just enough to show row `index` of a list of `item_height`-tall rows.
+static void ScrollListToItem(int index, float item_height) {
+    float item_top = (float)index * item_height;
+    float scroll_y = ImGui::GetScrollY();
+    float visible_height = ImGui::GetWindowSize().y;
+    if (item_top < scroll_y)
+        ImGui::SetScrollY(item_top);
+    else if (item_top + item_height > scroll_y + visible_height)
+        ImGui::SetScrollY(item_top + item_height - visible_height);
+}
+
 // Caller is responsible for freeing the result.
 static char *GetFullPath(const char *path, size_t path_length, const char *filename) {
     size_t filename_length = strlen(filename) + 1;
@@ -310,8 +824,107 @@ static char *GetFullPath(const char *path, size_t path_length, const char *filen
     return full_path;
 }
 
-static UIStatus ProcessFileUI(UI *ui) {
-    UIStatus status = { false, 0 };
+#ifdef __linux__
+// Waits on the directory watch until it's stopped, flagging a change and waking the main loop
+// whenever the directory being shown changes. Events for watches that have since been replaced
+// (e.g. the `IN_IGNORED` that removing the old watch generates) are skipped.
+static void RunDirectoryWatch(DirectoryWatch *watch) {
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd poll_fds[2] = { { watch->FD, POLLIN, 0 }, { watch->StopFDs[0], POLLIN, 0 } };
+    while (true) {
+        if (poll(poll_fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (poll_fds[1].revents != 0)
+            break;
+        ssize_t length = read(watch->FD, buffer, sizeof(buffer));
+        if (length < 0 && errno != EINTR && errno != EAGAIN)
+            break;
+        bool changed = false;
+        for (char *ptr = buffer; length > 0 && ptr < buffer + length; ) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            if (event->wd == watch->Descriptor.load())
+                changed = true;
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+        if (changed) {
+            watch->Changed.store(true);
+            WakeMainLoop(NULL);
+        }
+    }
+}
+#endif
+
+// Points the inotify watch at the snapshot's directory, replacing the previous watch, and starts
+// the thread that waits on it if there isn't one yet. A listing with sizes and modification times
+// is also refreshed when the entries are written to or touched.
+static void WatchDirectorySnapshot(DirectorySnapshot *snapshot) {
+#ifdef __linux__
+    if (snapshot->Watch == NULL) {
+        int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0)
+            return;
+        int stop_fds[2];
+        if (pipe(stop_fds) != 0) {
+            close(fd);
+            return;
+        }
+        fcntl(stop_fds[0], F_SETFD, FD_CLOEXEC);
+        fcntl(stop_fds[1], F_SETFD, FD_CLOEXEC);
+        DirectoryWatch *watch = new DirectoryWatch();
+        watch->FD = fd;
+        watch->Descriptor.store(-1);
+        watch->Changed.store(false);
+        watch->StopFDs[0] = stop_fds[0];
+        watch->StopFDs[1] = stop_fds[1];
+        watch->Thread = std::thread(RunDirectoryWatch, watch);
+        snapshot->Watch = watch;
+    }
+
+    // Whatever changed before the new watch is in place is picked up by the scan that follows.
+    DirectoryWatch *watch = snapshot->Watch;
+    int descriptor = watch->Descriptor.exchange(-1);
+    if (descriptor >= 0)
+        inotify_rm_watch(watch->FD, descriptor);
+    watch->Changed.store(false);
+    uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF |
+        IN_MOVE_SELF | IN_ONLYDIR;
+    if (snapshot->HasMetadata)
+        mask |= IN_MODIFY | IN_ATTRIB;
+    watch->Descriptor.store(inotify_add_watch(watch->FD, snapshot->Path, mask));
+#endif
+}
+
+static void StopWatchingDirectorySnapshot(DirectorySnapshot *snapshot) {
+    DirectoryWatch *watch = snapshot->Watch;
+    if (watch == NULL)
+        return;
+    close(watch->StopFDs[1]);
+    watch->Thread.join();
+    close(watch->StopFDs[0]);
+    close(watch->FD);
+    delete watch;
+    snapshot->Watch = NULL;
+}
+
+// Returns true if anything in the watched directory changed since the last call.
+static bool DirectorySnapshotChanged(DirectorySnapshot *snapshot) {
+    return snapshot->Watch != NULL && snapshot->Watch->Changed.exchange(false);
+}
+
+// Sizes and modification times cost a stat per entry, so they're only fetched when shown or
+// sorted on.
+static bool NeedsFileMetadata(const UI *ui) {
+    return ui->FileSizeColumn || ui->FileDateColumn ||
+        ui->FileSortMode == DirectorySortByMTime || ui->FileSortMode == DirectorySortBySize;
+}
+
+// Resolves the nearest existing directory to `ui->Data.File.Path` and lists it into the snapshot.
+static void RefreshDirectorySnapshot(UI *ui) {
+    DirectorySnapshot *snapshot = &ui->Data.File.Snapshot;
+    free(snapshot->Path);
     char *path = strdup(ui->Data.File.Path);
     size_t path_length = strlen(path);
     if (path_length >= 1 && path[path_length - 1] == '/')
@@ -319,7 +932,7 @@ static UIStatus ProcessFileUI(UI *ui) {
 
     while (true) {
         struct stat stats = { 0 };
-        int error = stat(ui->Data.File.Path, &stats);
+        int error = stat(path, &stats);
         if (error == 0 && (stats.st_mode & S_IFDIR) != 0)
             break;
         char *ptr = strrchr(path, '/');
@@ -331,149 +944,942 @@ static UIStatus ProcessFileUI(UI *ui) {
         *ptr = '\0';
     }
 
-    bool at_root = strcmp(path, "/") == 0;
+    snapshot->Path = path;
+    snapshot->AtRoot = strcmp(path, "/") == 0;
+    snapshot->Valid = true;
+    snapshot->HasMetadata = NeedsFileMetadata(ui);
+    WatchDirectorySnapshot(snapshot);
+
+    if (snapshot->Scan != NULL)
+        StopDirectoryScan(snapshot->Scan);
+    ClearDirectoryListing(&snapshot->Listing);
+    ResetDirectoryView(&snapshot->View);
+    snapshot->Scan = StartDirectoryScan(path,
+                                        (int)ui->StatThreadCount,
+                                        snapshot->HasMetadata,
+                                        WakeMainLoop,
+                                        NULL);
+    snapshot->ScanStartTime = SDL_GetPerformanceCounter();
+}
+
+// Picks up whatever the background scan has found since the last frame. Returns true if the
+// view needs sorting again, because entries arrived or metadata the order depends on did.
+static bool UpdateDirectorySnapshot(UI *ui) {
+    DirectorySnapshot *snapshot = &ui->Data.File.Snapshot;
+    if (snapshot->Scan == NULL)
+        return false;
+    size_t entry_count = snapshot->Listing.EntryCount;
+    bool metadata_updated = false;
+    bool finished =
+        TakeDirectoryScanEntries(snapshot->Scan, &snapshot->Listing, &metadata_updated);
+    bool order_uses_metadata = ui->FileDirectoriesFirst ||
+        ui->FileSortMode == DirectorySortByMTime || ui->FileSortMode == DirectorySortBySize;
+    bool resort = snapshot->Listing.EntryCount != entry_count ||
+        (metadata_updated && order_uses_metadata);
+    if (!finished)
+        return resort;
+
+    StopDirectoryScan(snapshot->Scan);
+    snapshot->Scan = NULL;
+#ifdef IMDEBUG
+    fprintf(stderr,
+            "scanned %zu entries of `%s` in %.2f ms\n",
+            snapshot->Listing.EntryCount,
+            snapshot->Path,
+            (double)(SDL_GetPerformanceCounter() - snapshot->ScanStartTime) * 1000.0 /
+            (double)SDL_GetPerformanceFrequency());
+#endif
+    return resort;
+}
 
-    char **directory_entries = (char **)malloc(sizeof(char *) * INITIAL_DIRECTORY_ENTRY_CAPACITY);
-    size_t directory_entry_count = 0;
-    size_t directory_entry_capacity = INITIAL_DIRECTORY_ENTRY_CAPACITY;
+// Returns the listing index of the entry at list position `index`, or -1 for "Up one level".
+static int GetDirectorySnapshotEntryIndex(const DirectorySnapshot *snapshot, int index) {
+    if (!snapshot->AtRoot) {
+        if (index == 0)
+            return -1;
+        index--;
+    }
+    return (int)snapshot->View.Order[index];
+}
 
-    if (!at_root) {
-        directory_entries[0] = strdup("Up one level");
-        directory_entry_count++;
+// Re-sorts the snapshot's view, keeping the same entry selected.
+static void SortDirectorySnapshot(UI *ui) {
+    DirectorySnapshot *snapshot = &ui->Data.File.Snapshot;
+    int first_entry = snapshot->AtRoot ? 0 : 1;
+    int selected_entry = -1;
+    if (ui->Data.File.ItemIndex >= first_entry &&
+        ui->Data.File.ItemIndex < first_entry + (int)snapshot->View.Count) {
+        selected_entry = GetDirectorySnapshotEntryIndex(snapshot, ui->Data.File.ItemIndex);
     }
 
-    DIR *dir = opendir(path);
-    if (dir == NULL)
-        abort();
-    struct dirent *entry = NULL;
-    while ((entry = readdir(dir)) != NULL) {
-        if (entry->d_name[0] == '.')
-            continue;
-        if (directory_entry_count == directory_entry_capacity) {
-            directory_entry_capacity *= 2;
-            directory_entries = (char **)realloc(directory_entries,
-                                                 sizeof(char *) * directory_entry_capacity);
+#ifdef IMDEBUG
+    uint64_t start_time = SDL_GetPerformanceCounter();
+#endif
+    SortDirectoryView(&snapshot->View,
+                      &snapshot->Listing,
+                      ui->FileSortMode,
+                      ui->FileDirectoriesFirst);
+#ifdef IMDEBUG
+    if (snapshot->Scan == NULL) {
+        fprintf(stderr,
+                "sorted %zu entries by %s in %.2f ms\n",
+                snapshot->View.Count,
+                g_SortModeNames[ui->FileSortMode],
+                (double)(SDL_GetPerformanceCounter() - start_time) * 1000.0 /
+                (double)SDL_GetPerformanceFrequency());
+    }
+#endif
+
+    if (selected_entry < 0)
+        return;
+    for (size_t index = 0; index < snapshot->View.Count; index++) {
+        if (snapshot->View.Order[index] == (uint32_t)selected_entry) {
+            ui->Data.File.ItemIndex = first_entry + (int)index;
+            break;
         }
+    }
+}
 
-        char *full_path = GetFullPath(path, path_length, entry->d_name);
-        struct stat stats = { 0 };
-        stat(full_path, &stats);
-        free(full_path);
+// Ctrl+S cycles through the sort modes and Ctrl+D toggles listing directories first. Returns
+// true if the order changed.
+static bool ProcessSortKeys(UI *ui) {
+    if (!ImGui::GetIO().KeyCtrl)
+        return false;
+    if (ImGui::IsKeyPressed(SDLK_s, false)) {
+        ui->FileSortMode = (DirectorySortMode)((ui->FileSortMode + 1) % DirectorySortModeCount);
+        return true;
+    }
+    if (ImGui::IsKeyPressed(SDLK_d, false)) {
+        ui->FileDirectoriesFirst = !ui->FileDirectoriesFirst;
+        return true;
+    }
+    return false;
+}
 
-        size_t filename_length = strlen(entry->d_name);
-        directory_entries[directory_entry_count] = (char *)malloc(filename_length + 2);
-        snprintf(directory_entries[directory_entry_count],
-                 filename_length + 2,
-                 "%s%s",
-                 entry->d_name,
-                 (stats.st_mode & S_IFDIR) ? "/" : "");
-        directory_entry_count++;
+// Gets the label for list position `index`: "Up one level" comes first outside the root, and
+// directory names get a trailing slash.
+static void GetDirectorySnapshotItem(const DirectorySnapshot *snapshot,
+                                     int index,
+                                     const char **out_text) {
+    int entry_index = GetDirectorySnapshotEntryIndex(snapshot, index);
+    if (entry_index < 0) {
+        *out_text = "Up one level";
+        return;
     }
 
-    ImGui::PushItemWidth(ToPixelSize(WINDOW_WIDTH));
-    if (ImGui::ListBox("",
-                       &ui->Data.File.ItemIndex,
-                       (const char **)directory_entries,
-                       directory_entry_count,
-                       LIST_HEIGHT)) {
-        rewinddir(dir);
-
-        if (!at_root && ui->Data.File.ItemIndex == 0) {
-            // The first item is "up one level".
-            char *ptr = strrchr(path, '/');
-            assert(ptr != NULL);
-            *ptr = '\0';
+    const char *name = GetDirectoryListingName(&snapshot->Listing, entry_index);
+    if (snapshot->Listing.Types[entry_index] != DirectoryEntryTypeDirectory) {
+        *out_text = name;
+        return;
+    }
 
-            free(ui->Data.File.Path);
-            ui->Data.File.Path = strdup(path);
-        } else {
-            if (!at_root)
-                ui->Data.File.ItemIndex--;
-
-            int index = 0;
-            while (index < ui->Data.File.ItemIndex) {
-                struct dirent *entry = readdir(dir);
-                if (entry->d_name[0] == '.')
-                    continue;
-                index++;
-            }
+    static char label[NAME_MAX + 2];
+    snprintf(label, sizeof(label), "%s/", name);
+    *out_text = label;
+}
+
+static void FormatFileSize(char *buffer, size_t buffer_size, int64_t size) {
+    if (size < 0) {
+        buffer[0] = '\0';
+        return;
+    }
+    static const char units[] = "BKMGTP";
+    double value = (double)size;
+    int unit = 0;
+    while (value >= 1024.0 && units[unit + 1] != '\0') {
+        value /= 1024.0;
+        unit++;
+    }
+    if (unit == 0)
+        snprintf(buffer, buffer_size, "%lld B", (long long)size);
+    else
+        snprintf(buffer, buffer_size, "%.1f %c", value, units[unit]);
+}
+
+static void FormatFileDate(char *buffer, size_t buffer_size, int64_t mtime) {
+    buffer[0] = '\0';
+    if (mtime < 0)
+        return;
+    time_t time = (time_t)mtime;
+    struct tm local_time;
+    if (localtime_r(&time, &local_time) != NULL)
+        strftime(buffer, buffer_size, "%Y-%m-%d %H:%M", &local_time);
+}
+
+// Draws the size and date columns, where enabled, on the same line as the row just drawn.
+static void ProcessFileColumns(const UI *ui, int entry_index) {
+    const DirectoryListing *listing = &ui->Data.File.Snapshot.Listing;
+    char text[32];
+    float column_x = ToPixelSize(WINDOW_WIDTH);
+    if (ui->FileDateColumn)
+        column_x -= ToPixelSize(DATE_COLUMN_WIDTH);
+    if (ui->FileSizeColumn) {
+        column_x -= ToPixelSize(SIZE_COLUMN_WIDTH);
+        if (listing->Types[entry_index] != DirectoryEntryTypeDirectory) {
+            FormatFileSize(text, sizeof(text), listing->Sizes[entry_index]);
+            ImGui::SameLine(column_x);
+            ImGui::TextColored(LABEL_COLOR, "%s", text);
+        }
+        column_x += ToPixelSize(SIZE_COLUMN_WIDTH);
+    }
+    if (ui->FileDateColumn) {
+        FormatFileDate(text, sizeof(text), listing->MTimes[entry_index]);
+        ImGui::SameLine(column_x);
+        ImGui::TextColored(LABEL_COLOR, "%s", text);
+    }
+}
+
+// Enters the directory or picks the file at list position `index`.
+static void ActivateFileEntry(UI *ui, int index, UIStatus *status) {
+    DirectorySnapshot *snapshot = &ui->Data.File.Snapshot;
+    int entry_index = GetDirectorySnapshotEntryIndex(snapshot, index);
+    if (entry_index < 0) {
+        char *ptr = strrchr(snapshot->Path, '/');
+        assert(ptr != NULL);
+        *ptr = '\0';
 
-            struct dirent *entry = NULL;
-            do {
-                entry = readdir(dir);
-            } while (entry != NULL && entry->d_name[0] == '.');
-            if (entry == NULL)
-                abort();
-            
-            char *full_path = GetFullPath(path, path_length, entry->d_name);
+        free(ui->Data.File.Path);
+        ui->Data.File.Path = strdup(snapshot->Path);
+    } else {
+        // The snapshot usually already knows which entries are directories, so the selection
+        // needs no further filesystem access unless the entry's type is still being looked up.
+        const char *name = GetDirectoryListingName(&snapshot->Listing, entry_index);
+        char *full_path = GetFullPath(snapshot->Path, strlen(snapshot->Path), name);
+        bool is_directory = snapshot->Listing.Types[entry_index] == DirectoryEntryTypeDirectory;
+        if (snapshot->Listing.Types[entry_index] == DirectoryEntryTypePending) {
             struct stat stats = { 0 };
-            stat(full_path, &stats);
-
-            if ((stats.st_mode & S_IFDIR) == 0) {
-                status.Done = true;
-                status.ExitCode = 0;
-                fprintf(stderr, "%s\n", full_path);
-            } else {
-                free(ui->Data.File.Path);
-                ui->Data.File.Path = strdup(full_path);
-            }
+            is_directory = stat(full_path, &stats) == 0 && S_ISDIR(stats.st_mode);
+        }
 
-            free(full_path);
+        if (!is_directory) {
+            status->Done = true;
+            status->ExitCode = 0;
+            fprintf(stderr, "%s\n", full_path);
+        } else {
+            free(ui->Data.File.Path);
+            ui->Data.File.Path = strdup(full_path);
         }
 
-        ui->Data.File.ItemIndex = 0;
+        free(full_path);
     }
-    ImGui::PopItemWidth();
 
-    closedir(dir);
+    snapshot->Valid = false;
+    ui->Data.File.ItemIndex = 0;
+}
 
-    const ImVec2 button_size(ToPixelSize(WINDOW_WIDTH), 0.0);
-    if (ImGui::Button("Cancel", button_size)) {
-        status.Done = true;
-        status.ExitCode = 1;
+// Draws the directory listing and handles selecting from it.
+static void ProcessDirectoryList(UI *ui, UIStatus *status) {
+    DirectorySnapshot *snapshot = &ui->Data.File.Snapshot;
+    if (snapshot->Scan != NULL) {
+        ImGui::PushFont(g_ImDialogState.labelFont);
+        ImGui::TextColored(LABEL_COLOR, "Scanning... %zu entries", snapshot->Listing.EntryCount);
+        ImGui::PopFont();
     }
 
-    for (size_t index = 0; index < directory_entry_count; index++)
-        free(directory_entries[index]);
-    free(directory_entries);
-    free(path);
-
-    return status;
-}
+    int item_count = (int)snapshot->View.Count + (snapshot->AtRoot ? 0 : 1);
+    bool moved = ProcessListNavigationKeys(&ui->Data.File.ItemIndex, item_count, LIST_HEIGHT);
+    int activated_index = -1;
+    if (item_count > 0 && IsKeyPressed(ImGuiKey_Enter))
+        activated_index = ui->Data.File.ItemIndex;
 
-static UIStatus ProcessInputUI(UI *ui) {
-    UIStatus status = { false, 0 };
-    const ImVec2 button_size(ToPixelSize(WINDOW_WIDTH), 0.0);
-    ImGui::Text(ui->Data.Input.Text);
     ImGui::PushItemWidth(ToPixelSize(WINDOW_WIDTH));
-    if (ImGui::InputText("",
-                         ui->Data.Input.Data,
-                         MAX_TEXT_SIZE,
-                         ImGuiInputTextFlags_EnterReturnsTrue)) {
-        status.Done = true;
-        status.ExitCode = 0;
-        fprintf(stderr, "%s\n", ui->Data.Input.Data);
+    if (ImGui::ListBoxHeader("##files", item_count, LIST_HEIGHT)) {
+        float item_height = ImGui::GetTextLineHeightWithSpacing();
+        if (moved)
+            ScrollListToItem(ui->Data.File.ItemIndex, item_height);
+
+        // Only the rows in view are submitted, so drawing a huge directory costs no more than a
+        // small one.
+        ImGuiListClipper clipper(item_count, item_height);
+        for (int index = clipper.DisplayStart; index < clipper.DisplayEnd; index++) {
+            const char *label = NULL;
+            GetDirectorySnapshotItem(snapshot, index, &label);
+            NoteText(label);
+            int entry_index = GetDirectorySnapshotEntryIndex(snapshot, index);
+            // Entries whose type is still being looked up are dimmed until it arrives.
+            bool pending = entry_index >= 0 &&
+                snapshot->Listing.Types[entry_index] == DirectoryEntryTypePending;
+            if (pending)
+                ImGui::PushStyleColor(ImGuiCol_Text, LABEL_COLOR);
+            ImGui::PushID(index);
+            if (ImGui::Selectable(label, index == ui->Data.File.ItemIndex))
+                activated_index = index;
+            ImGui::PopID();
+            if (pending)
+                ImGui::PopStyleColor();
+            if (entry_index >= 0)
+                ProcessFileColumns(ui, entry_index);
+        }
+        clipper.End();
+        ImGui::ListBoxFooter();
     }
     ImGui::PopItemWidth();
-    ProcessOKCancelButton(&status, ui->Data.Input.Data);
-    return status;
+
+    if (activated_index >= 0)
+        ActivateFileEntry(ui, activated_index, status);
 }
 
-static UIStatus ProcessMenuUI(UI *ui) {
-    UIStatus status = { false, 0 };
-    const ImVec2 button_size(ToPixelSize(WINDOW_WIDTH), 0.0);
-    for (size_t item_index = 0; item_index < ui->Data.Menu.ItemCount; item_index++) {
-        const MenuItem *item = &ui->Data.Menu.Items[item_index];
-        if (ImGui::Selectable(item->Tag, false, 0, button_size)) {
-            status.Done = true;
-            fprintf(stderr, "%s\n", item->Tag);
-        }
-        if (item->Item != NULL) {
-            ImGui::PushFont(g_ImDialogState.labelFont);
-            ImGui::TextColored(LABEL_COLOR, item->Item);
-            ImGui::PopFont();
+// Makes the path of a type-to-find match absolute. Returns NULL if it's too long to be written out.
+// Caller is responsible for freeing the result.
+static char *GetFindMatchPath(const FileIndex *index, uint32_t entry) {
+    char relative_path[PATH_MAX];
+    if (!GetFileIndexPath(index, entry, relative_path, sizeof(relative_path)))
+        return NULL;
+    const char *root = GetFileIndexRoot(index);
+    if (strcmp(root, "/") == 0)
+        root = "";
+    return GetFullPath(root, strlen(root), relative_path);
+}
+
+// Browses into the directory or picks the file of type-to-find match `match_index`.
+static void ActivateFindMatch(UI *ui, int match_index, UIStatus *status) {
+    FileUI *file = &ui->Data.File;
+    uint32_t entry = file->Matcher.Results[match_index].Entry;
+    char *full_path = GetFindMatchPath(file->Index, entry);
+    // The indexer leaves out paths this long, but a path cut short must never be picked.
+    if (full_path == NULL)
+        return;
+    if (!IsFileIndexDirectory(file->Index, entry)) {
+        status->Done = true;
+        status->ExitCode = 0;
+        fprintf(stderr, "%s\n", full_path);
+        free(full_path);
+        return;
+    }
+
+    free(file->Path);
+    file->Path = full_path;
+    file->Snapshot.Valid = false;
+    file->ItemIndex = 0;
+    file->FindQuery[0] = '\0';
+    file->FindItemIndex = 0;
+}
+
+// Draws the type-to-find box and, while a query is entered, its ranked matches in place of the
+// directory listing. Returns true if the matches were shown.
+static bool ProcessFindUI(UI *ui, UIStatus *status) {
+    FileUI *file = &ui->Data.File;
+    if (file->Index == NULL) {
+        file->Index = StartFileIndex(file->Snapshot.Path,
+                                     (int)ui->FileFindDepth,
+                                     ui->FileFindIgnorePatterns,
+                                     ui->FileFindIgnorePatternCount,
+                                     WakeMainLoop,
+                                     NULL);
+        file->IndexStartTime = SDL_GetPerformanceCounter();
+        InitFuzzyMatcher(&file->Matcher);
+        ImGui::SetKeyboardFocusHere();
+    }
+#ifdef IMDEBUG
+    if (!file->IndexFinished && IsFileIndexFinished(file->Index)) {
+        fprintf(stderr,
+                "indexed %zu entries under `%s` in %.2f ms\n",
+                GetFileIndexEntryCount(file->Index),
+                GetFileIndexRoot(file->Index),
+                (double)(SDL_GetPerformanceCounter() - file->IndexStartTime) * 1000.0 /
+                (double)SDL_GetPerformanceFrequency());
+    }
+#endif
+    file->IndexFinished = IsFileIndexFinished(file->Index);
+
+    ImGui::PushItemWidth(ToPixelSize(WINDOW_WIDTH));
+    NoteText(file->FindQuery);
+    if (ImGui::InputText("##find", file->FindQuery, sizeof(file->FindQuery))) {
+        file->FindItemIndex = 0;
+        file->FindQueryTime = SDL_GetPerformanceCounter();
+    }
+    NoteText(file->FindQuery);
+    ImGui::PopItemWidth();
+    if (file->FindQuery[0] == '\0')
+        return false;
+
+    SetFuzzyMatcherQuery(&file->Matcher, file->FindQuery);
+    if (UpdateFuzzyMatcher(&file->Matcher, file->Index, FIND_MATCH_BUDGET)) {
+        // Matching ran out of time for this frame, so come straight back for more.
+        WakeMainLoop(NULL);
+    } else if (file->FindQueryTime != 0) {
+#ifdef IMDEBUG
+        fprintf(stderr,
+                "matched `%s` against %zu entries in %.2f ms\n",
+                file->FindQuery,
+                GetFileIndexEntryCount(file->Index),
+                (double)(SDL_GetPerformanceCounter() - file->FindQueryTime) * 1000.0 /
+                (double)SDL_GetPerformanceFrequency());
+#endif
+        file->FindQueryTime = 0;
+    }
+
+    ImGui::PushFont(g_ImDialogState.labelFont);
+    if (file->IndexFinished) {
+        ImGui::TextColored(LABEL_COLOR,
+                           "%zu matches",
+                           GetFuzzyMatchCount(&file->Matcher));
+    } else {
+        ImGui::TextColored(LABEL_COLOR,
+                           "%zu matches (indexing... %zu entries)",
+                           GetFuzzyMatchCount(&file->Matcher),
+                           GetFileIndexEntryCount(file->Index));
+    }
+    ImGui::PopFont();
+
+    int item_count = (int)file->Matcher.ResultCount;
+    if (file->FindItemIndex >= item_count)
+        file->FindItemIndex = item_count > 0 ? item_count - 1 : 0;
+    bool moved = ProcessListNavigationKeys(&file->FindItemIndex, item_count, LIST_HEIGHT);
+    int activated_index = -1;
+    if (item_count > 0 && IsKeyPressed(ImGuiKey_Enter))
+        activated_index = file->FindItemIndex;
+
+    ImGui::PushItemWidth(ToPixelSize(WINDOW_WIDTH));
+    if (ImGui::ListBoxHeader("##matches", item_count, LIST_HEIGHT)) {
+        float item_height = ImGui::GetTextLineHeightWithSpacing();
+        if (moved)
+            ScrollListToItem(file->FindItemIndex, item_height);
+
+        ImGuiListClipper clipper(item_count, item_height);
+        for (int index = clipper.DisplayStart; index < clipper.DisplayEnd; index++) {
+            uint32_t entry = file->Matcher.Results[index].Entry;
+            char label[PATH_MAX + 1];
+            GetFileIndexPath(file->Index, entry, label, sizeof(label) - 1);
+            if (IsFileIndexDirectory(file->Index, entry))
+                strcat(label, "/");
+            NoteText(label);
+            ImGui::PushID(index);
+            if (ImGui::Selectable(label, index == file->FindItemIndex))
+                activated_index = index;
+            ImGui::PopID();
+        }
+        clipper.End();
+        ImGui::ListBoxFooter();
+    }
+    ImGui::PopItemWidth();
+
+    if (activated_index >= 0)
+        ActivateFindMatch(ui, activated_index, status);
+    return true;
+}
+
+static UIStatus ProcessFileUI(UI *ui) {
+    UIStatus status = { false, 0 };
+    DirectorySnapshot *snapshot = &ui->Data.File.Snapshot;
+    bool resort = ProcessSortKeys(ui);
+    if (!snapshot->Valid ||
+        DirectorySnapshotChanged(snapshot) ||
+        (NeedsFileMetadata(ui) && !snapshot->HasMetadata)) {
+        RefreshDirectorySnapshot(ui);
+    }
+    if (UpdateDirectorySnapshot(ui))
+        resort = true;
+    if (resort)
+        SortDirectorySnapshot(ui);
+
+    bool finding = ui->FileFind && ProcessFindUI(ui, &status);
+    if (!finding)
+        ProcessDirectoryList(ui, &status);
+
+    const ImVec2 button_size(ToPixelSize(WINDOW_WIDTH), 0.0);
+    if (ImGui::Button("Cancel", button_size)) {
+        status.Done = true;
+        status.ExitCode = 1;
+    }
+
+    return status;
+}
+
+static UIStatus ProcessInputUI(UI *ui) {
+    UIStatus status = { false, 0 };
+    const ImVec2 button_size(ToPixelSize(WINDOW_WIDTH), 0.0);
+    NoteText(ui->Data.Input.Text);
+    NoteText(ui->Data.Input.Data);
+    ImGui::Text(ui->Data.Input.Text);
+    ImGui::PushItemWidth(ToPixelSize(WINDOW_WIDTH));
+    if (ImGui::InputText("",
+                         ui->Data.Input.Data,
+                         MAX_TEXT_SIZE,
+                         ImGuiInputTextFlags_EnterReturnsTrue)) {
+        status.Done = true;
+        status.ExitCode = 0;
+        fprintf(stderr, "%s\n", ui->Data.Input.Data);
+    }
+    NoteText(ui->Data.Input.Data);
+    ImGui::PopItemWidth();
+    ProcessOKCancelButton(&status, ui->Data.Input.Data);
+    return status;
+}
+
+static int RejectSpace(ImGuiTextEditCallbackData *data) {
+    return data->EventChar == ' ';
+}
+
+// Draws the filter box and keeps the filter up to date. Returns true if a query is entered, in
+// which case only the items in `ui->Data.Menu.Filter.Matches` should be shown.
+static bool ProcessMenuFilter(UI *ui) {
+    MenuUI *menu = &ui->Data.Menu;
+    if (!menu->FilterInitialized) {
+        InitTextFilter(&menu->Filter);
+        ImGui::SetKeyboardFocusHere();
+        menu->FilterInitialized = true;
+    }
+
+    // In checklists and radiolists, space toggles the selected row instead.
+    ImGui::PushItemWidth(ToPixelSize(WINDOW_WIDTH));
+    NoteText(menu->FilterQuery);
+    bool changed = ui->Type == MenuUIType ?
+        ImGui::InputText("##filter", menu->FilterQuery, sizeof(menu->FilterQuery)) :
+        ImGui::InputText("##filter",
+                         menu->FilterQuery,
+                         sizeof(menu->FilterQuery),
+                         ImGuiInputTextFlags_CallbackCharFilter,
+                         RejectSpace);
+    NoteText(menu->FilterQuery);
+    ImGui::PopItemWidth();
+    if (menu->FilterQuery[0] == '\0' && !changed)
+        return false;
+
+#ifdef IMDEBUG
+    uint64_t start_time = SDL_GetPerformanceCounter();
+#endif
+    // Tags and items are matched together, so a query can hit either.
+    while (menu->Filter.RecordCount < menu->ItemCount) {
+        const MenuItem *item = &menu->Items[menu->Filter.RecordCount];
+        const char *fields[2] = { item->Tag, item->Item };
+        size_t field_lengths[2] = { item->TagLength, item->ItemLength };
+        AddTextFilterRecord(&menu->Filter, fields, field_lengths, 2);
+    }
+    if (changed) {
+        SetTextFilterQuery(&menu->Filter, menu->FilterQuery);
+        menu->ItemIndex = 0;
+        menu->AnchorRow = -1;
+    } else
+        UpdateTextFilter(&menu->Filter);
+#ifdef IMDEBUG
+    if (changed) {
+        fprintf(stderr,
+                "filtered %zu menu items for `%s` in %.3f ms (%zu matches)\n",
+                menu->ItemCount,
+                menu->FilterQuery,
+                (double)(SDL_GetPerformanceCounter() - start_time) * 1000.0 /
+                (double)SDL_GetPerformanceFrequency(),
+                menu->Filter.MatchCount);
+    }
+#endif
+    return menu->FilterQuery[0] != '\0';
+}
+
+static inline size_t GetMenuRowItem(const MenuUI *menu, bool filtered, int row) {
+    return filtered ? menu->Filter.Matches[row] : (size_t)row;
+}
+
+// Toggles the choice of row `row` of a checklist or radiolist. With `extend`, a checklist instead
+// gives every row from the anchor to `row` the anchor's state.
+static void ChooseMenuRow(UI *ui, bool filtered, int row, int row_count, bool extend) {
+    MenuUI *menu = &ui->Data.Menu;
+    size_t item_index = GetMenuRowItem(menu, filtered, row);
+    if (ui->Type == RadiolistUIType) {
+        menu->SelectedItem = item_index;
+        return;
+    }
+    if (!extend || menu->AnchorRow < 0 || menu->AnchorRow >= row_count) {
+        ToggleBit(&menu->Selection, item_index);
+        menu->AnchorRow = row;
+        return;
+    }
+
+    int first_row = std::min(menu->AnchorRow, row), last_row = std::max(menu->AnchorRow, row);
+    bool value = TestBit(&menu->Selection, GetMenuRowItem(menu, filtered, menu->AnchorRow));
+    if (!filtered) {
+        SetBitRange(&menu->Selection, first_row, last_row + 1, value);
+        return;
+    }
+    for (int range_row = first_row; range_row <= last_row; range_row++) {
+        if (value)
+            SetBit(&menu->Selection, menu->Filter.Matches[range_row]);
+        else
+            ClearBit(&menu->Selection, menu->Filter.Matches[range_row]);
+    }
+}
+
+// Ctrl+T checks every row of a checklist and Ctrl+I inverts them. Without a filter, whole words
+// of the selection are set at once. The filter box has the keyboard, and imgui's text editing
+// takes Ctrl+A, C, V, X, Y and Z, so none of those are used here.
+static void ProcessChecklistKeys(UI *ui, bool filtered) {
+    MenuUI *menu = &ui->Data.Menu;
+    if (ui->Type != ChecklistUIType || !ImGui::GetIO().KeyCtrl)
+        return;
+    bool check_all = ImGui::IsKeyPressed(SDLK_t, false);
+    bool invert = ImGui::IsKeyPressed(SDLK_i, false);
+    if (!check_all && !invert)
+        return;
+
+    if (!filtered) {
+        if (invert)
+            InvertBitRange(&menu->Selection, 0, menu->ItemCount);
+        else
+            SetBitRange(&menu->Selection, 0, menu->ItemCount, true);
+        return;
+    }
+    for (size_t match = 0; match < menu->Filter.MatchCount; match++) {
+        if (invert)
+            ToggleBit(&menu->Selection, menu->Filter.Matches[match]);
+        else
+            SetBit(&menu->Selection, menu->Filter.Matches[match]);
+    }
+}
+
+static void WriteMenuTag(char *buffer,
+                         size_t *buffer_used,
+                         size_t buffer_size,
+                         const MenuItem *item) {
+    if (*buffer_used + item->TagLength + 1 > buffer_size) {
+        fwrite(buffer, 1, *buffer_used, stderr);
+        *buffer_used = 0;
+    }
+    if (item->TagLength + 1 > buffer_size) {
+        fwrite(item->Tag, 1, item->TagLength, stderr);
+        fputc('\n', stderr);
+        return;
+    }
+    memcpy(&buffer[*buffer_used], item->Tag, item->TagLength);
+    buffer[*buffer_used + item->TagLength] = '\n';
+    *buffer_used += item->TagLength + 1;
+}
+
+// Writes the tags of the chosen items, one per line, through a fixed-size buffer, since stderr
+// is unbuffered and there may be tens of thousands of them.
+static void WriteChosenMenuItems(const UI *ui) {
+    const MenuUI *menu = &ui->Data.Menu;
+    char buffer[65536];
+    size_t buffer_used = 0;
+    if (ui->Type == RadiolistUIType) {
+        if (menu->SelectedItem != SIZE_MAX)
+            WriteMenuTag(buffer, &buffer_used, sizeof(buffer), &menu->Items[menu->SelectedItem]);
+    } else {
+        for (size_t item_index = FindNextSetBit(&menu->Selection, 0);
+             item_index < menu->ItemCount;
+             item_index = FindNextSetBit(&menu->Selection, item_index + 1)) {
+            WriteMenuTag(buffer, &buffer_used, sizeof(buffer), &menu->Items[item_index]);
         }
     }
+    fwrite(buffer, 1, buffer_used, stderr);
+}
+
+static UIStatus ProcessMenuUI(UI *ui) {
+    UIStatus status = { false, 0 };
+    MenuUI *menu = &ui->Data.Menu;
+    const ImVec2 button_size(ToPixelSize(WINDOW_WIDTH), 0.0);
+    if (menu->ReadFromStdin) {
+        menu->Stream = StartMenuItemStream(dup(STDIN_FILENO),
+                                           ui->NullDelimited ? '\0' : '\n',
+                                           WakeMainLoop,
+                                           NULL);
+        menu->ReadFromStdin = false;
+    }
+    // The items point into the stream's buffers, so the stream is kept around once it has ended.
+    if (menu->Stream != NULL &&
+        TakeMenuItemStreamItems(menu->Stream,
+                                &menu->Items,
+                                &menu->ItemCount,
+                                &menu->ItemCapacity)) {
+        ImGui::PushFont(g_ImDialogState.labelFont);
+        ImGui::TextColored(LABEL_COLOR, "Reading... %zu items", menu->ItemCount);
+        ImGui::PopFont();
+    }
+
+    bool choosing = ui->Type != MenuUIType;
+    bool filtered = ProcessMenuFilter(ui);
+    int row_count = (int)(filtered ? menu->Filter.MatchCount : menu->ItemCount);
+    if (ui->Type == ChecklistUIType) {
+        ImGui::PushFont(g_ImDialogState.labelFont);
+        ImGui::TextColored(LABEL_COLOR, "%zu selected", CountBits(&menu->Selection));
+        ImGui::PopFont();
+    }
+
+    // Each row is a tag followed by a line of item text in the label font.
+    float row_height = ImGui::GetTextLineHeightWithSpacing() +
+        g_ImDialogState.labelFont->FontSize * g_ImDialogState.labelFont->Scale +
+        ImGui::GetStyle().ItemSpacing.y;
+    int page_size = menu->MenuHeight != 0 ? (int)menu->MenuHeight : LIST_HEIGHT;
+
+    bool moved = ProcessListNavigationKeys(&menu->ItemIndex, row_count, page_size);
+    int activated_row = -1;
+    bool confirmed = false;
+    if (row_count > 0 && IsKeyPressed(ImGuiKey_Enter)) {
+        activated_row = menu->ItemIndex;
+        confirmed = true;
+    }
+    if (choosing) {
+        ProcessChecklistKeys(ui, filtered);
+        if (row_count > 0 && ImGui::IsKeyPressed(SDLK_SPACE))
+            activated_row = menu->ItemIndex;
+    }
+
+    // The menu scrolls within a viewport `MenuHeight` rows tall, and only the rows in view are
+    // submitted, so huge menus cost no more per frame than small ones.
+    ImGui::BeginChild("##menu", ImVec2(button_size.x, row_height * (float)page_size));
+    if (moved)
+        ScrollListToItem(menu->ItemIndex, row_height);
+    ImGuiListClipper clipper(row_count, row_height);
+    for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++) {
+        size_t item_index = GetMenuRowItem(menu, filtered, row);
+        const MenuItem *item = &menu->Items[item_index];
+        const char *mark = "";
+        if (ui->Type == ChecklistUIType)
+            mark = TestBit(&menu->Selection, item_index) ? "[x] " : "[ ] ";
+        else if (ui->Type == RadiolistUIType)
+            mark = menu->SelectedItem == item_index ? "(*) " : "( ) ";
+        char tag[MAX_TEXT_SIZE];
+        snprintf(tag, sizeof(tag), "%s%.*s", mark, (int)item->TagLength, item->Tag);
+        NoteText(tag);
+        NoteText(item->Item, item->Item + item->ItemLength);
+        ImGui::PushID(row);
+        if (ImGui::Selectable(tag, row == menu->ItemIndex, 0, button_size))
+            activated_row = row;
+        ImGui::PopID();
+        ImGui::PushFont(g_ImDialogState.labelFont);
+        ImGui::TextColored(LABEL_COLOR, "%.*s", (int)item->ItemLength, item->Item);
+        ImGui::PopFont();
+    }
+    clipper.End();
+    ImGui::EndChild();
+
+    if (!choosing) {
+        if (activated_row >= 0) {
+            status.Done = true;
+            const MenuItem *item = &menu->Items[GetMenuRowItem(menu, filtered, activated_row)];
+            fprintf(stderr, "%.*s\n", (int)item->TagLength, item->Tag);
+        }
+        return status;
+    }
+
+    if (activated_row >= 0 && !confirmed) {
+        menu->ItemIndex = activated_row;
+        ChooseMenuRow(ui, filtered, activated_row, row_count, ImGui::GetIO().KeyShift);
+    }
+    if (ImGui::Button("OK", button_size))
+        confirmed = true;
+    if (confirmed) {
+        status.Done = true;
+        status.ExitCode = 0;
+        WriteChosenMenuItems(ui);
+    }
+    if (ImGui::Button("Cancel", button_size)) {
+        status.Done = true;
+        status.ExitCode = 1;
+    }
+    return status;
+}
+
+#ifdef __linux__
+// Blocks on the tailed file's inotify watch, waking the main loop whenever the file changes.
+// Each frame checks the file's size anyway, so the events themselves are just thrown away, except
+// for the `IN_IGNORED` that removing the watch generates, which ends the thread.
+static void RunTailWatch(int watch_fd) {
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool watching = true;
+    while (watching) {
+        ssize_t length = read(watch_fd, buffer, sizeof(buffer));
+        if (length < 0 && errno != EINTR)
+            break;
+        for (char *ptr = buffer; length > 0 && ptr < buffer + length; ) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            if ((event->mask & IN_IGNORED) != 0)
+                watching = false;
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+        WakeMainLoop(NULL);
+    }
+}
+#endif
+
+static void StartTailWatch(UI *ui) {
+#ifdef __linux__
+    TextBoxUI *text_box = &ui->Data.TextBox;
+    text_box->WatchFD = inotify_init1(IN_CLOEXEC);
+    if (text_box->WatchFD < 0)
+        return;
+    text_box->WatchDescriptor = inotify_add_watch(text_box->WatchFD,
+                                                  text_box->Path,
+                                                  IN_MODIFY | IN_ATTRIB);
+    if (text_box->WatchDescriptor < 0)
+        return;
+    text_box->WatchThread = new std::thread(RunTailWatch, text_box->WatchFD);
+#endif
+}
+
+static void StopTailWatch(UI *ui) {
+#ifdef __linux__
+    TextBoxUI *text_box = &ui->Data.TextBox;
+    if (text_box->WatchThread != NULL) {
+        inotify_rm_watch(text_box->WatchFD, text_box->WatchDescriptor);
+        text_box->WatchThread->join();
+        delete text_box->WatchThread;
+        text_box->WatchThread = NULL;
+    }
+    if (text_box->WatchFD >= 0)
+        close(text_box->WatchFD);
+    text_box->WatchFD = -1;
+#endif
+}
+
+// Returns the start of the top line of the last page of `rows` lines.
+static uint64_t FindLastTextPage(TextFile *file, int rows) {
+    uint64_t line_start = FindLastTextLine(file);
+    for (int row = 1; row < rows && line_start > 0; row++)
+        line_start = FindPreviousTextLine(file, line_start);
+    return line_start;
+}
+
+// Moves the view of a text box in response to the arrow, page, home and end keys and the mouse
+// wheel. Each step only looks at the lines it moves over.
+static void ProcessTextBoxNavigation(UI *ui, int rows, uint64_t last_page, bool hovered) {
+    TextBoxUI *text_box = &ui->Data.TextBox;
+    int step = 0;
+    if (IsKeyPressed(ImGuiKey_UpArrow))
+        step--;
+    if (IsKeyPressed(ImGuiKey_DownArrow))
+        step++;
+    if (IsKeyPressed(ImGuiKey_PageUp))
+        step -= rows;
+    if (IsKeyPressed(ImGuiKey_PageDown))
+        step += rows;
+    if (hovered)
+        step -= (int)ImGui::GetIO().MouseWheel * 3;
+
+    for (; step < 0 && text_box->TopOffset > 0; step++)
+        text_box->TopOffset = FindPreviousTextLine(&text_box->File, text_box->TopOffset);
+    for (; step > 0 && text_box->TopOffset < last_page; step--)
+        text_box->TopOffset = FindNextTextLine(&text_box->File, text_box->TopOffset);
+
+    if (IsKeyPressed(ImGuiKey_Home))
+        text_box->TopOffset = 0;
+    if (IsKeyPressed(ImGuiKey_End))
+        text_box->TopOffset = last_page;
+    if (text_box->TopOffset > last_page)
+        text_box->TopOffset = last_page;
+}
+
+// Picks up a change in the size of a text box's file. Returns true if it changed.
+static bool RefreshTextBox(TextBoxUI *text_box) {
+    if (!RefreshTextFileSize(&text_box->File))
+        return false;
+    if (text_box->TopOffset > text_box->File.Size) {
+        // Truncated.
+        text_box->TopOffset = 0;
+    }
+    return true;
+}
+
+static UIStatus ProcessTextBoxUI(UI *ui) {
+    UIStatus status = { false, 0 };
+    TextBoxUI *text_box = &ui->Data.TextBox;
+    TextFile *file = &text_box->File;
+    const ImVec2 button_size(ToPixelSize(WINDOW_WIDTH), 0.0);
+    int rows = ui->Height != 0 ? (int)ui->Height : DEFAULT_TEXT_BOX_HEIGHT;
+
+    if (ui->Type == TailBoxUIType && text_box->WatchFD < 0)
+        StartTailWatch(ui);
+    RefreshTextBox(text_box);
+    uint64_t last_page = FindLastTextPage(file, rows);
+    if (text_box->Follow)
+        text_box->TopOffset = last_page;
+    text_box->TopOffset = FindTextLineStart(file, std::min(text_box->TopOffset, last_page));
+
+    ImGui::PushFont(g_ImDialogState.labelFont);
+    float row_height = ImGui::GetTextLineHeightWithSpacing();
+    ImGui::BeginChild("##text", ImVec2(button_size.x, row_height * (float)rows));
+    ProcessTextBoxNavigation(ui, rows, last_page, ImGui::IsWindowHovered());
+    if (ui->Type == TailBoxUIType)
+        text_box->Follow = text_box->TopOffset == last_page;
+
+    // Lines are copied out of the file rather than drawn from its mapping, so that a read that
+    // fails, as when a log is truncated under the view, fails here and not inside imgui.
+    char line[TEXT_FILE_MAX_LINE_LENGTH];
+    uint64_t line_start = text_box->TopOffset;
+    for (int row = 0; row < rows && line_start < file->Size && file->Error == 0; row++) {
+        uint64_t next_line_start = FindNextTextLine(file, line_start);
+        size_t length = (size_t)std::min(next_line_start - line_start,
+                                         (uint64_t)TEXT_FILE_MAX_LINE_LENGTH);
+        if (!ReadTextFile(file, line_start, length, line))
+            break;
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+            length--;
+        NoteText(line, line + length);
+        ImGui::TextUnformatted(line, line + length);
+        line_start = next_line_start;
+    }
+    ImGui::EndChild();
+
+    if (file->Error != 0) {
+        // A file that was truncated under the view is just shown again at its new size.
+        int error = file->Error;
+        if (RefreshTextBox(text_box)) {
+            WakeMainLoop(NULL);
+        } else {
+            NoteText(strerror(error));
+            NoteText(text_box->Path);
+            ImGui::TextColored(LABEL_COLOR,
+                               "Couldn't read `%s`: %s",
+                               text_box->Path,
+                               strerror(error));
+        }
+    }
+
+    // Line numbers need the index to reach the view, which after a jump far into a huge file
+    // may take a few frames; until then, the position is given as a percentage.
+    if (UpdateTextFileIndex(file, line_start, FIND_MATCH_BUDGET))
+        WakeMainLoop(NULL);
+    uint64_t line_number = 0;
+    if (GetTextFileLineNumber(file, text_box->TopOffset, &line_number)) {
+        char last_char = '\n';
+        if (file->IndexedSize == file->Size &&
+            (file->Size == 0 || ReadTextFile(file, file->Size - 1, 1, &last_char))) {
+            uint64_t line_count = file->IndexedLineCount;
+            if (last_char != '\n')
+                line_count++;
+            ImGui::TextColored(LABEL_COLOR,
+                               "Line %llu of %llu",
+                               (unsigned long long)line_number + 1,
+                               (unsigned long long)line_count);
+        } else {
+            ImGui::TextColored(LABEL_COLOR,
+                               "Line %llu (%d%%)",
+                               (unsigned long long)line_number + 1,
+                               (int)(text_box->TopOffset * 100 / file->Size));
+        }
+    } else {
+        ImGui::TextColored(LABEL_COLOR,
+                           "%d%%",
+                           (int)(text_box->TopOffset * 100 / std::max(file->Size, (uint64_t)1)));
+    }
+    ImGui::PopFont();
+
+    if (ImGui::Button("OK", button_size) || IsKeyPressed(ImGuiKey_Enter)) {
+        status.Done = true;
+        status.ExitCode = 0;
+    }
+    return status;
+}
+
+// Shows the latest progress read from stdin, finishing when stdin is closed.
+static UIStatus ProcessGaugeUI(UI *ui) {
+    UIStatus status = { false, 0 };
+    GaugeUI *gauge = &ui->Data.Gauge;
+    const ImVec2 button_size(ToPixelSize(WINDOW_WIDTH), 0.0);
+
+    if (gauge->Stream == NULL)
+        gauge->Stream = StartGaugeStream(dup(STDIN_FILENO), WakeMainLoop, NULL);
+    if (!TakeGaugeStreamState(gauge->Stream, &gauge->Percent, gauge->Text)) {
+        StopGaugeStream(gauge->Stream);
+        gauge->Stream = NULL;
+        status.Done = true;
+        status.ExitCode = 0;
+    }
+
+    NoteText(gauge->Text);
+    ImGui::TextUnformatted(gauge->Text);
+    char overlay[8];
+    snprintf(overlay, sizeof(overlay), "%d%%", gauge->Percent);
+    ImGui::ProgressBar((float)gauge->Percent / 100.0f, button_size, overlay);
     return status;
 }
 
@@ -484,13 +1890,107 @@ static UIStatus ProcessUI(UI *ui) {
     case InputUIType:
         return ProcessInputUI(ui);
     case MenuUIType:
+    case ChecklistUIType:
+    case RadiolistUIType:
         return ProcessMenuUI(ui);
+    case TextBoxUIType:
+    case TailBoxUIType:
+        return ProcessTextBoxUI(ui);
+    case GaugeUIType:
+        return ProcessGaugeUI(ui);
     default:
         assert(0 && "Unknown UI type!");
         abort();
     }
 }
 
+// Stops a dialog's background work and frees everything it holds, so that the server can go on
+// to the next dialog.
+static void FreeUI(UI *ui) {
+    switch (ui->Type) {
+    case FileUIType: {
+        FileUI *file = &ui->Data.File;
+        DirectorySnapshot *snapshot = &file->Snapshot;
+        free(file->Path);
+        free(snapshot->Path);
+        if (snapshot->Scan != NULL)
+            StopDirectoryScan(snapshot->Scan);
+        FreeDirectoryListing(&snapshot->Listing);
+        FreeDirectoryView(&snapshot->View);
+        StopWatchingDirectorySnapshot(snapshot);
+        if (file->Index != NULL) {
+            StopFileIndex(file->Index);
+            FreeFuzzyMatcher(&file->Matcher);
+        }
+        break;
+    }
+    case InputUIType:
+        free(ui->Data.Input.Data);
+        break;
+    case MenuUIType:
+    case ChecklistUIType:
+    case RadiolistUIType: {
+        MenuUI *menu = &ui->Data.Menu;
+        free(menu->Items);
+        if (menu->Stream != NULL)
+            StopMenuItemStream(menu->Stream);
+        FreeMenuItemFile(&menu->File);
+        FreeBitset(&menu->Selection);
+        if (menu->FilterInitialized)
+            FreeTextFilter(&menu->Filter);
+        break;
+    }
+    case TextBoxUIType:
+    case TailBoxUIType:
+        StopTailWatch(ui);
+        CloseTextFile(&ui->Data.TextBox.File);
+        break;
+    case GaugeUIType:
+        if (ui->Data.Gauge.Stream != NULL)
+            StopGaugeStream(ui->Data.Gauge.Stream);
+        break;
+    }
+    free(ui->FileFindIgnorePatterns);
+    memset(ui, 0, sizeof(*ui));
+}
+
+// The dialogs of a command line, of which `--and-widget` chains several to be shown one after
+// another in the same window. Each takes its own options.
+struct DialogChain {
+    UI *UIs;
+    int Count;
+};
+
+static void FreeDialogChain(DialogChain *chain) {
+    for (int index = 0; index < chain->Count; index++)
+        FreeUI(&chain->UIs[index]);
+    free(chain->UIs);
+    chain->UIs = NULL;
+    chain->Count = 0;
+}
+
+// Returns false, having said why and with nothing left to free, if any dialog's command line is
+// wrong.
+static bool ParseDialogChain(int argc, const char **argv, DialogChain *chain) {
+    chain->UIs = NULL;
+    chain->Count = 0;
+    int start = 0;
+    for (int index = 1; index <= argc; index++) {
+        if (index < argc && strcmp(argv[index], "--and-widget") != 0)
+            continue;
+        // `ParseCommandLine` skips the program name, or for the dialogs after the first, the
+        // `--and-widget` before them.
+        chain->UIs = (UI *)realloc(chain->UIs, sizeof(UI) * (chain->Count + 1));
+        if (!ParseCommandLine(index - start, &argv[start], &chain->UIs[chain->Count])) {
+            FreeDialogChain(chain);
+            return false;
+        }
+        chain->Count++;
+        start = index;
+    }
+    return true;
+}
+
 static char *Slurp(const char *path) {
     FILE *f = fopen(path, "rb");
     if (!f)
@@ -513,96 +2013,227 @@ static char *Slurp(const char *path) {
     return buffer;
 }
 
-// Result is null-terminated. Caller is responsible for freeing it. Exits app on failure.
-static char *SlurpShaderSource(const char *filename) {
-    char *path = (char *)malloc(PATH_MAX + 1);
-    char *dataHome = getenv("XDG_DATA_HOME");
-    if (dataHome == NULL || dataHome[0] == '\0') {
-        const char *home = getenv("HOME");
-        if (home == NULL)
-            home = ".";
-        snprintf(path, PATH_MAX, "%s/.local/share/imdialog/%s", home, filename);
-    } else {
-        snprintf(path, PATH_MAX, "%s/imdialog/%s", dataHome, filename);
-    }
-
-    char *source = Slurp(path);
-    if (source != NULL)
-        return source;
+// Points the vertex attributes at the vertices `offset` bytes into the vertex buffer.
+static void SetVertexAttributes(size_t offset) {
+    GL(glVertexAttribPointer(POSITION_ATTRIBUTE,
+                             2,
+                             GL_FLOAT,
+                             GL_FALSE,
+                             sizeof(ImDrawVert),
+                             (const GLvoid *)(offset + offsetof(ImDrawVert, pos))));
+    GL(glVertexAttribPointer(TEXTURE_UV_ATTRIBUTE,
+                             2,
+                             GL_FLOAT,
+                             GL_FALSE,
+                             sizeof(ImDrawVert),
+                             (const GLvoid *)(offset + offsetof(ImDrawVert, uv))));
+    GL(glVertexAttribPointer(COLOR_ATTRIBUTE,
+                             4,
+                             GL_UNSIGNED_BYTE,
+                             GL_TRUE,
+                             sizeof(ImDrawVert),
+                             (const GLvoid *)(offset + offsetof(ImDrawVert, col))));
+}
 
-    const char *dataDirsLocation = getenv("XDG_DATA_DIRS");
-    if (dataDirsLocation == NULL || dataDirsLocation[0] == '\0')
-        dataDirsLocation = "/usr/local/share/:/usr/share/";
-    char *dataDirs = strdup(dataDirsLocation);
-    char *dataDir;
-    while ((dataDir = xstrsep(&dataDirs, ":")) != NULL) {
-        snprintf(path, PATH_MAX, "%s/imdialog/%s", dataDir, filename);
-        source = Slurp(path);
-        if (source != NULL)
-            return source;
+static void AppendToFrameRecord(FrameRecord *record, const void *data, size_t size) {
+    if (record->Size + size > record->Capacity) {
+        record->Capacity = record->Capacity != 0 ? record->Capacity * 2 : 64 * 1024;
+        if (record->Capacity < record->Size + size)
+            record->Capacity = record->Size + size;
+        record->Data = (char *)realloc(record->Data, record->Capacity);
     }
+    memcpy(&record->Data[record->Size], data, size);
+    record->Size += size;
+}
 
-    snprintf(path, PATH_MAX, "./%s", filename);
-    if ((source = Slurp(path)) != NULL)
-        return source;
+// Records everything that goes into drawing `draw_data`. Returns false if it can't be recorded,
+// because some of it is drawn by callbacks.
+static bool RecordFrame(const ImDrawData *draw_data, FrameRecord *record) {
+    record->Size = 0;
+    for (int32_t drawListIndex = 0; drawListIndex < draw_data->CmdListsCount; drawListIndex++) {
+        const ImDrawList *draw_list = draw_data->CmdLists[drawListIndex];
+        int counts[3] = {
+            draw_list->VtxBuffer.size(), draw_list->IdxBuffer.size(), draw_list->CmdBuffer.size()
+        };
+        AppendToFrameRecord(record, counts, sizeof(counts));
+        AppendToFrameRecord(record,
+                            &draw_list->VtxBuffer.front(),
+                            draw_list->VtxBuffer.size() * sizeof(ImDrawVert));
+        AppendToFrameRecord(record,
+                            &draw_list->IdxBuffer.front(),
+                            draw_list->IdxBuffer.size() * sizeof(ImDrawIdx));
+        for (const ImDrawCmd *draw_command = draw_list->CmdBuffer.begin();
+             draw_command != draw_list->CmdBuffer.end();
+             draw_command++) {
+            if (draw_command->UserCallback != NULL)
+                return false;
+            AppendToFrameRecord(record,
+                                &draw_command->ElemCount,
+                                sizeof(draw_command->ElemCount));
+            AppendToFrameRecord(record,
+                                &draw_command->ClipRect,
+                                sizeof(draw_command->ClipRect));
+            AppendToFrameRecord(record,
+                                &draw_command->TextureId,
+                                sizeof(draw_command->TextureId));
+        }
+    }
+    return true;
+}
 
-    fprintf(stderr,
-            "video error: couldn't find shader `%s`: try installing it to "
-            "`~/.local/share/imdialog/%s` or "
-            "`/usr/local/share/imdialog/%s`\n",
-            filename,
-            filename,
-            filename);
-    exit(1);
+// Writes the quad that scales the render target up to fill the window, as 4 vertices and 6
+// indices. Its positions are in the render target's pixels, which is what the vertex shader takes,
+// and its texture coordinates are flipped, since the texture's rows run bottom to top.
+static void WriteRenderTargetQuad(ImDrawVert *vertices, ImDrawIdx *indices) {
+    float width = (float)g_ImDialogState.RenderWidth;
+    float height = (float)g_ImDialogState.RenderHeight;
+    const ImVec2 corners[4] = {
+        ImVec2(0.0f, 0.0f), ImVec2(width, 0.0f), ImVec2(width, height), ImVec2(0.0f, height)
+    };
+    const ImVec2 uvs[4] = {
+        ImVec2(0.0f, 1.0f), ImVec2(1.0f, 1.0f), ImVec2(1.0f, 0.0f), ImVec2(0.0f, 0.0f)
+    };
+    for (int index = 0; index < 4; index++) {
+        vertices[index].pos = corners[index];
+        vertices[index].uv = uvs[index];
+        vertices[index].col = 0xffffffff;
+    }
+    const ImDrawIdx quad_indices[6] = { 0, 1, 2, 0, 2, 3 };
+    memcpy(indices, quad_indices, sizeof(quad_indices));
 }
 
+// Draws a frame's draw lists from one upload of all their vertices and indices. Blending, the
+// viewport and the like are set up once and for all in `CreateDialogState`, and within the frame,
+// the program, texture and scissor are only set when they change. With a render target, the frame
+// is drawn into it, and then it's drawn into the window, from the same upload.
 static void RenderDrawLists(ImDrawData *draw_data) {
-    GL(glViewport(0, 0, FRAMEBUFFER_WIDTH, FRAMEBUFFER_HEIGHT));
-    GL(glUseProgram(g_ImDialogState.Program));
-    GL(glEnable(GL_BLEND));
-    GL(glEnable(GL_SCISSOR_TEST));
-    GL(glDisable(GL_DEPTH_TEST));
-    GL(glBlendEquation(GL_FUNC_ADD));
-    GL(glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA));
-    GL(glActiveTexture(GL_TEXTURE0));
-    GL(glUniform2f(g_ImDialogState.UWindowSize,
-                   (GLfloat)FRAMEBUFFER_WIDTH,
-                   (GLfloat)FRAMEBUFFER_HEIGHT));
-    GL(glUniform1i(g_ImDialogState.UTexture, 0));
+    // Most events, such as the mouse moving over nothing in particular, change nothing, so before
+    // anything's drawn, the frame is compared with the one on screen. A copy and a compare is far
+    // cheaper than clearing and blending the whole window.
+    int frame = 1 - g_ImDialogState.ShownFrame;
+    FrameRecord *record = &g_ImDialogState.Frames[frame];
+    const FrameRecord *shown = &g_ImDialogState.Frames[g_ImDialogState.ShownFrame];
+    g_ImDialogState.FrameRecorded = RecordFrame(draw_data, record);
+    g_ImDialogState.FrameSkipped = g_ImDialogState.FrameRecorded &&
+        g_ImDialogState.ShownFrameRecorded &&
+        record->Size == shown->Size &&
+        memcmp(record->Data, shown->Data, record->Size) == 0;
+    if (g_ImDialogState.FrameSkipped)
+        return;
+#ifdef IMDEBUG
+    uint64_t start_time = SDL_GetPerformanceCounter();
+#endif
 
+    bool scaled = g_ImDialogState.RenderFramebuffer != 0;
+    if (scaled) {
+        GL(glBindFramebuffer(GL_FRAMEBUFFER, g_ImDialogState.RenderFramebuffer));
+        GL(glViewport(0, 0, g_ImDialogState.RenderWidth, g_ImDialogState.RenderHeight));
+    }
+    GL(glClear(GL_COLOR_BUFFER_BIT));
+    size_t frame_vertices_size = (size_t)draw_data->TotalVtxCount * sizeof(ImDrawVert);
+    size_t frame_indices_size = (size_t)draw_data->TotalIdxCount * sizeof(ImDrawIdx);
+    size_t vertices_size = frame_vertices_size + (scaled ? 4 * sizeof(ImDrawVert) : 0);
+    size_t indices_size = frame_indices_size + (scaled ? 6 * sizeof(ImDrawIdx) : 0);
+    char *vertices = (char *)BeginStreamBufferWrite(&g_ImDialogState.VertexBuffer, vertices_size);
+    char *indices = (char *)BeginStreamBufferWrite(&g_ImDialogState.IndexBuffer, indices_size);
+    for (int32_t drawListIndex = 0; drawListIndex < draw_data->CmdListsCount; drawListIndex++) {
+        const ImDrawList *draw_list = draw_data->CmdLists[drawListIndex];
+        size_t size = (size_t)draw_list->VtxBuffer.size() * sizeof(ImDrawVert);
+        memcpy(vertices, &draw_list->VtxBuffer.front(), size);
+        vertices += size;
+        size = (size_t)draw_list->IdxBuffer.size() * sizeof(ImDrawIdx);
+        memcpy(indices, &draw_list->IdxBuffer.front(), size);
+        indices += size;
+    }
+    if (scaled)
+        WriteRenderTargetQuad((ImDrawVert *)vertices, (ImDrawIdx *)indices);
+    size_t vertex_offset = EndStreamBufferWrite(&g_ImDialogState.VertexBuffer);
+    size_t index_offset = EndStreamBufferWrite(&g_ImDialogState.IndexBuffer);
+
+    RenderStats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.UploadSize = vertices_size + indices_size;
+    const ImDialogProgram *current_program = NULL;
+    GLuint current_texture = 0;
+    ImVec4 current_clip_rect(0.0f, 0.0f, -1.0f, -1.0f);
+    GL(glEnable(GL_SCISSOR_TEST));
     for (int32_t drawListIndex = 0; drawListIndex < draw_data->CmdListsCount; drawListIndex++) {
         const ImDrawList *draw_list = draw_data->CmdLists[drawListIndex];
-        const ImDrawIdx *index_buffer_offset = 0;
-        GL(glBindBuffer(GL_ARRAY_BUFFER, g_ImDialogState.VBO));
-        GL(glBufferData(GL_ARRAY_BUFFER,
-                        (GLsizeiptr)draw_list->VtxBuffer.size() * sizeof(ImDrawVert),
-                        (GLvoid *)&draw_list->VtxBuffer.front(),
-                        GL_DYNAMIC_DRAW));
-        GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_ImDialogState.IBO));
-        GL(glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                        (GLsizeiptr)draw_list->IdxBuffer.size() * sizeof(ImDrawIdx),
-                        (GLvoid *)&draw_list->IdxBuffer.front(),
-                        GL_DYNAMIC_DRAW));
+        SetVertexAttributes(vertex_offset);
+        vertex_offset += (size_t)draw_list->VtxBuffer.size() * sizeof(ImDrawVert);
 
         for (const ImDrawCmd *draw_command = draw_list->CmdBuffer.begin();
              draw_command != draw_list->CmdBuffer.end();
              draw_command++) {
             if (draw_command->UserCallback != NULL) {
                 draw_command->UserCallback(draw_list, draw_command);
+                // Whatever it did to the GL, nothing can be assumed about it afterward.
+                current_program = NULL;
+                current_texture = 0;
+                current_clip_rect = ImVec4(0.0f, 0.0f, -1.0f, -1.0f);
                 continue;
             }
-            GL(glBindTexture(GL_TEXTURE_2D, (GLuint)(uintptr_t)draw_command->TextureId));
-            GL(glScissor((int)draw_command->ClipRect.x,
-                         (int)(FRAMEBUFFER_HEIGHT - draw_command->ClipRect.w),
-                         (int)(draw_command->ClipRect.z - draw_command->ClipRect.x),
-                         (int)(draw_command->ClipRect.w - draw_command->ClipRect.y)));
+            GLuint texture = (GLuint)(uintptr_t)draw_command->TextureId;
+            const ImDialogProgram *program = texture == g_ImDialogState.FontTexture ?
+                &g_ImDialogState.FontProgram :
+                &g_ImDialogState.TextureProgram;
+            if (program != current_program) {
+                GL(glUseProgram(program->Program));
+                current_program = program;
+                stats.StateChanges++;
+            }
+            if (texture != current_texture) {
+                GL(glBindTexture(GL_TEXTURE_2D, texture));
+                current_texture = texture;
+                stats.StateChanges++;
+            }
+            const ImVec4 &clip_rect = draw_command->ClipRect;
+            if (clip_rect.x != current_clip_rect.x || clip_rect.y != current_clip_rect.y ||
+                clip_rect.z != current_clip_rect.z || clip_rect.w != current_clip_rect.w) {
+                GL(glScissor((int)clip_rect.x,
+                             (int)(g_ImDialogState.RenderHeight - clip_rect.w),
+                             (int)(clip_rect.z - clip_rect.x),
+                             (int)(clip_rect.w - clip_rect.y)));
+                current_clip_rect = clip_rect;
+                stats.StateChanges++;
+            }
             GL(glDrawElements(GL_TRIANGLES,
                               (GLsizei)draw_command->ElemCount,
                               (sizeof(ImDrawIdx) == 2) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
-                              index_buffer_offset));
-            index_buffer_offset += draw_command->ElemCount;
+                              (const GLvoid *)index_offset));
+            index_offset += draw_command->ElemCount * sizeof(ImDrawIdx);
+            stats.DrawCalls++;
         }
     }
+    // So that clearing the window isn't cut down to the last clip rectangle.
+    GL(glDisable(GL_SCISSOR_TEST));
+
+    if (scaled) {
+        // The frame replaces what's in the window outright, so there's nothing to clear or blend.
+        GL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+        GL(glViewport(0, 0, g_ImDialogState.OutputWidth, g_ImDialogState.OutputHeight));
+        GL(glDisable(GL_BLEND));
+        if (current_program != &g_ImDialogState.TextureProgram) {
+            GL(glUseProgram(g_ImDialogState.TextureProgram.Program));
+            stats.StateChanges++;
+        }
+        GL(glBindTexture(GL_TEXTURE_2D, g_ImDialogState.RenderTexture));
+        stats.StateChanges++;
+        SetVertexAttributes(vertex_offset);
+        GL(glDrawElements(GL_TRIANGLES,
+                          6,
+                          (sizeof(ImDrawIdx) == 2) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+                          (const GLvoid *)index_offset));
+        GL(glEnable(GL_BLEND));
+        stats.DrawCalls++;
+    }
+    FinishStreamBufferFrame(&g_ImDialogState.VertexBuffer);
+    FinishStreamBufferFrame(&g_ImDialogState.IndexBuffer);
+#ifdef IMDEBUG
+    glFinish();
+    stats.DrawTime = SDL_GetPerformanceCounter() - start_time;
+#endif
+    g_ImDialogState.LastFrameStats = stats;
 }
 
 static GLuint CompileShaderFromCString(GLint shader_type, const char *source) {
@@ -626,86 +2257,656 @@ static GLuint CompileShaderFromCString(GLint shader_type, const char *source) {
     return shader;
 }
 
-static GLuint CompileShader(GLint shader_type, const char *filename) {
-    char *source = SlurpShaderSource(filename);
-    return CompileShaderFromCString(shader_type, source);
+// Result is null-terminated. Caller is responsible for freeing it. Exits app on failure.
+static char *LoadShaderSource(const char *filename) {
+    char *path = GetDataFileOverridePath(filename);
+    char *source = path != NULL ? Slurp(path) : NULL;
+    free(path);
+    if (source == NULL)
+        source = strdup((const char *)GetEmbeddedDataFile(filename)->Data);
+    return source;
+}
+
+typedef void (IMGL_APIENTRY *GetProgramBinaryFn)(GLuint program,
+                                                 GLsizei buffer_size,
+                                                 GLsizei *length,
+                                                 GLenum *format,
+                                                 void *binary);
+typedef void (IMGL_APIENTRY *ProgramBinaryFn)(GLuint program,
+                                              GLenum format,
+                                              const void *binary,
+                                              GLsizei length);
+typedef void (IMGL_APIENTRY *ProgramParameteriFn)(GLuint program, GLenum name, GLint value);
+
+// The entry points for getting linked programs back out of the driver, to cache them.
+struct ProgramBinaryFunctions {
+    GetProgramBinaryFn GetProgramBinary;
+    ProgramBinaryFn ProgramBinary;
+    // Only in desktop GL, where some drivers won't keep a binary around without being asked to.
+    ProgramParameteriFn ProgramParameteri;
+};
+
+// A linked program as cached on disk: this header, then the driver's binary.
+struct ProgramCacheHeader {
+    char Magic[8];
+    uint64_t Key;
+    uint32_t Format;
+    uint32_t Size;
+};
+
+// Returns false if the driver can't hand out program binaries.
+static bool GetProgramBinaryFunctions(ProgramBinaryFunctions *functions) {
+    memset(functions, 0, sizeof(*functions));
+#ifdef HAVE_OPENGLES2
+    if (!SDL_GL_ExtensionSupported("GL_OES_get_program_binary"))
+        return false;
+    functions->GetProgramBinary =
+        (GetProgramBinaryFn)SDL_GL_GetProcAddress("glGetProgramBinaryOES");
+    functions->ProgramBinary = (ProgramBinaryFn)SDL_GL_GetProcAddress("glProgramBinaryOES");
+#else
+    if (!SDL_GL_ExtensionSupported("GL_ARB_get_program_binary"))
+        return false;
+    functions->GetProgramBinary = (GetProgramBinaryFn)SDL_GL_GetProcAddress("glGetProgramBinary");
+    functions->ProgramBinary = (ProgramBinaryFn)SDL_GL_GetProcAddress("glProgramBinary");
+    functions->ProgramParameteri =
+        (ProgramParameteriFn)SDL_GL_GetProcAddress("glProgramParameteri");
+#endif
+    // Some drivers have the extension without a single format to save programs in.
+    GLint format_count = 0;
+    GL(glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count));
+    return format_count > 0 && functions->GetProgramBinary != NULL &&
+        functions->ProgramBinary != NULL;
+}
+
+// A binary is only any good to the same driver, so that's part of what identifies it.
+static uint64_t GetProgramCacheKey(const char *vertex_source, const char *fragment_source) {
+    uint64_t key = HashBytes(PROGRAM_CACHE_MAGIC, strlen(PROGRAM_CACHE_MAGIC), HASH_SEED);
+    const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+    for (size_t index = 0; index < sizeof(names) / sizeof(names[0]); index++) {
+        const char *string = (const char *)glGetString(names[index]);
+        if (string != NULL)
+            key = HashBytes(string, strlen(string) + 1, key);
+    }
+    key = HashBytes(vertex_source, strlen(vertex_source) + 1, key);
+    return HashBytes(fragment_source, strlen(fragment_source) + 1, key);
 }
 
-static GLuint CreateProgram(GLuint vertex_shader, GLuint fragment_shader) {
-    GLuint program = glCreateProgram();
-    GL(glAttachShader(program, vertex_shader));
-    GL(glAttachShader(program, fragment_shader));
-    return program;
+// Loads the binary cached at `path` into `program`. Returns false if there isn't one, or if the
+// driver won't take it, which it's free to do for any reason at all.
+static bool LoadCachedProgram(const ProgramBinaryFunctions *functions,
+                              GLuint program,
+                              const char *path,
+                              uint64_t key) {
+    size_t size = 0;
+    void *data = MapFile(path, &size);
+    if (data == NULL)
+        return false;
+    const ProgramCacheHeader *header = (const ProgramCacheHeader *)data;
+    bool loaded = false;
+    if (size >= sizeof(ProgramCacheHeader) &&
+        memcmp(header->Magic, PROGRAM_CACHE_MAGIC, sizeof(header->Magic)) == 0 &&
+        header->Key == key &&
+        size - sizeof(ProgramCacheHeader) == header->Size) {
+        functions->ProgramBinary(program, header->Format, header + 1, (GLsizei)header->Size);
+        // A rejected binary may leave an error behind, which is no concern of anyone else's.
+        glGetError();
+        GLint link_status = GL_FALSE;
+        GL(glGetProgramiv(program, GL_LINK_STATUS, &link_status));
+        loaded = link_status == GL_TRUE;
+    }
+    UnmapFile(data, size);
+    return loaded;
 }
 
-static void CreateDialogState() {
+static void SaveProgram(const ProgramBinaryFunctions *functions,
+                        GLuint program,
+                        const char *path,
+                        uint64_t key) {
+    GLint length = 0;
+    GL(glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length));
+    if (length <= 0)
+        return;
+    char *data = (char *)calloc(sizeof(ProgramCacheHeader) + length, 1);
+    ProgramCacheHeader *header = (ProgramCacheHeader *)data;
+    GLsizei written = 0;
+    GLenum format = 0;
+    GL(functions->GetProgramBinary(program, length, &written, &format, header + 1));
+    if (written > 0) {
+        memcpy(header->Magic, PROGRAM_CACHE_MAGIC, sizeof(header->Magic));
+        header->Key = key;
+        header->Format = format;
+        header->Size = (uint32_t)written;
+        WriteCacheFile(path, data, sizeof(ProgramCacheHeader) + written);
+    }
+    free(data);
+}
+
+// A baked font atlas as cached on disk: this header, the atlas's alpha pixels, then for each font a
+// `FontAtlasCacheFont` followed by its glyphs.
+struct FontAtlasCacheHeader {
+    char Magic[8];
+    uint64_t Key;
+    int32_t Width;
+    int32_t Height;
+    float WhitePixelU;
+    float WhitePixelV;
+    uint32_t FontCount;
+    uint32_t Padding;
+};
+
+struct FontAtlasCacheFont {
+    float FontSize;
+    float Ascent;
+    float Descent;
+    float DisplayOffsetX;
+    float DisplayOffsetY;
+    uint32_t GlyphCount;
+};
+
+// Identifies a bake: anything that could change the atlas goes into it.
+static uint64_t GetFontAtlasCacheKey(const void *font_data,
+                                     size_t font_data_size,
+                                     const float *sizes,
+                                     int font_count,
+                                     const ImWchar *glyph_ranges) {
+    uint64_t key = HashBytes(IMGUI_VERSION, strlen(IMGUI_VERSION), HASH_SEED);
+    key = HashBytes(FONT_ATLAS_CACHE_MAGIC, strlen(FONT_ATLAS_CACHE_MAGIC), key);
+    size_t glyph_size = sizeof(ImFont::Glyph);
+    key = HashBytes(&glyph_size, sizeof(glyph_size), key);
+    key = HashBytes(font_data, font_data_size, key);
+    key = HashBytes(sizes, sizeof(float) * font_count, key);
+    int spread = SDF_SPREAD;
+    key = HashBytes(&spread, sizeof(spread), key);
+    size_t range_count = 0;
+    while (glyph_ranges[range_count * 2] != 0)
+        range_count++;
+    return HashBytes(glyph_ranges, sizeof(ImWchar) * 2 * range_count, key);
+}
+
+// Fills the atlas with the fonts and pixels of a cached bake, with the pixels left where they are
+// in `data`. Returns the pixels, or NULL if the cache doesn't hold a bake with the key.
+static const void *LoadCachedFontAtlas(const void *data,
+                                      size_t size,
+                                      uint64_t key,
+                                      int font_count) {
+    const FontAtlasCacheHeader *header = (const FontAtlasCacheHeader *)data;
+    if (size < sizeof(FontAtlasCacheHeader) ||
+        memcmp(header->Magic, FONT_ATLAS_CACHE_MAGIC, sizeof(header->Magic)) != 0 ||
+        header->Key != key ||
+        header->FontCount != (uint32_t)font_count ||
+        header->Width <= 0 ||
+        header->Height <= 0) {
+        return NULL;
+    }
+    size_t offset = sizeof(FontAtlasCacheHeader) + (size_t)header->Width * header->Height;
+    for (int index = 0; index < font_count; index++) {
+        if (offset + sizeof(FontAtlasCacheFont) > size)
+            return NULL;
+        const FontAtlasCacheFont *font = (const FontAtlasCacheFont *)((const char *)data + offset);
+        offset += sizeof(FontAtlasCacheFont) + sizeof(ImFont::Glyph) * font->GlyphCount;
+    }
+    if (offset != size)
+        return NULL;
+
+    ImFontAtlas *atlas = ImGui::GetIO().Fonts;
+    atlas->TexWidth = header->Width;
+    atlas->TexHeight = header->Height;
+    atlas->TexUvWhitePixel = ImVec2(header->WhitePixelU, header->WhitePixelV);
+    offset = sizeof(FontAtlasCacheHeader) + (size_t)header->Width * header->Height;
+    for (int index = 0; index < font_count; index++) {
+        const FontAtlasCacheFont *cached =
+            (const FontAtlasCacheFont *)((const char *)data + offset);
+        offset += sizeof(FontAtlasCacheFont);
+
+        // As `ImFontAtlas::AddFont` does, so that the atlas can free it.
+        ImFont *font = (ImFont *)ImGui::MemAlloc(sizeof(ImFont));
+        new (font) ImFont();
+        font->FontSize = cached->FontSize;
+        font->Ascent = cached->Ascent;
+        font->Descent = cached->Descent;
+        font->DisplayOffset = ImVec2(cached->DisplayOffsetX, cached->DisplayOffsetY);
+        font->ContainerAtlas = atlas;
+        font->Glyphs.resize((int)cached->GlyphCount);
+        memcpy(font->Glyphs.Data,
+               (const char *)data + offset,
+               sizeof(ImFont::Glyph) * cached->GlyphCount);
+        offset += sizeof(ImFont::Glyph) * cached->GlyphCount;
+        font->BuildLookupTable();
+        atlas->Fonts.push_back(font);
+    }
+    return (const char *)data + sizeof(FontAtlasCacheHeader);
+}
+
+static void SaveFontAtlas(const char *path, uint64_t key, const uint8_t *pixels) {
+    const ImFontAtlas *atlas = ImGui::GetIO().Fonts;
+    size_t pixels_size = (size_t)atlas->TexWidth * atlas->TexHeight;
+    size_t size = sizeof(FontAtlasCacheHeader) + pixels_size;
+    for (int index = 0; index < atlas->Fonts.Size; index++) {
+        size += sizeof(FontAtlasCacheFont) +
+            sizeof(ImFont::Glyph) * atlas->Fonts[index]->Glyphs.Size;
+    }
+
+    char *data = (char *)calloc(size, 1);
+    FontAtlasCacheHeader *header = (FontAtlasCacheHeader *)data;
+    memcpy(header->Magic, FONT_ATLAS_CACHE_MAGIC, sizeof(header->Magic));
+    header->Key = key;
+    header->Width = atlas->TexWidth;
+    header->Height = atlas->TexHeight;
+    header->WhitePixelU = atlas->TexUvWhitePixel.x;
+    header->WhitePixelV = atlas->TexUvWhitePixel.y;
+    header->FontCount = (uint32_t)atlas->Fonts.Size;
+    memcpy(&data[sizeof(FontAtlasCacheHeader)], pixels, pixels_size);
+    size_t offset = sizeof(FontAtlasCacheHeader) + pixels_size;
+    for (int index = 0; index < atlas->Fonts.Size; index++) {
+        const ImFont *font = atlas->Fonts[index];
+        FontAtlasCacheFont *cached = (FontAtlasCacheFont *)&data[offset];
+        cached->FontSize = font->FontSize;
+        cached->Ascent = font->Ascent;
+        cached->Descent = font->Descent;
+        cached->DisplayOffsetX = font->DisplayOffset.x;
+        cached->DisplayOffsetY = font->DisplayOffset.y;
+        cached->GlyphCount = (uint32_t)font->Glyphs.Size;
+        offset += sizeof(FontAtlasCacheFont);
+        memcpy(&data[offset], font->Glyphs.Data, sizeof(ImFont::Glyph) * font->Glyphs.Size);
+        offset += sizeof(ImFont::Glyph) * font->Glyphs.Size;
+    }
+    WriteCacheFile(path, data, size);
+    free(data);
+}
+
+// Converts the coverage of each of the font's glyphs into a distance field.
+static void MakeGlyphDistanceFields(const ImFont *font, uint8_t *pixels) {
+    const ImFontAtlas *atlas = font->ContainerAtlas;
+    for (int index = 0; index < font->Glyphs.Size; index++) {
+        const ImFont::Glyph *glyph = &font->Glyphs[index];
+        int x0 = (int)(glyph->U0 * atlas->TexWidth + 0.5f);
+        int y0 = (int)(glyph->V0 * atlas->TexHeight + 0.5f);
+        int x1 = (int)(glyph->U1 * atlas->TexWidth + 0.5f);
+        int y1 = (int)(glyph->V1 * atlas->TexHeight + 0.5f);
+        MakeDistanceField(&pixels[y0 * atlas->TexWidth + x0],
+                          x1 - x0,
+                          y1 - y0,
+                          1,
+                          atlas->TexWidth,
+                          SDF_SPREAD);
+    }
+}
+
+// Adds a copy of `base` to its atlas that's drawn at `size`, sharing its glyphs in the atlas.
+static ImFont *AddScaledFont(const ImFont *base, float size) {
+    ImFontAtlas *atlas = base->ContainerAtlas;
+    ImFont *font = (ImFont *)ImGui::MemAlloc(sizeof(ImFont));
+    new (font) ImFont();
+    font->FontSize = base->FontSize;
+    font->Scale = size / base->FontSize;
+    font->Ascent = base->Ascent;
+    font->Descent = base->Descent;
+    font->DisplayOffset = base->DisplayOffset;
+    font->FallbackChar = base->FallbackChar;
+    font->ContainerAtlas = atlas;
+    font->Glyphs.resize(base->Glyphs.Size);
+    memcpy(font->Glyphs.Data, base->Glyphs.Data, sizeof(ImFont::Glyph) * base->Glyphs.Size);
+    font->BuildLookupTable();
+    atlas->Fonts.push_back(font);
+    return font;
+}
+
+// Rasterizing the fonts is most of the work of starting up, so the atlas baked at startup is
+// cached, keyed on everything that goes into it, and on later runs just mapped. Only the latest
+// one is kept, since each set of characters gets an atlas of its own. Only the characters in
+// `g_ImDialogState.Glyphs` are baked; the atlas is baked again, with `save` false, when more turn
+// up. None of this needs the GL, so at startup it's done while the GL is still being set up.
+static void BakeFontAtlas(FontAtlasBake *bake, bool save) {
     ImGuiIO &io = ImGui::GetIO();
-    uint8_t *pixels = NULL;
-    int width = 0, height = 0;
-    char *ui_font_path = GetDataFilePath(FONT_FILENAME);
-    g_ImDialogState.standardFont = io.Fonts->AddFontFromFileTTF(ui_font_path,
-                                                                STANDARD_FONT_SIZE,
-                                                                NULL);
-    g_ImDialogState.labelFont = io.Fonts->AddFontFromFileTTF(ui_font_path, LABEL_FONT_SIZE, NULL);
-    free(ui_font_path);
+    memset(bake, 0, sizeof(*bake));
+#ifdef IMDEBUG
+    bake->StartTime = SDL_GetPerformanceCounter();
+#endif
+    const float sizes[] = { SDF_FONT_SIZE };
+    const int font_count = sizeof(sizes) / sizeof(sizes[0]);
+    ImWchar *glyph_ranges = GetGlyphRanges(&g_ImDialogState.Glyphs);
+    g_ImDialogState.Glyphs.Changed = false;
+
+    // A font in `$IMDIALOG_DATA_DIR` is only mapped while the atlas is being baked.
+    size_t font_size = 0;
+    char *font_path = GetDataFileOverridePath(FONT_FILENAME);
+    void *mapped_font = font_path != NULL ? MapFile(font_path, &font_size) : NULL;
+    free(font_path);
+    void *font_data = mapped_font;
+    if (mapped_font == NULL) {
+        const EmbeddedAsset *font = GetEmbeddedDataFile(FONT_FILENAME);
+        font_data = (void *)font->Data;
+        font_size = font->Size;
+    }
+    uint64_t key = GetFontAtlasCacheKey(font_data,
+                                        font_size,
+                                        sizes,
+                                        font_count,
+                                        glyph_ranges);
+    char cache_filename[64];
+    snprintf(cache_filename,
+             sizeof(cache_filename),
+             FONT_ATLAS_CACHE_PREFIX "%016llx",
+             (unsigned long long)key);
+    char *cache_path = GetCacheFilePath(cache_filename);
+
+    // Nothing refers to the old fonts between frames, so they can just be thrown away.
+    io.Fonts->Clear();
+    if (cache_path != NULL)
+        bake->Cache = MapFile(cache_path, &bake->CacheSize);
+    if (bake->Cache != NULL)
+        bake->Pixels = LoadCachedFontAtlas(bake->Cache, bake->CacheSize, key, font_count);
+    if (bake->Pixels == NULL) {
+        // The atlas copies any font data it doesn't own, so it's handed the font as its own, then
+        // made to let go of it before it could free it.
+        ImFontConfig config;
+        config.FontDataOwnedByAtlas = true;
+        // Oversampling would only stretch the distance fields.
+        config.OversampleH = 1;
+        config.OversampleV = 1;
+        for (int index = 0; index < font_count; index++) {
+            io.Fonts->AddFontFromMemoryTTF(font_data,
+                                           (int)font_size,
+                                           sizes[index],
+                                           &config,
+                                           glyph_ranges);
+        }
+        uint8_t *baked_pixels = NULL;
+        int width = 0, height = 0;
+        io.Fonts->GetTexDataAsAlpha8(&baked_pixels, &width, &height);
+        for (int index = 0; index < io.Fonts->ConfigData.Size; index++)
+            io.Fonts->ConfigData[index].FontData = NULL;
+        io.Fonts->ClearInputData();
+        MakeGlyphDistanceFields(io.Fonts->Fonts[0], baked_pixels);
+        if (save && cache_path != NULL) {
+            SaveFontAtlas(cache_path, key, baked_pixels);
+            RemoveOtherCacheFiles(FONT_ATLAS_CACHE_PREFIX, cache_filename);
+        }
+        bake->Pixels = baked_pixels;
+        if (bake->Cache != NULL) {
+            UnmapFile(bake->Cache, bake->CacheSize);
+            bake->Cache = NULL;
+        }
+    }
+    free(cache_path);
+    if (mapped_font != NULL)
+        UnmapFile(mapped_font, font_size);
 
-    io.Fonts->GetTexDataAsRGBA32(&pixels, &width, &height);
+    for (size_t range = 0; glyph_ranges[range] != 0; range += 2)
+        bake->GlyphCount += glyph_ranges[range + 1] - glyph_ranges[range] + 1;
+    free(glyph_ranges);
+#ifdef IMDEBUG
+    bake->EndTime = SDL_GetPerformanceCounter();
+#endif
+}
 
-    glGenTextures(1, &g_ImDialogState.FontTexture);
+static void UploadFontAtlas(FontAtlasBake *bake) {
+    ImGuiIO &io = ImGui::GetIO();
+#ifdef IMDEBUG
+    uint64_t start_time = SDL_GetPerformanceCounter();
+#endif
+    // The atlas is one byte a texel, so rows needn't start on 4-byte boundaries.
+    GL(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
     GL(glBindTexture(GL_TEXTURE_2D, g_ImDialogState.FontTexture));
-    GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
-    GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
     GL(glTexImage2D(GL_TEXTURE_2D,
                     0,
-                    GL_RGBA,
-                    width,
-                    height,
+                    GL_ALPHA,
+                    io.Fonts->TexWidth,
+                    io.Fonts->TexHeight,
                     0,
-                    GL_RGBA,
+                    GL_ALPHA,
                     GL_UNSIGNED_BYTE,
-                    pixels));
+                    bake->Pixels));
     io.Fonts->TexID = (void *)(uintptr_t)g_ImDialogState.FontTexture;
     GL(glBindTexture(GL_TEXTURE_2D, 0));
+    GL(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+    // The fonts are sized to what's drawn, which isn't known until there's a window. Being distance
+    // fields, the glyphs stay sharp at any size, so that's all it takes to match the render target.
+    // The first font is the one imgui uses by default.
+    float height = (float)g_ImDialogState.RenderHeight;
+    g_ImDialogState.standardFont = io.Fonts->Fonts[0];
+    g_ImDialogState.standardFont->Scale = STANDARD_FONT_SIZE(height) / SDF_FONT_SIZE;
+    g_ImDialogState.labelFont = AddScaledFont(io.Fonts->Fonts[0], LABEL_FONT_SIZE(height));
+#ifdef IMDEBUG
+    glFinish();
+    uint64_t end_time = SDL_GetPerformanceCounter();
+#endif
+    if (bake->Cache != NULL)
+        UnmapFile(bake->Cache, bake->CacheSize);
+    // The GL has its own copy now.
+    io.Fonts->ClearTexData();
+#ifdef IMDEBUG
+    fprintf(stderr,
+            "%s %zu-character %dx%d font atlas in %.2f ms, uploading %zu KB in %.2f ms\n",
+            bake->Cache != NULL ? "loaded cached" : "baked",
+            bake->GlyphCount,
+            io.Fonts->TexWidth,
+            io.Fonts->TexHeight,
+            (double)(bake->EndTime - bake->StartTime) * 1000.0 /
+            (double)SDL_GetPerformanceFrequency(),
+            (size_t)io.Fonts->TexWidth * io.Fonts->TexHeight / 1024,
+            (double)(end_time - start_time) * 1000.0 / (double)SDL_GetPerformanceFrequency());
+#endif
+    memset(bake, 0, sizeof(*bake));
+}
 
-    g_ImDialogState.VertexShader = CompileShader(GL_VERTEX_SHADER, "imgui.vs.glsl");
-    g_ImDialogState.FragmentShader = CompileShader(GL_FRAGMENT_SHADER, "imgui.fs.glsl");
-    g_ImDialogState.Program = CreateProgram(g_ImDialogState.VertexShader,
-                                            g_ImDialogState.FragmentShader);
-    GL(glLinkProgram(g_ImDialogState.Program));
-
-    g_ImDialogState.UWindowSize = glGetUniformLocation(g_ImDialogState.Program, "uWindowSize");
-    g_ImDialogState.UTexture = glGetUniformLocation(g_ImDialogState.Program, "uTexture");
-    g_ImDialogState.APosition = glGetAttribLocation(g_ImDialogState.Program, "aPosition");
-    g_ImDialogState.ATextureUV = glGetAttribLocation(g_ImDialogState.Program, "aTextureUV");
-    g_ImDialogState.AColor = glGetAttribLocation(g_ImDialogState.Program, "aColor");
-    GL(glUseProgram(g_ImDialogState.Program));
-
-    glGenBuffers(1, &g_ImDialogState.VBO);
-    GL(glBindBuffer(GL_ARRAY_BUFFER, g_ImDialogState.VBO));
-    GL(glVertexAttribPointer(g_ImDialogState.APosition,
-                             2,
-                             GL_FLOAT,
-                             GL_FALSE,
-                             sizeof(ImDrawVert),
-                             (const GLvoid *)offsetof(ImDrawVert, pos)));
-    GL(glVertexAttribPointer(g_ImDialogState.ATextureUV,
-                             2,
-                             GL_FLOAT,
-                             GL_FALSE,
-                             sizeof(ImDrawVert),
-                             (const GLvoid *)offsetof(ImDrawVert, uv)));
-    GL(glVertexAttribPointer(g_ImDialogState.AColor,
-                             4,
-                             GL_UNSIGNED_BYTE,
-                             GL_TRUE,
-                             sizeof(ImDrawVert),
-                             (const GLvoid *)offsetof(ImDrawVert, col)));
+static void CreateFontTexture() {
+    glGenTextures(1, &g_ImDialogState.FontTexture);
+    GL(glBindTexture(GL_TEXTURE_2D, g_ImDialogState.FontTexture));
+    GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+    GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+    GL(glBindTexture(GL_TEXTURE_2D, 0));
+    UploadFontAtlas(&g_ImDialogState.FontBake);
+}
 
-    GL(glEnableVertexAttribArray(g_ImDialogState.APosition));
-    GL(glEnableVertexAttribArray(g_ImDialogState.ATextureUV));
-    GL(glEnableVertexAttribArray(g_ImDialogState.AColor));
+// Compiling and linking is a good part of starting up on some drivers, so where the driver allows,
+// linked programs are cached, keyed on their sources and the driver. `binary_functions` is NULL if
+// it doesn't. The vertex shader, which all programs share, is compiled into `*vertex_shader` the
+// first time a program isn't found in the cache.
+static void CreateDialogProgram(ImDialogProgram *program,
+                                const ProgramBinaryFunctions *binary_functions,
+                                const char *vertex_source,
+                                GLuint *vertex_shader,
+                                const char *fragment_shader_filename,
+                                const char *fragment_source) {
+#ifdef IMDEBUG
+    uint64_t start_time = SDL_GetPerformanceCounter();
+#endif
+    program->Program = glCreateProgram();
+    uint64_t key = 0;
+    char *cache_path = NULL;
+    if (binary_functions != NULL) {
+        key = GetProgramCacheKey(vertex_source, fragment_source);
+        char cache_filename[64];
+        snprintf(cache_filename,
+                 sizeof(cache_filename),
+                 "program-%016llx",
+                 (unsigned long long)key);
+        cache_path = GetCacheFilePath(cache_filename);
+    }
 
-    glGenBuffers(1, &g_ImDialogState.IBO);
+    bool cached = cache_path != NULL &&
+        LoadCachedProgram(binary_functions, program->Program, cache_path, key);
+    if (!cached) {
+        if (*vertex_shader == 0)
+            *vertex_shader = CompileShaderFromCString(GL_VERTEX_SHADER, vertex_source);
+        GLuint fragment_shader = CompileShaderFromCString(GL_FRAGMENT_SHADER, fragment_source);
+        GL(glAttachShader(program->Program, *vertex_shader));
+        GL(glAttachShader(program->Program, fragment_shader));
+        GL(glBindAttribLocation(program->Program, POSITION_ATTRIBUTE, "aPosition"));
+        GL(glBindAttribLocation(program->Program, TEXTURE_UV_ATTRIBUTE, "aTextureUV"));
+        GL(glBindAttribLocation(program->Program, COLOR_ATTRIBUTE, "aColor"));
+        if (binary_functions != NULL && binary_functions->ProgramParameteri != NULL) {
+            GL(binary_functions->ProgramParameteri(program->Program,
+                                                   GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                                                   GL_TRUE));
+        }
+        GL(glLinkProgram(program->Program));
+        // It goes once the program does.
+        GL(glDeleteShader(fragment_shader));
+        if (cache_path != NULL)
+            SaveProgram(binary_functions, program->Program, cache_path, key);
+    }
+    free(cache_path);
+
+    program->UWindowSize = glGetUniformLocation(program->Program, "uWindowSize");
+    program->UTexture = glGetUniformLocation(program->Program, "uTexture");
+    GL(glUseProgram(program->Program));
+    GL(glUniform2f(program->UWindowSize,
+                   (GLfloat)g_ImDialogState.RenderWidth,
+                   (GLfloat)g_ImDialogState.RenderHeight));
+    GL(glUniform1i(program->UTexture, 0));
+#ifdef IMDEBUG
+    fprintf(stderr,
+            "%s program for `%s` in %.2f ms\n",
+            cached ? "loaded cached" :
+            binary_functions != NULL ? "compiled and cached" : "compiled",
+            fragment_shader_filename,
+            (double)(SDL_GetPerformanceCounter() - start_time) * 1000.0 /
+            (double)SDL_GetPerformanceFrequency());
+#endif
+}
+
+// Notes up to `*budget` bytes of `text`, taking them off the budget.
+static void NotePreparedText(const char *text, size_t length, size_t *budget) {
+    length = std::min(length, *budget);
+    NoteText(text, text + length);
+    *budget -= length;
+}
+
+// Notes the text a dialog starts out showing, so that its characters are in the first atlas rather
+// than baked into another once the first frame is drawn. The directories a file browser lists
+// aren't known until it scans them.
+static void NoteDialogText(UI *ui, size_t *budget) {
+    switch (ui->Type) {
+    case FileUIType:
+        NotePreparedText(ui->Data.File.Path, strlen(ui->Data.File.Path), budget);
+        break;
+    case InputUIType:
+        NotePreparedText(ui->Data.Input.Text, strlen(ui->Data.Input.Text), budget);
+        NotePreparedText(ui->Data.Input.Data, strlen(ui->Data.Input.Data), budget);
+        break;
+    case MenuUIType:
+    case ChecklistUIType:
+    case RadiolistUIType: {
+        const MenuUI *menu = &ui->Data.Menu;
+        NotePreparedText(menu->Text, strlen(menu->Text), budget);
+        for (size_t index = 0; index < menu->ItemCount && *budget > 0; index++) {
+            NotePreparedText(menu->Items[index].Tag, menu->Items[index].TagLength, budget);
+            NotePreparedText(menu->Items[index].Item, menu->Items[index].ItemLength, budget);
+        }
+        break;
+    }
+    case TextBoxUIType:
+    case TailBoxUIType: {
+        // A textbox starts at the top of its file and a tailbox at the bottom. This covers a page
+        // of the default height even if every line is as long as lines get.
+        TextFile *file = &ui->Data.TextBox.File;
+        static char text[DEFAULT_TEXT_BOX_HEIGHT * TEXT_FILE_MAX_LINE_LENGTH];
+        size_t length = (size_t)std::min((uint64_t)sizeof(text), file->Size);
+        uint64_t offset = ui->Type == TailBoxUIType ? file->Size - length : 0;
+        if (ReadTextFile(file, offset, length, text))
+            NotePreparedText(text, length, budget);
+        break;
+    }
+    case GaugeUIType:
+        NotePreparedText(ui->Data.Gauge.Text, strlen(ui->Data.Gauge.Text), budget);
+        break;
+    }
+}
+
+// Loads the shaders and bakes the font atlas, with the characters of `chain`, if there is one,
+// in it.
+static void PrepareDialogState(DialogChain *chain) {
+#ifdef IMDEBUG
+    uint64_t start_time = SDL_GetPerformanceCounter();
+#endif
+    g_ImDialogState.VertexSource = LoadShaderSource("imgui.vs.glsl");
+    g_ImDialogState.FontFragmentSource = LoadShaderSource("imgui.sdf.fs.glsl");
+    g_ImDialogState.TextureFragmentSource = LoadShaderSource("imgui.fs.glsl");
+    InitGlyphSet(&g_ImDialogState.Glyphs);
+    size_t budget = PREPARED_TEXT_SIZE;
+    for (int index = 0; chain != NULL && index < chain->Count; index++)
+        NoteDialogText(&chain->UIs[index], &budget);
+    BakeFontAtlas(&g_ImDialogState.FontBake, true);
+#ifdef IMDEBUG
+    g_ImDialogState.PrepareEndTime = SDL_GetPerformanceCounter();
+    fprintf(stderr,
+            "prepared the fonts and shaders in %.2f ms\n",
+            (double)(g_ImDialogState.PrepareEndTime - start_time) * 1000.0 /
+            (double)SDL_GetPerformanceFrequency());
+#endif
+}
+
+// Starts preparing the dialog state for `chain` on another thread, so that it's done while SDL
+// and the GL start up. `CreateDialogState` waits for it, and `chain` mustn't change until then.
+static void StartPreparingDialogState(DialogChain *chain) {
+    g_ImDialogState.PrepareStartTime = SDL_GetPerformanceCounter();
+    g_ImDialogState.PrepareThread = new std::thread(PrepareDialogState, chain);
+}
+
+static void CreateDialogState() {
+    if (g_ImDialogState.PrepareThread != NULL) {
+#ifdef IMDEBUG
+        uint64_t join_time = SDL_GetPerformanceCounter();
+#endif
+        g_ImDialogState.PrepareThread->join();
+        delete g_ImDialogState.PrepareThread;
+        g_ImDialogState.PrepareThread = NULL;
+#ifdef IMDEBUG
+        double frequency = (double)SDL_GetPerformanceFrequency();
+        double setup_time = (double)(join_time - g_ImDialogState.PrepareStartTime);
+        double prepare_time =
+            (double)(g_ImDialogState.PrepareEndTime - g_ImDialogState.PrepareStartTime);
+        fprintf(stderr,
+                "SDL and GL setup took %.2f ms, alongside %.2f ms of preparing; waited %.2f ms\n",
+                setup_time * 1000.0 / frequency,
+                prepare_time * 1000.0 / frequency,
+                (prepare_time > setup_time ? prepare_time - setup_time : 0.0) * 1000.0 / frequency);
+#endif
+    } else {
+        PrepareDialogState(NULL);
+    }
+    CreateFontTexture();
+
+    ProgramBinaryFunctions binary_functions;
+    const ProgramBinaryFunctions *cacheable =
+        GetProgramBinaryFunctions(&binary_functions) ? &binary_functions : NULL;
+    GLuint vertex_shader = 0;
+    CreateDialogProgram(&g_ImDialogState.FontProgram,
+                        cacheable,
+                        g_ImDialogState.VertexSource,
+                        &vertex_shader,
+                        "imgui.sdf.fs.glsl",
+                        g_ImDialogState.FontFragmentSource);
+    CreateDialogProgram(&g_ImDialogState.TextureProgram,
+                        cacheable,
+                        g_ImDialogState.VertexSource,
+                        &vertex_shader,
+                        "imgui.fs.glsl",
+                        g_ImDialogState.TextureFragmentSource);
+    if (vertex_shader != 0)
+        GL(glDeleteShader(vertex_shader));
+    free(g_ImDialogState.VertexSource);
+    free(g_ImDialogState.FontFragmentSource);
+    free(g_ImDialogState.TextureFragmentSource);
+    g_ImDialogState.VertexSource = NULL;
+    g_ImDialogState.FontFragmentSource = NULL;
+    g_ImDialogState.TextureFragmentSource = NULL;
+    InitStreamBuffer(&g_ImDialogState.VertexBuffer, GL_ARRAY_BUFFER);
+    InitStreamBuffer(&g_ImDialogState.IndexBuffer, GL_ELEMENT_ARRAY_BUFFER);
+    GL(glEnableVertexAttribArray(POSITION_ATTRIBUTE));
+    GL(glEnableVertexAttribArray(TEXTURE_UV_ATTRIBUTE));
+    GL(glEnableVertexAttribArray(COLOR_ATTRIBUTE));
+
+    // Nothing else draws, so this is all the GL state `RenderDrawLists` needs.
+    GL(glViewport(0, 0, g_ImDialogState.OutputWidth, g_ImDialogState.OutputHeight));
+    GL(glEnable(GL_BLEND));
+    GL(glDisable(GL_DEPTH_TEST));
+    GL(glBlendEquation(GL_FUNC_ADD));
+    GL(glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA));
+    GL(glActiveTexture(GL_TEXTURE0));
+    GL(glClearColor(0.0, 0.0, 0.0, 1.0));
 }
 
 static void InitKeys() {
@@ -731,9 +2932,107 @@ static void InitKeys() {
     io.KeyMap[ImGuiKey_Z] = SDLK_z;
 }
 
-extern "C" int main(int argc, char **argv) {
-    UI ui = ParseCommandLine(argc, (const char **)argv);
+// Returns `$IMDIALOG_RENDER_SCALE`, the fraction of the window's resolution that frames are drawn
+// at, or 1 if it's unset or out of range.
+static float GetRenderScale() {
+    const char *value = getenv("IMDIALOG_RENDER_SCALE");
+    if (value == NULL || value[0] == '\0')
+        return 1.0f;
+    char *end = NULL;
+    float scale = strtof(value, &end);
+    if (*end != '\0' || !(scale >= MIN_RENDER_SCALE && scale <= 1.0f)) {
+        fprintf(stderr,
+                "imdialog: ignoring render scale `%s`, which isn't from %g to 1\n",
+                value,
+                (double)MIN_RENDER_SCALE);
+        return 1.0f;
+    }
+    return scale;
+}
+
+static bool CanRenderToTexture() {
+#ifdef HAVE_OPENGLES2
+    return true;
+#elif defined(__APPLE__)
+    return false;
+#else
+    return GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object;
+#endif
+}
+
+// Sets frames up to be drawn at `scale` times the window's resolution, into a texture that's then
+// scaled up to fill the window. Frames are drawn straight into the window if `scale` is 1 or the GL
+// can't draw into a texture.
+static void CreateRenderTarget(float scale) {
+    g_ImDialogState.RenderWidth = g_ImDialogState.OutputWidth;
+    g_ImDialogState.RenderHeight = g_ImDialogState.OutputHeight;
+    if (scale >= 1.0f)
+        return;
+    if (!CanRenderToTexture()) {
+        fprintf(stderr, "imdialog: ignoring render scale, which this GL can't do\n");
+        return;
+    }
+    int width = (int)((float)g_ImDialogState.OutputWidth * scale + 0.5f);
+    int height = (int)((float)g_ImDialogState.OutputHeight * scale + 0.5f);
+    if (width < 1 || height < 1)
+        return;
+
+    // Scaling up is the only sampling it gets, and GLES2 only allows textures of any size without
+    // repeating or mipmaps.
+    GL(glGenTextures(1, &g_ImDialogState.RenderTexture));
+    GL(glBindTexture(GL_TEXTURE_2D, g_ImDialogState.RenderTexture));
+    GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+    GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+    GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+    GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+    GL(glTexImage2D(GL_TEXTURE_2D,
+                    0,
+                    GL_RGBA,
+                    width,
+                    height,
+                    0,
+                    GL_RGBA,
+                    GL_UNSIGNED_BYTE,
+                    NULL));
+    GL(glBindTexture(GL_TEXTURE_2D, 0));
+    GL(glGenFramebuffers(1, &g_ImDialogState.RenderFramebuffer));
+    GL(glBindFramebuffer(GL_FRAMEBUFFER, g_ImDialogState.RenderFramebuffer));
+    GL(glFramebufferTexture2D(GL_FRAMEBUFFER,
+                              GL_COLOR_ATTACHMENT0,
+                              GL_TEXTURE_2D,
+                              g_ImDialogState.RenderTexture,
+                              0));
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    GL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "imdialog: ignoring render scale, which this GL can't do: %#x\n", status);
+        GL(glDeleteFramebuffers(1, &g_ImDialogState.RenderFramebuffer));
+        GL(glDeleteTextures(1, &g_ImDialogState.RenderTexture));
+        g_ImDialogState.RenderFramebuffer = 0;
+        g_ImDialogState.RenderTexture = 0;
+        return;
+    }
+    g_ImDialogState.RenderWidth = width;
+    g_ImDialogState.RenderHeight = height;
+}
 
+// imgui's spacing is in the render target's pixels, so it's scaled down along with it to look the
+// same once scaled back up.
+static void ScaleStyle(float scale) {
+    ImGuiStyle &style = ImGui::GetStyle();
+    style.WindowPadding = ImVec2(style.WindowPadding.x * scale, style.WindowPadding.y * scale);
+    style.WindowMinSize = ImVec2(style.WindowMinSize.x * scale, style.WindowMinSize.y * scale);
+    style.FramePadding = ImVec2(style.FramePadding.x * scale, style.FramePadding.y * scale);
+    style.ItemSpacing = ImVec2(style.ItemSpacing.x * scale, style.ItemSpacing.y * scale);
+    style.ItemInnerSpacing =
+        ImVec2(style.ItemInnerSpacing.x * scale, style.ItemInnerSpacing.y * scale);
+    style.IndentSpacing *= scale;
+    style.ScrollbarSize *= scale;
+    style.GrabMinSize *= scale;
+}
+
+// Sets up SDL, the window and GL context, and the fonts and shaders every dialog draws with.
+static SDL_Window *CreateDialogWindow(SDL_GLContext *gl_context) {
     int error = SDL_Init(SDL_INIT_VIDEO);
     if (error != 0)
         abort();
@@ -741,15 +3040,26 @@ extern "C" int main(int argc, char **argv) {
     int value = 1;
     SDL_GL_GetAttribute(SDL_GL_DOUBLEBUFFER, &value);
 
+    int window_width = WINDOW_PIXEL_WIDTH;
+    int window_height = WINDOW_PIXEL_HEIGHT;
+#ifdef HAVE_OPENGLES2
+    SDL_DisplayMode display_mode;
+    if (SDL_GetDesktopDisplayMode(0, &display_mode) == 0) {
+        window_width = display_mode.w;
+        window_height = display_mode.h;
+    }
+#endif
     SDL_Window *window = SDL_CreateWindow("imdialog",
                                           SDL_WINDOWPOS_UNDEFINED,
                                           SDL_WINDOWPOS_UNDEFINED,
-                                          FRAMEBUFFER_WIDTH,
-                                          FRAMEBUFFER_HEIGHT,
+                                          window_width,
+                                          window_height,
                                           SDL_WINDOW_OPENGL);
-    SDL_GLContext gl_context = SDL_GL_CreateContext(window);
-    SDL_GL_MakeCurrent(window, gl_context);
+    *gl_context = SDL_GL_CreateContext(window);
+    SDL_GL_MakeCurrent(window, *gl_context);
+    SDL_GL_SetSwapInterval(1);
     SDL_ShowCursor(0);
+    g_WakeEventType = SDL_RegisterEvents(1);
 
 #if !defined(HAVE_OPENGLES2) && !defined(__APPLE__)
     int glewError = glewInit();
@@ -759,33 +3069,157 @@ extern "C" int main(int argc, char **argv) {
     }
 #endif
 
+    SDL_GL_GetDrawableSize(window, &g_ImDialogState.OutputWidth, &g_ImDialogState.OutputHeight);
+    CreateRenderTarget(GetRenderScale());
+    ScaleStyle((float)g_ImDialogState.RenderHeight / (float)g_ImDialogState.OutputHeight);
+#ifdef IMDEBUG
+    fprintf(stderr,
+            "drawing at %dx%d into a %dx%d window\n",
+            g_ImDialogState.RenderWidth,
+            g_ImDialogState.RenderHeight,
+            g_ImDialogState.OutputWidth,
+            g_ImDialogState.OutputHeight);
+#endif
     CreateDialogState();
     InitKeys();
 
     ImGuiIO &io = ImGui::GetIO();
     io.RenderDrawListsFn = RenderDrawLists;
-    io.DisplaySize = ImVec2((float)FRAMEBUFFER_WIDTH, (float)FRAMEBUFFER_HEIGHT);
+    io.DisplaySize =
+        ImVec2((float)g_ImDialogState.RenderWidth, (float)g_ImDialogState.RenderHeight);
     io.DisplayFramebufferScale = ImVec2(1.0, 1.0);
     io.DeltaTime = 1.0f / 60.0f;
+    return window;
+}
+
+static void DestroyDialogWindow(SDL_Window *window, SDL_GLContext gl_context) {
+    SDL_GL_DeleteContext(gl_context);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+
+#ifdef __linux__
+    int tty = fileno(stdin);
+    if (isatty(tty)) {
+        if (ioctl(tty, KDSKBMUTE, 0) != 0)
+            ioctl(tty, KDSKBMODE, K_XLATE);
+    }
+#endif
+}
+
+static void ClearDialogWindow(SDL_Window *window) {
+    GL(glClear(GL_COLOR_BUFFER_BIT));
+    SDL_GL_SwapWindow(window);
+    g_ImDialogState.ShownFrameRecorded = false;
+}
+
+// Makes imgui forget the last dialog, so that none of its state, such as the widget that had focus,
+// how far a list was scrolled, or which tree nodes were open, carries over to the next. Every
+// dialog is drawn in the same window, since imgui never frees one.
+static void ResetDialogWindow() {
+    ImGuiState &g = *GImGui;
+    ImGui::SetActiveID(0);
+    g.FocusedWindow = NULL;
+    for (int index = 0; index < g.Windows.Size; index++) {
+        ImGuiWindow *window = g.Windows[index];
+        window->Scroll = ImVec2(0.0f, 0.0f);
+        window->ScrollTarget = ImVec2(FLT_MAX, FLT_MAX);
+        window->StateStorage.Clear();
+        window->FocusIdxAllRequestNext = INT_MAX;
+        window->FocusIdxTabRequestNext = INT_MAX;
+    }
+}
+
+// Shows a dialog until it's done and returns its exit code. The dialog is abandoned if `cancelled`
+// is set, and `quit` is set if the window was closed.
+static int RunDialog(SDL_Window *window,
+                     UI *ui,
+                     uint64_t start_time,
+                     const std::atomic<bool> *cancelled,
+                     bool *quit) {
+    ImGuiIO &io = ImGui::GetIO();
+    ResetDialogWindow();
+
+    // Input from before the dialog, such as the release of the key that ended the last one, is
+    // dropped.
+    SDL_FlushEvents(SDL_FIRSTEVENT, SDL_LASTEVENT);
+    g_WakePending.store(false);
+    memset(io.KeysDown, 0, sizeof(io.KeysDown));
+
+    // Wakes from background threads are spaced out to at most one frame per display refresh, so a
+    // flood of updates, such as a gauge being fed as fast as its producer can write, costs no
+    // more drawing than the display can show. Vsync usually does this already, but it isn't
+    // always available.
+    SDL_DisplayMode display_mode;
+    int refresh_rate = 60;
+    if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &display_mode) == 0 &&
+        display_mode.refresh_rate > 0) {
+        refresh_rate = display_mode.refresh_rate;
+    }
+    uint64_t frame_interval = SDL_GetPerformanceFrequency() / refresh_rate;
 
     UIStatus status;
     bool done = false;
+    bool first_frame = true;
     while (!done) {
+        uint64_t frame_start_time = SDL_GetPerformanceCounter();
         ImGui::NewFrame();
         bool show_by_default = true;
         ImGui::SetNextWindowPosCenter();
+        // A zero size fits the window to the new dialog rather than keeping the last one's.
+        if (first_frame)
+            ImGui::SetNextWindowSize(ImVec2(0.0f, 0.0f));
+        first_frame = false;
         ImGui::Begin("imdialog",
                      &show_by_default,
-                     ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoResize);
+                     ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoResize |
+                     ImGuiWindowFlags_NoSavedSettings);
         if (!ImGui::IsAnyItemHovered() && !ImGui::IsAnyItemActive())
             ImGui::SetKeyboardFocusHere();
-        status = ProcessUI(&ui);
+        status = ProcessUI(ui);
         ImGui::End();
 
-        GL(glClearColor(0.0, 0.0, 0.0, 1.0));
-        GL(glClear(GL_COLOR_BUFFER_BIT));
         ImGui::Render();
-        SDL_GL_SwapWindow(window);
+        // Characters that weren't in the font atlas were just drawn with the fallback glyph, so
+        // rather than being shown, the frame is drawn again once they've been baked.
+        if (!status.Done && g_ImDialogState.Glyphs.Changed) {
+            FontAtlasBake bake;
+            BakeFontAtlas(&bake, false);
+            UploadFontAtlas(&bake);
+            io.MouseWheel = 0.0f;
+            continue;
+        }
+        if (g_ImDialogState.FrameSkipped) {
+            g_ImDialogState.SkippedFrameCount++;
+        } else {
+            SDL_GL_SwapWindow(window);
+            g_ImDialogState.ShownFrame = 1 - g_ImDialogState.ShownFrame;
+            g_ImDialogState.ShownFrameRecorded = g_ImDialogState.FrameRecorded;
+        }
+#ifdef IMDEBUG
+        if (start_time != 0) {
+            fprintf(stderr,
+                    "first frame shown %.2f ms after start\n",
+                    (double)(SDL_GetPerformanceCounter() - start_time) * 1000.0 /
+                    (double)SDL_GetPerformanceFrequency());
+            start_time = 0;
+        }
+        const RenderStats *stats = &g_ImDialogState.LastFrameStats;
+        if (g_ImDialogState.FrameSkipped) {
+            fprintf(stderr,
+                    "frame: unchanged, skipped (%llu skipped so far)\n",
+                    (unsigned long long)g_ImDialogState.SkippedFrameCount);
+        } else {
+            fprintf(stderr,
+                    "frame: %d draw calls, %d state changes, %zu bytes uploaded, "
+                    "drawn at %dx%d in %.2f ms\n",
+                    stats->DrawCalls,
+                    stats->StateChanges,
+                    stats->UploadSize,
+                    g_ImDialogState.RenderWidth,
+                    g_ImDialogState.RenderHeight,
+                    (double)stats->DrawTime * 1000.0 / (double)SDL_GetPerformanceFrequency());
+        }
+#endif
 
         if (status.Done) {
             done = true;
@@ -794,9 +3228,27 @@ extern "C" int main(int argc, char **argv) {
 
         SDL_Event event;
         int key;
+        io.MouseWheel = 0.0f;
         SDL_WaitEvent(&event);
-        if (event.type == SDL_QUIT)
+        if (event.type == SDL_QUIT) {
+            *quit = true;
             break;
+        }
+        // Whatever was on screen may have been lost.
+        if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_EXPOSED)
+            g_ImDialogState.ShownFrameRecorded = false;
+        if (event.type == g_WakeEventType) {
+            uint64_t elapsed = SDL_GetPerformanceCounter() - frame_start_time;
+            if (elapsed < frame_interval) {
+                SDL_Delay((Uint32)((frame_interval - elapsed) * 1000 /
+                                   SDL_GetPerformanceFrequency()));
+            }
+            g_WakePending.store(false);
+        }
+        if (cancelled != NULL && cancelled->load()) {
+            status.ExitCode = 1;
+            break;
+        }
         switch (event.type) {
         case SDL_QUIT:
             done = true;
@@ -804,6 +3256,9 @@ extern "C" int main(int argc, char **argv) {
         case SDL_TEXTINPUT:
             io.AddInputCharactersUTF8(event.text.text);
             break;
+        case SDL_MOUSEWHEEL:
+            io.MouseWheel = (float)event.wheel.y;
+            break;
         case SDL_KEYDOWN:
         case SDL_KEYUP:
             key = event.key.keysym.sym & ~SDLK_SCANCODE_MASK;
@@ -812,8 +3267,10 @@ extern "C" int main(int argc, char **argv) {
             io.KeyCtrl = ((SDL_GetModState() & KMOD_CTRL) != 0);
             io.KeyAlt = ((SDL_GetModState() & KMOD_ALT) != 0);
             io.KeySuper = ((SDL_GetModState() & KMOD_GUI) != 0);
-            if (key == SDLK_ESCAPE)
+            if (key == SDLK_ESCAPE) {
                 done = true;
+                status.ExitCode = ESCAPE_EXIT_CODE;
+            }
             break;
         }
 
@@ -823,23 +3280,208 @@ extern "C" int main(int argc, char **argv) {
         if (io.MouseDrawCursor)
             mouse_mask = SDL_GetMouseState(&mouse_x, &mouse_y);
         io.MousePos = ImVec2((float)mouse_x, (float)mouse_y);
+        // The mouse is in the window's pixels, and imgui works in the render target's.
+        if (mouse_x >= 0 && mouse_y >= 0) {
+            io.MousePos.x *= (float)g_ImDialogState.RenderWidth / g_ImDialogState.OutputWidth;
+            io.MousePos.y *= (float)g_ImDialogState.RenderHeight / g_ImDialogState.OutputHeight;
+        }
         io.MouseDown[0] = (mouse_mask & SDL_BUTTON(SDL_BUTTON_LEFT)) != 0;
         io.MouseDown[1] = (mouse_mask & SDL_BUTTON(SDL_BUTTON_RIGHT)) != 0;
         io.MouseDown[2] = (mouse_mask & SDL_BUTTON(SDL_BUTTON_MIDDLE)) != 0;
     }
+    return status.ExitCode;
+}
 
-    SDL_GL_DeleteContext(gl_context);
-    SDL_DestroyWindow(window);
-    SDL_Quit();
+// Shows the dialogs of a chain one after another, each result being written as its dialog ends,
+// until one of them is cancelled. The next dialog is drawn in the frame right after the last one
+// ends. Frees the chain.
+static int RunDialogChain(SDL_Window *window,
+                          DialogChain *chain,
+                          uint64_t start_time,
+                          const std::atomic<bool> *cancelled,
+                          bool *quit) {
+    int exit_code = 0;
+    for (int index = 0; index < chain->Count; index++) {
+        exit_code = RunDialog(window, &chain->UIs[index], start_time, cancelled, quit);
+        if (exit_code != 0 || *quit)
+            break;
+        start_time = SDL_GetPerformanceCounter();
+    }
+    FreeDialogChain(chain);
+    return exit_code;
+}
 
-#ifdef __linux__
-    int tty = fileno(stdin);
-    if (isatty(tty)) {
-        if (ioctl(tty, KDSKBMUTE, 0) != 0)
-            ioctl(tty, KDSKBMODE, K_XLATE);
+// Flags the client's dialog as abandoned once its connection becomes readable. Clients send
+// nothing after their request, so that only happens when they've gone away, or when the server
+// shuts the connection down after replying.
+static void WatchDialogClient(int connection, std::atomic<bool> *client_gone) {
+    struct pollfd poll_fd = { connection, POLLIN, 0 };
+    while (poll(&poll_fd, 1, -1) < 0 && errno == EINTR) {
     }
-#endif
+    client_gone->store(true);
+    WakeMainLoop(NULL);
+}
 
-    return status.ExitCode;
+// Waits on the listening socket until a client connects or `stop_fd` is closed, then wakes the
+// main loop.
+static void WatchListenSocket(int listen_fd, int stop_fd) {
+    struct pollfd poll_fds[2] = { { listen_fd, POLLIN, 0 }, { stop_fd, POLLIN, 0 } };
+    while (poll(poll_fds, 2, -1) < 0 && errno == EINTR) {
+    }
+    WakeMainLoop(NULL);
+}
+
+// Handles the window's events between dialogs until a client connects, so the window can still be
+// closed, and redrawn, while the server is idle. Returns false if it was closed.
+static bool WaitForDialogClient(SDL_Window *window, int listen_fd) {
+    int stop_pipe[2];
+    if (pipe(stop_pipe) != 0)
+        return false;
+    g_WakePending.store(false);
+    std::thread listen_watch(WatchListenSocket, listen_fd, stop_pipe[0]);
+    bool connected = false, closed = false;
+    while (!connected && !closed) {
+        SDL_Event event;
+        SDL_WaitEvent(&event);
+        if (event.type == SDL_QUIT) {
+            closed = true;
+        } else if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_EXPOSED) {
+            ClearDialogWindow(window);
+        } else if (event.type == g_WakeEventType) {
+            g_WakePending.store(false);
+            // Something left over from the last dialog may have woken the loop instead.
+            struct pollfd poll_fd = { listen_fd, POLLIN, 0 };
+            connected = poll(&poll_fd, 1, 0) > 0;
+        }
+    }
+    // Closing the write end wakes the watch if it's still waiting.
+    close(stop_pipe[1]);
+    listen_watch.join();
+    close(stop_pipe[0]);
+    return connected;
 }
 
+// With `--server`, shows dialogs for clients one after another until the window is closed. Each
+// dialog runs with the client's stdin, stdout and stderr in place of the server's and in the
+// client's working directory, so it behaves as if the client had shown it.
+static int RunServer(SDL_Window *window, const char *socket_path) {
+    int listen_fd = ListenForDialogRequests(socket_path);
+    if (listen_fd < 0) {
+        fprintf(stderr, "imdialog: couldn't listen on `%s`: %s\n", socket_path, strerror(errno));
+        return 1;
+    }
+    // A client that goes away mid-dialog mustn't take the server with it.
+    signal(SIGPIPE, SIG_IGN);
+
+    int server_fds[DIALOG_REQUEST_FD_COUNT];
+    for (int fd = 0; fd < DIALOG_REQUEST_FD_COUNT; fd++)
+        server_fds[fd] = fcntl(fd, F_DUPFD_CLOEXEC, DIALOG_REQUEST_FD_COUNT);
+    char *server_directory = getcwd(NULL, 0);
+
+    ClearDialogWindow(window);
+    bool quit = false;
+    while (!quit) {
+        if (!WaitForDialogClient(window, listen_fd))
+            break;
+        // The client may have given up and gone before it could be accepted.
+        DialogRequest request;
+        int connection = AcceptDialogRequest(listen_fd, &request);
+        if (connection < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            continue;
+        if (connection < 0)
+            break;
+        uint64_t start_time = SDL_GetPerformanceCounter();
+        for (int fd = 0; fd < DIALOG_REQUEST_FD_COUNT; fd++)
+            dup2(request.FDs[fd], fd);
+
+        // A request that can't be shown as the client would have shown it is refused, with the
+        // reason on the client's stderr.
+        int exit_code = 1;
+        DialogChain chain;
+        std::atomic<bool> client_gone(false);
+        std::thread client_watch;
+        if (request.WorkingDirectory[0] != '\0' && chdir(request.WorkingDirectory) != 0) {
+            fprintf(stderr,
+                    "imdialog: couldn't change to `%s`: %s\n",
+                    request.WorkingDirectory,
+                    strerror(errno));
+        } else if (ParseDialogChain(request.ArgumentCount, request.Arguments, &chain)) {
+            client_watch = std::thread(WatchDialogClient, connection, &client_gone);
+            exit_code = RunDialogChain(window, &chain, start_time, &client_gone, &quit);
+            ClearDialogWindow(window);
+        }
+
+        fflush(stdout);
+        fflush(stderr);
+        for (int fd = 0; fd < DIALOG_REQUEST_FD_COUNT; fd++)
+            dup2(server_fds[fd], fd);
+        if (server_directory != NULL && chdir(server_directory) != 0)
+            fprintf(stderr, "imdialog: couldn't change back to `%s`\n", server_directory);
+        SendDialogExitCode(connection, exit_code);
+        shutdown(connection, SHUT_RDWR);
+        if (client_watch.joinable())
+            client_watch.join();
+        close(connection);
+        FreeDialogRequest(&request);
+    }
+
+    free(server_directory);
+    for (int fd = 0; fd < DIALOG_REQUEST_FD_COUNT; fd++)
+        close(server_fds[fd]);
+    close(listen_fd);
+    unlink(socket_path);
+    return 0;
+}
+
+extern "C" int main(int argc, char **argv) {
+    uint64_t start_time = SDL_GetPerformanceCounter();
+    SDL_GLContext gl_context;
+    if (argc > 1 && strcmp(argv[1], "--server") == 0) {
+        if (argc != 3) {
+            Usage();
+            return EXIT_SUCCESS;
+        }
+        StartPreparingDialogState(NULL);
+        SDL_Window *window = CreateDialogWindow(&gl_context);
+        int exit_code = RunServer(window, argv[2]);
+        DestroyDialogWindow(window, gl_context);
+        return exit_code;
+    }
+
+    const char *server_socket_path = NULL;
+    if (argc > 1 && strcmp(argv[1], "--client") == 0) {
+        if (argc < 3) {
+            Usage();
+            return EXIT_SUCCESS;
+        }
+        server_socket_path = argv[2];
+        argv[2] = argv[0];
+        argc -= 2;
+        argv += 2;
+    }
+
+    // A client parses its arguments too, so that mistakes in them are reported before they reach
+    // the server.
+    DialogChain chain;
+    if (!ParseDialogChain(argc, (const char **)argv, &chain))
+        return 1;
+    if (server_socket_path != NULL) {
+        int connection = SendDialogRequest(server_socket_path, argc, (const char **)argv);
+        if (connection >= 0) {
+            FreeDialogChain(&chain);
+            int exit_code = 1;
+            if (!ReceiveDialogExitCode(connection, &exit_code))
+                fprintf(stderr, "imdialog: lost the connection to the server\n");
+            close(connection);
+            return exit_code;
+        }
+        // With no server to show it, the dialog is shown here instead.
+    }
+
+    StartPreparingDialogState(&chain);
+    SDL_Window *window = CreateDialogWindow(&gl_context);
+    bool quit = false;
+    int exit_code = RunDialogChain(window, &chain, start_time, NULL, &quit);
+    DestroyDialogWindow(window, gl_context);
+    return exit_code;
+}
@@ -0,0 +1,691 @@
+// imdirscan.cpp
+//
+// Lists a directory with as few system calls as possible: the directory is opened once, entry
+// types come from `d_type`, and only entries whose type that doesn't settle (`DT_UNKNOWN` and
+// symlinks) are `fstatat`ed relative to the directory descriptor. Background scans hand those
+// `fstatat`s to a small pool of threads so that, on network filesystems, the round trips overlap
+// instead of running back to back.
+
+#include "imdirscan.h"
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#define INITIAL_ENTRY_CAPACITY      64
+#define INITIAL_NAMES_CAPACITY      4096
+#define GETDENTS_BUFFER_SIZE        (64 * 1024)
+
+// Background scans hand entries over in batches of at least this many.
+#define SCAN_BATCH_SIZE             256
+
+#ifdef __linux__
+// The kernel's record layout for `getdents64`, which glibc doesn't export everywhere.
+struct LinuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+// Called for every visible entry of a directory being scanned. Returns false to stop the scan.
+typedef bool (*ScannedEntryFn)(void *data, int dir_fd, const char *name, unsigned char d_type);
+
+// An entry whose type is waiting on an `fstatat`. `NameOffset` points into `StatNames`.
+struct StatJob {
+    uint32_t Index;
+    uint32_t NameOffset;
+};
+
+// The result of a finished `fstatat`, to be applied to entry `Index` of the owner's listing.
+struct EntryMetadataUpdate {
+    uint32_t Index;
+    uint8_t Type;
+    int64_t Size;
+    int64_t MTime;
+};
+
+struct DirectoryScan {
+    char *Path;
+    int DirFD;
+    int StatThreadCount;
+    bool WantMetadata;
+    DirectoryScanNotifyFn Notify;
+    void *NotifyData;
+
+    // Entries the scanning thread has found but not yet published, and the stat jobs for those
+    // of them that are pending. Only the scanning thread touches these.
+    DirectoryListing Batch;
+    std::vector<StatJob> BatchStatJobs;
+    std::vector<char> BatchStatNames;
+    uint32_t EntryCount;
+
+    // Guards everything below. Published entries and type updates collect in `Pending` and
+    // `PendingUpdates`; the owner swaps them with `Taken` and `TakenUpdates` and copies out of
+    // those without holding the lock.
+    std::mutex Lock;
+    DirectoryListing Pending;
+    DirectoryListing Taken;
+    std::vector<EntryMetadataUpdate> PendingUpdates;
+    std::vector<EntryMetadataUpdate> TakenUpdates;
+    bool OwnerNotified;
+    bool EnumerationDone;
+    bool Finished;
+
+    // The stat pool's queue. Jobs are only queued once their entries have been published, so an
+    // update never reaches the owner ahead of the entry it applies to.
+    std::condition_variable StatCondition;
+    std::vector<StatJob> StatJobs;
+    std::vector<char> StatNames;
+    size_t NextStatJob;
+    size_t OutstandingStatCount;
+    int StatThreadsStarted;
+
+    std::atomic<bool> Cancelled;
+    // One reference for the owner, one for the scanning thread and one for each stat thread.
+    std::atomic<int> ReferenceCount;
+};
+
+#ifdef IMDEBUG
+// Setting `IMDIALOG_STAT_LATENCY_US` makes every entry go through a stat that first sleeps that
+// many microseconds, which simulates a network filesystem without `d_type` for timing scans.
+static long GetSimulatedStatLatency() {
+    static long latency = -1;
+    if (latency < 0) {
+        const char *value = getenv("IMDIALOG_STAT_LATENCY_US");
+        latency = value != NULL ? strtol(value, NULL, 0) : 0;
+    }
+    return latency;
+}
+#endif
+
+static void ReserveDirectoryListing(DirectoryListing *listing,
+                                    size_t entry_count,
+                                    size_t names_size) {
+    if (entry_count > listing->EntryCapacity) {
+        if (listing->EntryCapacity == 0)
+            listing->EntryCapacity = INITIAL_ENTRY_CAPACITY;
+        while (entry_count > listing->EntryCapacity)
+            listing->EntryCapacity *= 2;
+        listing->NameOffsets = (uint32_t *)realloc(listing->NameOffsets,
+                                                   sizeof(uint32_t) * listing->EntryCapacity);
+        listing->Types = (uint8_t *)realloc(listing->Types,
+                                            sizeof(uint8_t) * listing->EntryCapacity);
+        listing->Sizes = (int64_t *)realloc(listing->Sizes,
+                                            sizeof(int64_t) * listing->EntryCapacity);
+        listing->MTimes = (int64_t *)realloc(listing->MTimes,
+                                             sizeof(int64_t) * listing->EntryCapacity);
+    }
+    if (names_size > listing->NamesCapacity) {
+        if (listing->NamesCapacity == 0)
+            listing->NamesCapacity = INITIAL_NAMES_CAPACITY;
+        while (names_size > listing->NamesCapacity)
+            listing->NamesCapacity *= 2;
+        listing->Names = (char *)realloc(listing->Names, listing->NamesCapacity);
+    }
+}
+
+static void AddDirectoryListingEntry(DirectoryListing *listing,
+                                     const char *name,
+                                     size_t name_length,
+                                     DirectoryEntryType type,
+                                     int64_t size,
+                                     int64_t mtime) {
+    ReserveDirectoryListing(listing,
+                            listing->EntryCount + 1,
+                            listing->NamesSize + name_length + 1);
+    listing->NameOffsets[listing->EntryCount] = (uint32_t)listing->NamesSize;
+    listing->Types[listing->EntryCount] = (uint8_t)type;
+    listing->Sizes[listing->EntryCount] = size;
+    listing->MTimes[listing->EntryCount] = mtime;
+    listing->EntryCount++;
+    memcpy(&listing->Names[listing->NamesSize], name, name_length + 1);
+    listing->NamesSize += name_length + 1;
+}
+
+// Fills in `update` (apart from its index) for the entry `name` of the directory at `dir_fd`.
+static void StatEntry(int dir_fd, const char *name, EntryMetadataUpdate *update) {
+#ifdef IMDEBUG
+    if (GetSimulatedStatLatency() > 0)
+        usleep(GetSimulatedStatLatency());
+#endif
+    struct stat stats;
+    if (fstatat(dir_fd, name, &stats, 0) != 0) {
+        update->Type = DirectoryEntryTypeFile;
+        update->Size = DIRECTORY_ENTRY_UNKNOWN;
+        update->MTime = DIRECTORY_ENTRY_UNKNOWN;
+        return;
+    }
+    update->Type = S_ISDIR(stats.st_mode) ? DirectoryEntryTypeDirectory : DirectoryEntryTypeFile;
+    update->Size = (int64_t)stats.st_size;
+    update->MTime = (int64_t)stats.st_mtime;
+}
+
+// Returns the type `d_type` settles, or `DirectoryEntryTypePending` if the entry needs a stat.
+static DirectoryEntryType GetDirentType(unsigned char d_type) {
+#ifdef IMDEBUG
+    if (GetSimulatedStatLatency() > 0)
+        return DirectoryEntryTypePending;
+#endif
+    switch (d_type) {
+    case DT_DIR:
+        return DirectoryEntryTypeDirectory;
+    case DT_UNKNOWN:
+    case DT_LNK:
+        return DirectoryEntryTypePending;
+    default:
+        return DirectoryEntryTypeFile;
+    }
+}
+
+// Calls `fn` for every entry of the directory open at `dir_fd` that isn't a dotfile.
+static void ScanDirectoryEntries(int dir_fd, ScannedEntryFn fn, void *data) {
+#ifdef __linux__
+    char *buffer = (char *)malloc(GETDENTS_BUFFER_SIZE);
+    long length;
+    bool stopped = false;
+    while (!stopped &&
+           (length = syscall(SYS_getdents64, dir_fd, buffer, GETDENTS_BUFFER_SIZE)) > 0) {
+        for (long offset = 0; offset < length; ) {
+            const LinuxDirent64 *entry = (const LinuxDirent64 *)&buffer[offset];
+            offset += entry->d_reclen;
+            if (entry->d_name[0] == '.')
+                continue;
+            if (!fn(data, dir_fd, entry->d_name, entry->d_type)) {
+                stopped = true;
+                break;
+            }
+        }
+    }
+    free(buffer);
+#else
+    int dup_fd = dup(dir_fd);
+    DIR *dir = dup_fd >= 0 ? fdopendir(dup_fd) : NULL;
+    if (dir == NULL) {
+        if (dup_fd >= 0)
+            close(dup_fd);
+        return;
+    }
+    struct dirent *entry = NULL;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+        if (!fn(data, dirfd(dir), entry->d_name, entry->d_type))
+            break;
+    }
+    closedir(dir);
+#endif
+}
+
+static bool AddScannedEntry(void *data, int dir_fd, const char *name, unsigned char d_type) {
+    DirectoryListing *listing = (DirectoryListing *)data;
+    EntryMetadataUpdate metadata;
+    metadata.Type = GetDirentType(d_type);
+    metadata.Size = DIRECTORY_ENTRY_UNKNOWN;
+    metadata.MTime = DIRECTORY_ENTRY_UNKNOWN;
+    if (metadata.Type == DirectoryEntryTypePending)
+        StatEntry(dir_fd, name, &metadata);
+    AddDirectoryListingEntry(listing,
+                             name,
+                             strlen(name),
+                             (DirectoryEntryType)metadata.Type,
+                             metadata.Size,
+                             metadata.MTime);
+    return true;
+}
+
+bool ScanDirectory(DirectoryListing *listing, const char *path) {
+    ClearDirectoryListing(listing);
+
+    int dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0)
+        return false;
+    ScanDirectoryEntries(dir_fd, AddScannedEntry, listing);
+    close(dir_fd);
+    return true;
+}
+
+void AppendDirectoryListing(DirectoryListing *listing, const DirectoryListing *other) {
+    if (other->EntryCount == 0)
+        return;
+    ReserveDirectoryListing(listing,
+                            listing->EntryCount + other->EntryCount,
+                            listing->NamesSize + other->NamesSize);
+    for (size_t index = 0; index < other->EntryCount; index++) {
+        listing->NameOffsets[listing->EntryCount + index] =
+            (uint32_t)listing->NamesSize + other->NameOffsets[index];
+    }
+    memcpy(&listing->Types[listing->EntryCount], other->Types, other->EntryCount);
+    memcpy(&listing->Sizes[listing->EntryCount],
+           other->Sizes,
+           sizeof(int64_t) * other->EntryCount);
+    memcpy(&listing->MTimes[listing->EntryCount],
+           other->MTimes,
+           sizeof(int64_t) * other->EntryCount);
+    memcpy(&listing->Names[listing->NamesSize], other->Names, other->NamesSize);
+    listing->EntryCount += other->EntryCount;
+    listing->NamesSize += other->NamesSize;
+}
+
+void ClearDirectoryListing(DirectoryListing *listing) {
+    listing->NamesSize = 0;
+    listing->EntryCount = 0;
+}
+
+void FreeDirectoryListing(DirectoryListing *listing) {
+    free(listing->Names);
+    free(listing->NameOffsets);
+    free(listing->Types);
+    free(listing->Sizes);
+    free(listing->MTimes);
+    memset(listing, 0, sizeof(*listing));
+}
+
+static void ReleaseDirectoryScan(DirectoryScan *scan) {
+    if (scan->ReferenceCount.fetch_sub(1) != 1)
+        return;
+    if (scan->DirFD >= 0)
+        close(scan->DirFD);
+    FreeDirectoryListing(&scan->Batch);
+    FreeDirectoryListing(&scan->Pending);
+    FreeDirectoryListing(&scan->Taken);
+    free(scan->Path);
+    delete scan;
+}
+
+// Must be called with the lock held. Returns true if the owner should be woken up.
+static bool MarkDirectoryScanUpdated(DirectoryScan *scan) {
+    if (scan->OwnerNotified)
+        return false;
+    scan->OwnerNotified = true;
+    return true;
+}
+
+static void NotifyDirectoryScanOwner(DirectoryScan *scan) {
+    if (!scan->Cancelled.load() && scan->Notify != NULL)
+        scan->Notify(scan->NotifyData);
+}
+
+static void RunStatThread(DirectoryScan *scan) {
+    char name[NAME_MAX + 1];
+    while (true) {
+        StatJob job;
+        {
+            std::unique_lock<std::mutex> lock(scan->Lock);
+            while (!scan->Cancelled.load() &&
+                   scan->NextStatJob == scan->StatJobs.size() &&
+                   !scan->EnumerationDone) {
+                scan->StatCondition.wait(lock);
+            }
+            if (scan->Cancelled.load() || scan->NextStatJob == scan->StatJobs.size())
+                break;
+            job = scan->StatJobs[scan->NextStatJob++];
+            snprintf(name, sizeof(name), "%s", &scan->StatNames[job.NameOffset]);
+            if (scan->NextStatJob == scan->StatJobs.size()) {
+                scan->StatJobs.clear();
+                scan->StatNames.clear();
+                scan->NextStatJob = 0;
+            }
+        }
+
+        EntryMetadataUpdate update;
+        update.Index = job.Index;
+        StatEntry(scan->DirFD, name, &update);
+
+        bool notify;
+        {
+            std::lock_guard<std::mutex> lock(scan->Lock);
+            scan->PendingUpdates.push_back(update);
+            scan->OutstandingStatCount--;
+            if (scan->EnumerationDone && scan->OutstandingStatCount == 0)
+                scan->Finished = true;
+            notify = MarkDirectoryScanUpdated(scan);
+        }
+        if (notify)
+            NotifyDirectoryScanOwner(scan);
+    }
+    ReleaseDirectoryScan(scan);
+}
+
+// Must be called with the lock held.
+static void StartStatThreads(DirectoryScan *scan) {
+    while (scan->StatThreadsStarted < scan->StatThreadCount) {
+        scan->ReferenceCount.fetch_add(1);
+        std::thread(RunStatThread, scan).detach();
+        scan->StatThreadsStarted++;
+    }
+}
+
+// Moves the scanning thread's batch over to the owner, queues its stat jobs and wakes the owner
+// up if it isn't already due to take something.
+static void PublishDirectoryScanBatch(DirectoryScan *scan, bool enumeration_done) {
+    bool notify;
+    {
+        std::lock_guard<std::mutex> lock(scan->Lock);
+        AppendDirectoryListing(&scan->Pending, &scan->Batch);
+
+        if (!scan->BatchStatJobs.empty()) {
+            uint32_t name_base = (uint32_t)scan->StatNames.size();
+            for (size_t index = 0; index < scan->BatchStatJobs.size(); index++) {
+                StatJob job = scan->BatchStatJobs[index];
+                job.NameOffset += name_base;
+                scan->StatJobs.push_back(job);
+            }
+            scan->StatNames.insert(scan->StatNames.end(),
+                                   scan->BatchStatNames.begin(),
+                                   scan->BatchStatNames.end());
+            scan->OutstandingStatCount += scan->BatchStatJobs.size();
+            StartStatThreads(scan);
+        }
+
+        if (enumeration_done) {
+            scan->EnumerationDone = true;
+            scan->Finished = scan->OutstandingStatCount == 0;
+        }
+        notify = MarkDirectoryScanUpdated(scan);
+    }
+    scan->StatCondition.notify_all();
+
+    ClearDirectoryListing(&scan->Batch);
+    scan->BatchStatJobs.clear();
+    scan->BatchStatNames.clear();
+    if (notify)
+        NotifyDirectoryScanOwner(scan);
+}
+
+static bool AddBackgroundScannedEntry(void *data, int dir_fd, const char *name, unsigned char d_type) {
+    DirectoryScan *scan = (DirectoryScan *)data;
+    if (scan->Cancelled.load())
+        return false;
+
+    size_t name_length = strlen(name);
+    DirectoryEntryType type = GetDirentType(d_type);
+    if (type == DirectoryEntryTypePending || scan->WantMetadata) {
+        StatJob job;
+        job.Index = scan->EntryCount;
+        job.NameOffset = (uint32_t)scan->BatchStatNames.size();
+        scan->BatchStatJobs.push_back(job);
+        scan->BatchStatNames.insert(scan->BatchStatNames.end(), name, name + name_length + 1);
+    }
+    AddDirectoryListingEntry(&scan->Batch,
+                             name,
+                             name_length,
+                             type,
+                             DIRECTORY_ENTRY_UNKNOWN,
+                             DIRECTORY_ENTRY_UNKNOWN);
+    scan->EntryCount++;
+
+    if (scan->Batch.EntryCount >= SCAN_BATCH_SIZE)
+        PublishDirectoryScanBatch(scan, false);
+    return true;
+}
+
+static void RunDirectoryScan(DirectoryScan *scan) {
+    if (scan->DirFD >= 0)
+        ScanDirectoryEntries(scan->DirFD, AddBackgroundScannedEntry, scan);
+    if (!scan->Cancelled.load())
+        PublishDirectoryScanBatch(scan, true);
+    ReleaseDirectoryScan(scan);
+}
+
+DirectoryScan *StartDirectoryScan(const char *path,
+                                  int stat_thread_count,
+                                  bool want_metadata,
+                                  DirectoryScanNotifyFn notify,
+                                  void *notify_data) {
+    DirectoryScan *scan = new DirectoryScan();
+    scan->Path = strdup(path);
+    scan->DirFD = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    scan->StatThreadCount = stat_thread_count > 0 ? stat_thread_count : 1;
+    scan->WantMetadata = want_metadata;
+    scan->Notify = notify;
+    scan->NotifyData = notify_data;
+    memset(&scan->Batch, 0, sizeof(scan->Batch));
+    memset(&scan->Pending, 0, sizeof(scan->Pending));
+    memset(&scan->Taken, 0, sizeof(scan->Taken));
+    scan->EntryCount = 0;
+    scan->OwnerNotified = false;
+    scan->EnumerationDone = false;
+    scan->Finished = false;
+    scan->NextStatJob = 0;
+    scan->OutstandingStatCount = 0;
+    scan->StatThreadsStarted = 0;
+    scan->Cancelled.store(false);
+    scan->ReferenceCount.store(2);
+    std::thread(RunDirectoryScan, scan).detach();
+    return scan;
+}
+
+bool TakeDirectoryScanEntries(DirectoryScan *scan,
+                              DirectoryListing *listing,
+                              bool *metadata_updated) {
+    bool finished;
+    {
+        std::lock_guard<std::mutex> lock(scan->Lock);
+        DirectoryListing pending = scan->Pending;
+        scan->Pending = scan->Taken;
+        scan->Taken = pending;
+        scan->PendingUpdates.swap(scan->TakenUpdates);
+        scan->OwnerNotified = false;
+        finished = scan->Finished;
+    }
+
+    AppendDirectoryListing(listing, &scan->Taken);
+    ClearDirectoryListing(&scan->Taken);
+    for (size_t index = 0; index < scan->TakenUpdates.size(); index++) {
+        const EntryMetadataUpdate *update = &scan->TakenUpdates[index];
+        listing->Types[update->Index] = update->Type;
+        listing->Sizes[update->Index] = update->Size;
+        listing->MTimes[update->Index] = update->MTime;
+    }
+    *metadata_updated = !scan->TakenUpdates.empty();
+    scan->TakenUpdates.clear();
+    return finished;
+}
+
+void StopDirectoryScan(DirectoryScan *scan) {
+    {
+        std::lock_guard<std::mutex> lock(scan->Lock);
+        scan->Cancelled.store(true);
+    }
+    scan->StatCondition.notify_all();
+    ReleaseDirectoryScan(scan);
+}
+
+// Folds ASCII letters to lower case, which is all the case-insensitive orderings here do.
+static inline unsigned char FoldCase(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static inline bool IsDigit(unsigned char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Packs the first eight case-folded bytes of `name` into an integer that orders the same way.
+// With `natural` set, the first run of digits is packed as a '0' marker byte, which orders
+// correctly against names with a non-digit there, followed by the run's value in the bytes that
+// remain, saturating if it doesn't fit. Names whose keys tie are compared in full.
+static uint64_t ComputeNameKey(const char *name, bool natural) {
+    uint64_t key = 0;
+    for (int index = 0; index < 8 && name[index] != '\0'; index++) {
+        unsigned char c = FoldCase((unsigned char)name[index]);
+        int shift = 56 - index * 8;
+        if (!natural || !IsDigit(c)) {
+            key |= (uint64_t)c << shift;
+            continue;
+        }
+
+        key |= (uint64_t)'0' << shift;
+        if (shift == 0)
+            break;
+        uint64_t max_value = ((uint64_t)1 << shift) - 1;
+        uint64_t value = 0;
+        for (const char *digit = &name[index]; IsDigit(*digit); digit++) {
+            value = value * 10 + (uint64_t)(*digit - '0');
+            if (value > max_value) {
+                value = max_value;
+                break;
+            }
+        }
+        key |= value;
+        break;
+    }
+    return key;
+}
+
+static int CompareNames(const char *a, const char *b) {
+    while (*a != '\0' && FoldCase(*a) == FoldCase(*b)) {
+        a++;
+        b++;
+    }
+    return (int)FoldCase(*a) - (int)FoldCase(*b);
+}
+
+// Orders names case-insensitively, comparing runs of digits by their numeric value.
+static int CompareNamesNaturally(const char *a, const char *b) {
+    while (*a != '\0' && *b != '\0') {
+        if (IsDigit(*a) && IsDigit(*b)) {
+            while (*a == '0')
+                a++;
+            while (*b == '0')
+                b++;
+            const char *a_start = a, *b_start = b;
+            while (IsDigit(*a))
+                a++;
+            while (IsDigit(*b))
+                b++;
+            if (a - a_start != b - b_start)
+                return (int)(a - a_start) - (int)(b - b_start);
+            int result = memcmp(a_start, b_start, a - a_start);
+            if (result != 0)
+                return result;
+            continue;
+        }
+        if (FoldCase(*a) != FoldCase(*b))
+            return (int)FoldCase(*a) - (int)FoldCase(*b);
+        a++;
+        b++;
+    }
+    return (int)FoldCase(*a) - (int)FoldCase(*b);
+}
+
+// What an entry is sorted on, gathered into one record so that sorting walks contiguous memory
+// instead of chasing indices into the listing's arrays.
+struct DirectorySortRecord {
+    uint32_t Group;
+    uint32_t Index;
+    uint64_t Primary;
+    uint64_t NameKey;
+};
+
+struct DirectorySortComparator {
+    const DirectoryListing *Listing;
+    bool Natural;
+
+    bool operator()(const DirectorySortRecord &a, const DirectorySortRecord &b) const {
+        if (a.Group != b.Group)
+            return a.Group < b.Group;
+        if (a.Primary != b.Primary)
+            return a.Primary < b.Primary;
+        if (a.NameKey != b.NameKey)
+            return a.NameKey < b.NameKey;
+        const char *a_name = GetDirectoryListingName(Listing, a.Index);
+        const char *b_name = GetDirectoryListingName(Listing, b.Index);
+        int result = Natural ? CompareNamesNaturally(a_name, b_name) : CompareNames(a_name, b_name);
+        return result != 0 ? result < 0 : a.Index < b.Index;
+    }
+};
+
+// Maps a signed value onto an unsigned key that sorts the largest value first.
+static inline uint64_t DescendingKey(int64_t value) {
+    return (uint64_t)INT64_MAX - (uint64_t)value;
+}
+
+void SortDirectoryView(DirectoryView *view,
+                       const DirectoryListing *listing,
+                       DirectorySortMode mode,
+                       bool directories_first) {
+    if (listing->EntryCount > view->Capacity) {
+        view->Capacity = listing->EntryCapacity;
+        view->Order = (uint32_t *)realloc(view->Order, sizeof(uint32_t) * view->Capacity);
+        view->NameKeys = (uint64_t *)realloc(view->NameKeys, sizeof(uint64_t) * view->Capacity);
+    }
+    view->Count = listing->EntryCount;
+    if (mode == DirectorySortNone && !directories_first) {
+        for (size_t index = 0; index < listing->EntryCount; index++)
+            view->Order[index] = (uint32_t)index;
+        return;
+    }
+
+    // Entries are only ever appended until the listing is cleared, which resets the view, so keys
+    // only need computing for entries that are new since the last sort, unless the kind of key
+    // changed.
+    bool natural = mode == DirectorySortNatural;
+    if (natural != view->NaturalKeys) {
+        view->KeyCount = 0;
+        view->NaturalKeys = natural;
+    }
+    for (size_t index = view->KeyCount; index < listing->EntryCount; index++)
+        view->NameKeys[index] = ComputeNameKey(GetDirectoryListingName(listing, index), natural);
+    view->KeyCount = listing->EntryCount;
+
+    DirectorySortRecord *records =
+        (DirectorySortRecord *)malloc(sizeof(DirectorySortRecord) * listing->EntryCount);
+    for (size_t index = 0; index < listing->EntryCount; index++) {
+        DirectorySortRecord *record = &records[index];
+        record->Group = directories_first &&
+            listing->Types[index] != DirectoryEntryTypeDirectory ? 1 : 0;
+        record->Index = (uint32_t)index;
+        record->NameKey = view->NameKeys[index];
+        switch (mode) {
+        case DirectorySortNone:
+            record->Primary = index;
+            break;
+        case DirectorySortByMTime:
+            record->Primary = DescendingKey(listing->MTimes[index]);
+            break;
+        case DirectorySortBySize:
+            record->Primary = DescendingKey(listing->Sizes[index]);
+            break;
+        default:
+            record->Primary = 0;
+            break;
+        }
+    }
+
+    DirectorySortComparator comparator;
+    comparator.Listing = listing;
+    comparator.Natural = natural;
+    std::sort(records, records + listing->EntryCount, comparator);
+    for (size_t index = 0; index < listing->EntryCount; index++)
+        view->Order[index] = records[index].Index;
+    free(records);
+}
+
+void ResetDirectoryView(DirectoryView *view) {
+    view->Count = 0;
+    view->KeyCount = 0;
+}
+
+void FreeDirectoryView(DirectoryView *view) {
+    free(view->Order);
+    free(view->NameKeys);
+    memset(view, 0, sizeof(*view));
+}
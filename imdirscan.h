@@ -0,0 +1,114 @@
+// imdirscan.h
+
+#ifndef IMDIRSCAN_H
+#define IMDIRSCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum DirectoryEntryType {
+    DirectoryEntryTypeFile,
+    DirectoryEntryTypeDirectory,
+    // Background scans only: the entry's type is still being looked up.
+    DirectoryEntryTypePending,
+};
+
+// Sizes and modification times that haven't been looked up.
+#define DIRECTORY_ENTRY_UNKNOWN     (-1)
+
+// The visible entries of one directory, as parallel arrays. Names are stored back to back,
+// NUL-terminated and without a trailing slash, in the single `Names` buffer; `NameOffsets[i]` is
+// where the ith name starts, `Types[i]` is its `DirectoryEntryType`, and `Sizes[i]` and
+// `MTimes[i]` are its size in bytes and modification time, or `DIRECTORY_ENTRY_UNKNOWN`.
+struct DirectoryListing {
+    char *Names;
+    size_t NamesSize;
+    size_t NamesCapacity;
+    uint32_t *NameOffsets;
+    uint8_t *Types;
+    int64_t *Sizes;
+    int64_t *MTimes;
+    size_t EntryCount;
+    size_t EntryCapacity;
+};
+
+enum DirectorySortMode {
+    // The order the directory returned its entries in.
+    DirectorySortNone,
+    DirectorySortByName,
+    // By name, but with runs of digits compared by their value, so "file2" comes before "file10".
+    DirectorySortNatural,
+    DirectorySortByMTime,
+    DirectorySortBySize,
+    DirectorySortModeCount,
+};
+
+// A sorted order over a `DirectoryListing`. `Order[i]` is the listing index of the ith entry.
+// Sorting compares precomputed integer keys and only falls back to comparing names when their
+// keys tie, so re-sorting never touches the filesystem or copies a name.
+struct DirectoryView {
+    uint32_t *Order;
+    uint64_t *NameKeys;
+    size_t Count;
+    size_t KeyCount;
+    size_t Capacity;
+    bool NaturalKeys;
+};
+
+// Replaces the contents of `listing` with the entries of the directory at `path`, skipping
+// dotfiles. Returns false if the directory couldn't be opened.
+bool ScanDirectory(DirectoryListing *listing, const char *path);
+
+// Appends every entry of `other` to `listing`.
+void AppendDirectoryListing(DirectoryListing *listing, const DirectoryListing *other);
+
+void ClearDirectoryListing(DirectoryListing *listing);
+void FreeDirectoryListing(DirectoryListing *listing);
+
+// A directory listing being built on a background thread.
+struct DirectoryScan;
+
+// Called from the scanning thread when new entries become available to take.
+typedef void (*DirectoryScanNotifyFn)(void *data);
+
+// Starts listing the directory at `path` on a background thread. Entries arrive straight away;
+// those whose type needs a stat arrive as `DirectoryEntryTypePending` and are looked up by up to
+// `stat_thread_count` threads in parallel. With `want_metadata` set every entry is stat'ed so
+// that its size and modification time get filled in too. `notify` is called whenever there is
+// something new to take and the owner hasn't been told yet. An unreadable directory finishes
+// with no entries.
+DirectoryScan *StartDirectoryScan(const char *path,
+                                  int stat_thread_count,
+                                  bool want_metadata,
+                                  DirectoryScanNotifyFn notify,
+                                  void *notify_data);
+
+// Appends the entries found since the last call to `listing` and fills in the metadata of entries
+// that has been looked up since, setting `*metadata_updated` if there was any. `listing` must have
+// been empty when the scan started. Returns true once the scan has finished and everything has
+// been handed over.
+bool TakeDirectoryScanEntries(DirectoryScan *scan,
+                              DirectoryListing *listing,
+                              bool *metadata_updated);
+
+// Gives up the owner's reference to `scan`, cancelling it if it's still running. The scanning
+// thread stops at its next entry; `notify` may still be called once while it winds down.
+void StopDirectoryScan(DirectoryScan *scan);
+
+// Re-sorts `view` over every entry of `listing`. The view keeps keys for the entries it has already
+// sorted, so it must be reset whenever `listing` is cleared.
+void SortDirectoryView(DirectoryView *view,
+                       const DirectoryListing *listing,
+                       DirectorySortMode mode,
+                       bool directories_first);
+
+// Forgets everything `view` knows about its listing, for when the listing is cleared.
+void ResetDirectoryView(DirectoryView *view);
+
+void FreeDirectoryView(DirectoryView *view);
+
+inline const char *GetDirectoryListingName(const DirectoryListing *listing, size_t index) {
+    return &listing->Names[listing->NameOffsets[index]];
+}
+
+#endif
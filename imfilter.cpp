@@ -0,0 +1,239 @@
+// imfilter.cpp
+
+#include "imfilter.h"
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+static inline char FoldCase(char c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// Folds ASCII letters in `text` to lowercase, in place.
+static void FoldText(char *text, size_t length) {
+    size_t position = 0;
+#if defined(__SSE2__)
+    // Bytes from 0x80 up compare as negative, so they're never taken for letters.
+    const __m128i before_a = _mm_set1_epi8('A' - 1);
+    const __m128i after_z = _mm_set1_epi8('Z' + 1);
+    const __m128i lowercase_bit = _mm_set1_epi8(0x20);
+    for (; position + 16 <= length; position += 16) {
+        __m128i chars = _mm_loadu_si128((const __m128i *)&text[position]);
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(chars, before_a),
+                                      _mm_cmplt_epi8(chars, after_z));
+        chars = _mm_or_si128(chars, _mm_and_si128(upper, lowercase_bit));
+        _mm_storeu_si128((__m128i *)&text[position], chars);
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t a = vdupq_n_u8('A');
+    const uint8x16_t z = vdupq_n_u8('Z');
+    const uint8x16_t lowercase_bit = vdupq_n_u8(0x20);
+    for (; position + 16 <= length; position += 16) {
+        uint8x16_t chars = vld1q_u8((const uint8_t *)&text[position]);
+        uint8x16_t upper = vandq_u8(vcgeq_u8(chars, a), vcleq_u8(chars, z));
+        chars = vorrq_u8(chars, vandq_u8(upper, lowercase_bit));
+        vst1q_u8((uint8_t *)&text[position], chars);
+    }
+#endif
+    for (; position < length; position++)
+        text[position] = FoldCase(text[position]);
+}
+
+// Looks for the first and last characters of the pattern 16 positions at a time, and compares
+// the rest only where both match. Whatever is left over at the end is searched with `memchr`.
+size_t FindText(const char *text, size_t text_length, const char *pattern, size_t pattern_length) {
+    if (pattern_length == 0)
+        return 0;
+    if (pattern_length > text_length)
+        return SIZE_MAX;
+
+    // The last position at which a match could start.
+    size_t last_start = text_length - pattern_length;
+    size_t start = 0;
+
+#if defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(pattern[0]);
+    const __m128i last = _mm_set1_epi8(pattern[pattern_length - 1]);
+    for (; start + 15 <= last_start; start += 16) {
+        __m128i head = _mm_loadu_si128((const __m128i *)&text[start]);
+        __m128i tail = _mm_loadu_si128((const __m128i *)&text[start + pattern_length - 1]);
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first),
+                                                                  _mm_cmpeq_epi8(tail, last)));
+        while (mask != 0) {
+            size_t candidate = start + (size_t)__builtin_ctz(mask);
+            if (memcmp(&text[candidate], pattern, pattern_length) == 0)
+                return candidate;
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t first = vdupq_n_u8((uint8_t)pattern[0]);
+    const uint8x16_t last = vdupq_n_u8((uint8_t)pattern[pattern_length - 1]);
+    for (; start + 15 <= last_start; start += 16) {
+        uint8x16_t head = vld1q_u8((const uint8_t *)&text[start]);
+        uint8x16_t tail = vld1q_u8((const uint8_t *)&text[start + pattern_length - 1]);
+        uint8x16_t equal = vandq_u8(vceqq_u8(head, first), vceqq_u8(tail, last));
+        // NEON has no movemask, so narrow each byte of the comparison to a nibble instead.
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(equal),
+                                                                      4)),
+                                      0);
+        while (mask != 0) {
+            size_t candidate = start + (size_t)(__builtin_ctzll(mask) >> 2);
+            if (memcmp(&text[candidate], pattern, pattern_length) == 0)
+                return candidate;
+            mask &= ~((uint64_t)0xf << ((candidate - start) * 4));
+        }
+    }
+#endif
+
+    while (start <= last_start) {
+        const char *candidate = (const char *)memchr(&text[start],
+                                                     pattern[0],
+                                                     last_start - start + 1);
+        if (candidate == NULL)
+            break;
+        start = candidate - text;
+        if (memcmp(candidate, pattern, pattern_length) == 0)
+            return start;
+        start++;
+    }
+    return SIZE_MAX;
+}
+
+void InitTextFilter(TextFilter *filter) {
+    memset(filter, 0, sizeof(*filter));
+    filter->RecordCapacity = 1;
+    filter->RecordOffsets = (size_t *)malloc(sizeof(size_t));
+    filter->RecordOffsets[0] = 0;
+}
+
+void FreeTextFilter(TextFilter *filter) {
+    free(filter->Text);
+    free(filter->RecordOffsets);
+    free(filter->Query);
+    free(filter->Matches);
+    memset(filter, 0, sizeof(*filter));
+}
+
+void AddTextFilterRecord(TextFilter *filter,
+                         const char *const *fields,
+                         const size_t *field_lengths,
+                         int field_count) {
+    size_t record_size = 0;
+    for (int field = 0; field < field_count; field++)
+        record_size += field_lengths[field] + 1;
+    if (filter->TextSize + record_size > filter->TextCapacity) {
+        filter->TextCapacity = std::max(filter->TextCapacity * 2,
+                                        filter->TextSize + record_size + 4096);
+        filter->Text = (char *)realloc(filter->Text, filter->TextCapacity);
+    }
+
+    // The NUL separators keep matches from straddling fields or records, since no query can
+    // contain one.
+    char *text = &filter->Text[filter->TextSize];
+    for (int field = 0; field < field_count; field++) {
+        memcpy(text, fields[field], field_lengths[field]);
+        FoldText(text, field_lengths[field]);
+        text += field_lengths[field];
+        *text++ = '\0';
+    }
+    filter->TextSize += record_size;
+
+    if (filter->RecordCount + 2 > filter->RecordCapacity) {
+        filter->RecordCapacity *= 2;
+        filter->RecordOffsets = (size_t *)realloc(filter->RecordOffsets,
+                                                  sizeof(size_t) * filter->RecordCapacity);
+    }
+    filter->RecordOffsets[++filter->RecordCount] = filter->TextSize;
+}
+
+static void AddTextFilterMatch(TextFilter *filter, size_t record) {
+    if (filter->MatchCount == filter->MatchCapacity) {
+        filter->MatchCapacity = filter->MatchCapacity == 0 ? 1024 : filter->MatchCapacity * 2;
+        filter->Matches = (uint32_t *)realloc(filter->Matches,
+                                              sizeof(uint32_t) * filter->MatchCapacity);
+    }
+    filter->Matches[filter->MatchCount++] = (uint32_t)record;
+}
+
+void UpdateTextFilter(TextFilter *filter) {
+    if (filter->QueryLength == 0) {
+        filter->FilteredRecordCount = filter->RecordCount;
+        return;
+    }
+
+    // Search all the new records in one pass, skipping to the start of the next record after
+    // each match.
+    const size_t *offsets = filter->RecordOffsets;
+    size_t record = filter->FilteredRecordCount;
+    size_t position = offsets[record];
+    while (record < filter->RecordCount) {
+        size_t match = FindText(&filter->Text[position],
+                                filter->TextSize - position,
+                                filter->Query,
+                                filter->QueryLength);
+        if (match == SIZE_MAX)
+            break;
+        match += position;
+        // Stepping over the records is no more work than the search that skipped them was.
+        while (offsets[record + 1] <= match)
+            record++;
+        AddTextFilterMatch(filter, record);
+        record++;
+        position = offsets[record];
+    }
+    filter->FilteredRecordCount = filter->RecordCount;
+}
+
+void SetTextFilterQuery(TextFilter *filter, const char *query) {
+    size_t length = strlen(query);
+    if (length + 1 > filter->QueryCapacity) {
+        filter->QueryCapacity = length + 1;
+        filter->Query = (char *)realloc(filter->Query, filter->QueryCapacity);
+    }
+    char *folded = (char *)malloc(length + 1);
+    memcpy(folded, query, length + 1);
+    FoldText(folded, length);
+    if (length == filter->QueryLength && memcmp(folded, filter->Query, length) == 0) {
+        free(folded);
+        UpdateTextFilter(filter);
+        return;
+    }
+
+    // Anything that contains the new query also contains the old one, so if the new query
+    // contains the old one, only the old matches need to be searched. That's only worth it if
+    // they're a minority, since searching one record at a time is slower than a single pass.
+    bool narrowing = filter->QueryLength > 0 &&
+        filter->MatchCount < filter->FilteredRecordCount / 2 &&
+        FindText(folded, length, filter->Query, filter->QueryLength) != SIZE_MAX;
+    memcpy(filter->Query, folded, length + 1);
+    filter->QueryLength = length;
+    free(folded);
+
+    if (!narrowing) {
+        filter->MatchCount = 0;
+        filter->FilteredRecordCount = 0;
+        UpdateTextFilter(filter);
+        return;
+    }
+
+    size_t match_count = 0;
+    for (size_t match = 0; match < filter->MatchCount; match++) {
+        uint32_t record = filter->Matches[match];
+        size_t start = filter->RecordOffsets[record];
+        if (FindText(&filter->Text[start],
+                     filter->RecordOffsets[record + 1] - start,
+                     filter->Query,
+                     filter->QueryLength) != SIZE_MAX) {
+            filter->Matches[match_count++] = record;
+        }
+    }
+    filter->MatchCount = match_count;
+    UpdateTextFilter(filter);
+}
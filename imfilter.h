@@ -0,0 +1,52 @@
+// imfilter.h
+
+#ifndef IMFILTER_H
+#define IMFILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Returns the offset of the first occurrence of `pattern` in `text`, or `SIZE_MAX` if there is
+// none. Uses SSE2 or NEON where available.
+size_t FindText(const char *text, size_t text_length, const char *pattern, size_t pattern_length);
+
+// Case-insensitive substring filtering over a growing list of records, each made of one or more
+// text fields. Records are folded to lowercase as they're added and stored back to back,
+// NUL-separated, so that filtering everything is a single pass of `FindText` over one buffer.
+// When a query extends the previous one, only the previous matches are searched again.
+struct TextFilter {
+    char *Text;
+    size_t TextSize;
+    size_t TextCapacity;
+    // Record `i` spans `Text[RecordOffsets[i]]` up to `Text[RecordOffsets[i + 1]]`.
+    size_t *RecordOffsets;
+    size_t RecordCount;
+    size_t RecordCapacity;
+
+    char *Query;
+    size_t QueryLength;
+    size_t QueryCapacity;
+
+    // Indices of the matching records, in order. Records below `FilteredRecordCount` have been
+    // filtered against the current query.
+    uint32_t *Matches;
+    size_t MatchCount;
+    size_t MatchCapacity;
+    size_t FilteredRecordCount;
+};
+
+void InitTextFilter(TextFilter *filter);
+void FreeTextFilter(TextFilter *filter);
+
+void AddTextFilterRecord(TextFilter *filter,
+                         const char *const *fields,
+                         const size_t *field_lengths,
+                         int field_count);
+
+// Sets the query and filters every record against it. An empty query matches everything.
+void SetTextFilterQuery(TextFilter *filter, const char *query);
+
+// Filters records added since the last call against the current query.
+void UpdateTextFilter(TextFilter *filter);
+
+#endif
@@ -0,0 +1,563 @@
+// imfind.cpp
+//
+// A background recursive file indexer and an incremental fuzzy matcher over its results, for
+// finding files several levels below the file browser's directory by typing part of their path.
+
+#include "imfind.h"
+#include "imdirscan.h"
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <fnmatch.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+// Entries live in fixed-size blocks that never move once allocated, so the owner can read
+// published entries while the indexing thread keeps appending.
+#define ENTRY_BLOCK_SHIFT   16
+#define ENTRY_BLOCK_SIZE    (1 << ENTRY_BLOCK_SHIFT)
+#define MAX_ENTRY_BLOCKS    1024
+
+// Names are packed into blocks the same way; an entry's `Name` is its block index shifted up by
+// `NAME_BLOCK_SHIFT` plus its offset within the block.
+#define NAME_BLOCK_SHIFT    20
+#define NAME_BLOCK_SIZE     (1 << NAME_BLOCK_SHIFT)
+#define MAX_NAME_BLOCKS     4096
+
+// The indexing thread notifies its owner after publishing at least this many new entries.
+#define INDEX_NOTIFY_INTERVAL   4096
+
+// How many candidates the matcher processes between checks of its time budget.
+#define MATCH_BUDGET_CHECK_INTERVAL 256
+
+#define FILE_INDEX_ENTRY_DIRECTORY  0x01
+
+struct FileIndexEntry {
+    uint32_t Parent;
+    uint32_t Name;
+    uint16_t Depth;
+    uint8_t Flags;
+    uint8_t NameLength;
+};
+
+struct FileIndex {
+    char *Root;
+    int MaxDepth;
+    char **IgnorePatterns;
+    int IgnorePatternCount;
+    FileIndexNotifyFn Notify;
+    void *NotifyData;
+
+    FileIndexEntry *EntryBlocks[MAX_ENTRY_BLOCKS];
+    char *NameBlocks[MAX_NAME_BLOCKS];
+
+    // Only the indexing thread touches these.
+    size_t EntryCount;
+    size_t NameBlockCount;
+    size_t NameBlockUsed;
+
+    std::atomic<size_t> PublishedEntryCount;
+    std::atomic<bool> Finished;
+    std::atomic<bool> Cancelled;
+    // One reference for the owner and one for the indexing thread.
+    std::atomic<int> ReferenceCount;
+};
+
+static inline const FileIndexEntry *GetEntry(const FileIndex *index, uint32_t entry) {
+    return &index->EntryBlocks[entry >> ENTRY_BLOCK_SHIFT][entry & (ENTRY_BLOCK_SIZE - 1)];
+}
+
+const char *GetFileIndexRoot(const FileIndex *index) {
+    return index->Root;
+}
+
+size_t GetFileIndexEntryCount(const FileIndex *index) {
+    return index->PublishedEntryCount.load(std::memory_order_acquire);
+}
+
+bool IsFileIndexFinished(const FileIndex *index) {
+    return index->Finished.load();
+}
+
+const char *GetFileIndexName(const FileIndex *index, uint32_t entry) {
+    uint32_t name = GetEntry(index, entry)->Name;
+    return &index->NameBlocks[name >> NAME_BLOCK_SHIFT][name & (NAME_BLOCK_SIZE - 1)];
+}
+
+uint32_t GetFileIndexParent(const FileIndex *index, uint32_t entry) {
+    return GetEntry(index, entry)->Parent;
+}
+
+bool IsFileIndexDirectory(const FileIndex *index, uint32_t entry) {
+    return (GetEntry(index, entry)->Flags & FILE_INDEX_ENTRY_DIRECTORY) != 0;
+}
+
+bool GetFileIndexPath(const FileIndex *index, uint32_t entry, char *buffer, size_t buffer_size) {
+    // Fill the buffer from the end, walking up through the parents.
+    char *start = buffer + buffer_size - 1;
+    *start = '\0';
+    while (entry != FILE_INDEX_NO_PARENT) {
+        const FileIndexEntry *index_entry = GetEntry(index, entry);
+        if (start - buffer < index_entry->NameLength + 1) {
+            buffer[0] = '\0';
+            return false;
+        }
+        start -= index_entry->NameLength;
+        memcpy(start, GetFileIndexName(index, entry), index_entry->NameLength);
+        entry = index_entry->Parent;
+        if (entry != FILE_INDEX_NO_PARENT)
+            *--start = '/';
+    }
+    memmove(buffer, start, buffer + buffer_size - start);
+    return true;
+}
+
+static bool IsIgnored(const FileIndex *index, const char *name) {
+    for (int pattern = 0; pattern < index->IgnorePatternCount; pattern++) {
+        if (fnmatch(index->IgnorePatterns[pattern], name, 0) == 0)
+            return true;
+    }
+    return false;
+}
+
+// Appends an entry. Returns false once the index is full.
+static bool AddFileIndexEntry(FileIndex *index,
+                              uint32_t parent,
+                              int depth,
+                              const char *name,
+                              bool is_directory) {
+    size_t block = index->EntryCount >> ENTRY_BLOCK_SHIFT;
+    if (block >= MAX_ENTRY_BLOCKS)
+        return false;
+    if (index->EntryBlocks[block] == NULL) {
+        index->EntryBlocks[block] =
+            (FileIndexEntry *)malloc(sizeof(FileIndexEntry) * ENTRY_BLOCK_SIZE);
+    }
+
+    size_t name_length = strlen(name);
+    if (name_length > UINT8_MAX)
+        return true;
+    if (index->NameBlockCount == 0 || index->NameBlockUsed + name_length + 1 > NAME_BLOCK_SIZE) {
+        if (index->NameBlockCount == MAX_NAME_BLOCKS)
+            return false;
+        index->NameBlocks[index->NameBlockCount++] = (char *)malloc(NAME_BLOCK_SIZE);
+        index->NameBlockUsed = 0;
+    }
+    size_t name_block = index->NameBlockCount - 1;
+    memcpy(&index->NameBlocks[name_block][index->NameBlockUsed], name, name_length + 1);
+
+    FileIndexEntry *entry =
+        &index->EntryBlocks[block][index->EntryCount & (ENTRY_BLOCK_SIZE - 1)];
+    entry->Parent = parent;
+    entry->Name = (uint32_t)((name_block << NAME_BLOCK_SHIFT) | index->NameBlockUsed);
+    entry->Depth = (uint16_t)depth;
+    entry->Flags = is_directory ? FILE_INDEX_ENTRY_DIRECTORY : 0;
+    entry->NameLength = (uint8_t)name_length;
+    index->NameBlockUsed += name_length + 1;
+    index->EntryCount++;
+    return true;
+}
+
+static void ReleaseFileIndex(FileIndex *index) {
+    if (index->ReferenceCount.fetch_sub(1) != 1)
+        return;
+    for (int block = 0; block < MAX_ENTRY_BLOCKS; block++)
+        free(index->EntryBlocks[block]);
+    for (size_t block = 0; block < index->NameBlockCount; block++)
+        free(index->NameBlocks[block]);
+    for (int pattern = 0; pattern < index->IgnorePatternCount; pattern++)
+        free(index->IgnorePatterns[pattern]);
+    free(index->IgnorePatterns);
+    free(index->Root);
+    delete index;
+}
+
+static void NotifyFileIndexOwner(FileIndex *index) {
+    if (!index->Cancelled.load() && index->Notify != NULL)
+        index->Notify(index->NotifyData);
+}
+
+// Walks the tree breadth first, so that shallow entries, which are the likeliest to be wanted,
+// are available soonest.
+static void RunFileIndex(FileIndex *index) {
+    DirectoryListing listing;
+    memset(&listing, 0, sizeof(listing));
+    std::vector<uint32_t> directories;
+    directories.push_back(FILE_INDEX_NO_PARENT);
+    char relative_path[PATH_MAX];
+    char path[PATH_MAX];
+    size_t notified_entry_count = 0;
+    bool full = false;
+
+    for (size_t head = 0; head < directories.size() && !full; head++) {
+        if (index->Cancelled.load())
+            break;
+
+        uint32_t directory = directories[head];
+        int depth = directory == FILE_INDEX_NO_PARENT ? 1 : GetEntry(index, directory)->Depth + 1;
+        if (directory == FILE_INDEX_NO_PARENT) {
+            snprintf(path, sizeof(path), "%s", index->Root);
+        } else {
+            // Entries are only indexed if their paths fit, so this never skips one.
+            if (!GetFileIndexPath(index, directory, relative_path, sizeof(relative_path)) ||
+                snprintf(path, sizeof(path), "%s/%s", index->Root, relative_path) >=
+                (int)sizeof(path)) {
+                continue;
+            }
+        }
+        if (!ScanDirectory(&listing, path))
+            continue;
+
+        size_t path_length = strlen(path);
+        for (size_t entry = 0; entry < listing.EntryCount; entry++) {
+            const char *name = GetDirectoryListingName(&listing, entry);
+            if (name[0] == '.' || IsIgnored(index, name))
+                continue;
+            // An entry whose path couldn't be written out could never be picked or descended
+            // into, so it's left out rather than indexed under a path cut short.
+            if (path_length + 1 + strlen(name) >= sizeof(path))
+                continue;
+            bool is_directory = listing.Types[entry] == DirectoryEntryTypeDirectory;
+            if (!AddFileIndexEntry(index, directory, depth, name, is_directory)) {
+                full = true;
+                break;
+            }
+            if (!is_directory || depth >= index->MaxDepth)
+                continue;
+
+            // Don't follow symlinked directories, which could lead around in circles.
+            struct stat stats;
+            snprintf(&path[path_length], sizeof(path) - path_length, "/%s", name);
+            if (lstat(path, &stats) == 0 && !S_ISLNK(stats.st_mode))
+                directories.push_back((uint32_t)(index->EntryCount - 1));
+            path[path_length] = '\0';
+        }
+
+        index->PublishedEntryCount.store(index->EntryCount, std::memory_order_release);
+        if (index->EntryCount - notified_entry_count >= INDEX_NOTIFY_INTERVAL) {
+            notified_entry_count = index->EntryCount;
+            NotifyFileIndexOwner(index);
+        }
+    }
+
+    FreeDirectoryListing(&listing);
+    index->Finished.store(true);
+    NotifyFileIndexOwner(index);
+    ReleaseFileIndex(index);
+}
+
+FileIndex *StartFileIndex(const char *root,
+                          int max_depth,
+                          const char *const *ignore_patterns,
+                          int ignore_pattern_count,
+                          FileIndexNotifyFn notify,
+                          void *notify_data) {
+    FileIndex *index = new FileIndex();
+    memset(index->EntryBlocks, 0, sizeof(index->EntryBlocks));
+    memset(index->NameBlocks, 0, sizeof(index->NameBlocks));
+    index->Root = strdup(root);
+    index->MaxDepth = max_depth;
+    index->IgnorePatterns = (char **)malloc(sizeof(char *) * (ignore_pattern_count + 1));
+    for (int pattern = 0; pattern < ignore_pattern_count; pattern++)
+        index->IgnorePatterns[pattern] = strdup(ignore_patterns[pattern]);
+    index->IgnorePatternCount = ignore_pattern_count;
+    index->Notify = notify;
+    index->NotifyData = notify_data;
+    index->EntryCount = 0;
+    index->NameBlockCount = 0;
+    index->NameBlockUsed = 0;
+    index->PublishedEntryCount.store(0);
+    index->Finished.store(false);
+    index->Cancelled.store(false);
+    index->ReferenceCount.store(2);
+    std::thread(RunFileIndex, index).detach();
+    return index;
+}
+
+void StopFileIndex(FileIndex *index) {
+    index->Cancelled.store(true);
+    ReleaseFileIndex(index);
+}
+
+static inline char FoldCase(char c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static inline bool IsWordStart(const char *name, size_t position) {
+    if (position == 0)
+        return true;
+    char previous = name[position - 1], current = name[position];
+    if (previous == '_' || previous == '-' || previous == '.' || previous == ' ')
+        return true;
+    return previous >= 'a' && previous <= 'z' && current >= 'A' && current <= 'Z';
+}
+
+static double GetMonotonicSeconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+// Greedily matches more of `query` (already case-folded) against `text`, starting from
+// `matched` characters in. Greedy matching finds a subsequence whenever there is one.
+static size_t ExtendMatch(const char *query, size_t query_length, size_t matched, const char *text) {
+    for (; *text != '\0' && matched < query_length; text++) {
+        if (FoldCase(*text) == query[matched])
+            matched++;
+    }
+    return matched;
+}
+
+void InitFuzzyMatcher(FuzzyMatcher *matcher) {
+    memset(matcher, 0, sizeof(*matcher));
+    matcher->Ranked = (FuzzyRankedMatch *)malloc(sizeof(FuzzyRankedMatch) * FUZZY_MATCH_RANK_COUNT);
+    matcher->Results =
+        (FuzzyRankedMatch *)malloc(sizeof(FuzzyRankedMatch) * FUZZY_MATCH_RANK_COUNT);
+}
+
+void FreeFuzzyMatcher(FuzzyMatcher *matcher) {
+    for (size_t level = 0; level < matcher->LevelCapacity; level++)
+        free(matcher->Levels[level].Matches);
+    free(matcher->Levels);
+    free(matcher->DirectoryCounts);
+    free(matcher->DirectoryStamps);
+    free(matcher->Ranked);
+    free(matcher->Results);
+    memset(matcher, 0, sizeof(*matcher));
+}
+
+static void ResetFuzzyMatchRanking(FuzzyMatcher *matcher) {
+    matcher->RankedCount = 0;
+    matcher->RankCursor = 0;
+    matcher->ResultCount = 0;
+    matcher->ResultsDirty = false;
+}
+
+void SetFuzzyMatcherQuery(FuzzyMatcher *matcher, const char *query) {
+    char folded[sizeof(matcher->Query)];
+    size_t length = 0;
+    for (; query[length] != '\0' && length < sizeof(folded) - 1; length++)
+        folded[length] = FoldCase(query[length]);
+    folded[length] = '\0';
+    if (length == matcher->QueryLength && memcmp(folded, matcher->Query, length) == 0)
+        return;
+
+    size_t common_length = 0;
+    while (common_length < length && common_length < matcher->QueryLength &&
+           folded[common_length] == matcher->Query[common_length]) {
+        common_length++;
+    }
+
+    if (length > matcher->LevelCapacity) {
+        matcher->Levels = (FuzzyMatchLevel *)realloc(matcher->Levels,
+                                                     sizeof(FuzzyMatchLevel) * length);
+        memset(&matcher->Levels[matcher->LevelCapacity],
+               0,
+               sizeof(FuzzyMatchLevel) * (length - matcher->LevelCapacity));
+        matcher->LevelCapacity = length;
+    }
+    for (size_t level = common_length; level < length; level++) {
+        matcher->Levels[level].MatchCount = 0;
+        matcher->Levels[level].ScannedEntryCount = 0;
+        matcher->Levels[level].SourceCursor = 0;
+    }
+
+    memcpy(matcher->Query, folded, length + 1);
+    matcher->QueryLength = length;
+    // The memoized directory counts are against the whole query, so they're all stale now.
+    matcher->Generation++;
+    ResetFuzzyMatchRanking(matcher);
+}
+
+// Returns how many characters of the query a greedy match gets through over the path of
+// `directory` followed by a slash.
+static size_t GetDirectoryMatchCount(FuzzyMatcher *matcher,
+                                     const FileIndex *index,
+                                     uint32_t directory) {
+    if (directory == FILE_INDEX_NO_PARENT)
+        return 0;
+    if (directory >= matcher->DirectoryCapacity) {
+        size_t capacity = matcher->DirectoryCapacity == 0 ? ENTRY_BLOCK_SIZE :
+            matcher->DirectoryCapacity;
+        while (directory >= capacity)
+            capacity *= 2;
+        matcher->DirectoryCounts = (uint8_t *)realloc(matcher->DirectoryCounts, capacity);
+        matcher->DirectoryStamps = (uint32_t *)realloc(matcher->DirectoryStamps,
+                                                       sizeof(uint32_t) * capacity);
+        memset(&matcher->DirectoryStamps[matcher->DirectoryCapacity],
+               0,
+               sizeof(uint32_t) * (capacity - matcher->DirectoryCapacity));
+        matcher->DirectoryCapacity = capacity;
+    }
+    if (matcher->DirectoryStamps[directory] == matcher->Generation)
+        return matcher->DirectoryCounts[directory];
+
+    size_t matched = GetDirectoryMatchCount(matcher, index, GetFileIndexParent(index, directory));
+    matched = ExtendMatch(matcher->Query,
+                          matcher->QueryLength,
+                          matched,
+                          GetFileIndexName(index, directory));
+    matched = ExtendMatch(matcher->Query, matcher->QueryLength, matched, "/");
+    matcher->DirectoryCounts[directory] = (uint8_t)matched;
+    matcher->DirectoryStamps[directory] = matcher->Generation;
+    return matched;
+}
+
+// Returns true if the first `length` characters of the query are a subsequence of the path of
+// `entry`.
+static bool MatchesQueryPrefix(FuzzyMatcher *matcher,
+                               const FileIndex *index,
+                               uint32_t entry,
+                               size_t length) {
+    size_t matched = GetDirectoryMatchCount(matcher, index, GetFileIndexParent(index, entry));
+    if (matched >= length)
+        return true;
+    return ExtendMatch(matcher->Query, length, matched, GetFileIndexName(index, entry)) == length;
+}
+
+// Scores a match of the whole query. Matches that fit entirely within the name beat those that
+// need the directories, and within those, consecutive characters, characters at the start of
+// words and shallow, short names score higher.
+static int32_t ScoreFuzzyMatch(const FuzzyMatcher *matcher, const FileIndex *index, uint32_t entry) {
+    const char *name = GetFileIndexName(index, entry);
+    const FileIndexEntry *index_entry = GetEntry(index, entry);
+    int32_t score = 0;
+    size_t matched = 0;
+    size_t previous = SIZE_MAX;
+    for (size_t position = 0; name[position] != '\0' && matched < matcher->QueryLength; position++) {
+        if (FoldCase(name[position]) != matcher->Query[matched])
+            continue;
+        score += 16;
+        if (previous != SIZE_MAX && previous + 1 == position)
+            score += 24;
+        if (IsWordStart(name, position))
+            score += 16;
+        if (position == 0)
+            score += 32;
+        previous = position;
+        matched++;
+    }
+    if (matched == matcher->QueryLength)
+        score += 1024;
+    return score - (int32_t)index_entry->Depth * 8 - (int32_t)index_entry->NameLength;
+}
+
+static inline bool IsRankedBelow(const FuzzyRankedMatch &a, const FuzzyRankedMatch &b) {
+    return a.Score != b.Score ? a.Score < b.Score : a.Entry > b.Entry;
+}
+
+static void RankFuzzyMatch(FuzzyMatcher *matcher, const FileIndex *index, uint32_t entry) {
+    FuzzyRankedMatch match;
+    match.Score = ScoreFuzzyMatch(matcher, index, entry);
+    match.Entry = entry;
+
+    // `Ranked` is a min-heap, so the worst of the best is always at the top, ready to be evicted.
+    FuzzyRankedMatch *heap = matcher->Ranked;
+    size_t position;
+    if (matcher->RankedCount < FUZZY_MATCH_RANK_COUNT) {
+        position = matcher->RankedCount++;
+        while (position > 0 && IsRankedBelow(match, heap[(position - 1) / 2])) {
+            heap[position] = heap[(position - 1) / 2];
+            position = (position - 1) / 2;
+        }
+    } else {
+        if (!IsRankedBelow(heap[0], match))
+            return;
+        position = 0;
+        while (true) {
+            size_t child = position * 2 + 1;
+            if (child >= matcher->RankedCount)
+                break;
+            if (child + 1 < matcher->RankedCount && IsRankedBelow(heap[child + 1], heap[child]))
+                child++;
+            if (!IsRankedBelow(heap[child], match))
+                break;
+            heap[position] = heap[child];
+            position = child;
+        }
+    }
+    heap[position] = match;
+    matcher->ResultsDirty = true;
+}
+
+static void AddFuzzyMatch(FuzzyMatchLevel *level, uint32_t entry) {
+    if (level->MatchCount == level->MatchCapacity) {
+        level->MatchCapacity = level->MatchCapacity == 0 ? 1024 : level->MatchCapacity * 2;
+        level->Matches = (uint32_t *)realloc(level->Matches,
+                                             sizeof(uint32_t) * level->MatchCapacity);
+    }
+    level->Matches[level->MatchCount++] = entry;
+}
+
+bool UpdateFuzzyMatcher(FuzzyMatcher *matcher, const FileIndex *index, double budget_seconds) {
+    if (matcher->QueryLength == 0)
+        return false;
+
+    double deadline = GetMonotonicSeconds() + budget_seconds;
+    size_t entry_count = GetFileIndexEntryCount(index);
+    size_t work = 0;
+    bool out_of_time = false;
+
+    // Bring each level up to date in turn, since each one refines the one below it.
+    for (size_t level_index = 0; level_index < matcher->QueryLength && !out_of_time; level_index++) {
+        FuzzyMatchLevel *level = &matcher->Levels[level_index];
+        size_t length = level_index + 1;
+        if (level_index == 0) {
+            while (level->ScannedEntryCount < entry_count) {
+                uint32_t entry = (uint32_t)level->ScannedEntryCount++;
+                if (MatchesQueryPrefix(matcher, index, entry, length))
+                    AddFuzzyMatch(level, entry);
+                if (++work % MATCH_BUDGET_CHECK_INTERVAL == 0 &&
+                    GetMonotonicSeconds() > deadline) {
+                    out_of_time = true;
+                    break;
+                }
+            }
+            continue;
+        }
+
+        const FuzzyMatchLevel *source = &matcher->Levels[level_index - 1];
+        while (level->SourceCursor < source->MatchCount) {
+            uint32_t entry = source->Matches[level->SourceCursor++];
+            if (MatchesQueryPrefix(matcher, index, entry, length))
+                AddFuzzyMatch(level, entry);
+            if (++work % MATCH_BUDGET_CHECK_INTERVAL == 0 && GetMonotonicSeconds() > deadline) {
+                out_of_time = true;
+                break;
+            }
+        }
+        if (level->SourceCursor == source->MatchCount)
+            level->ScannedEntryCount = source->ScannedEntryCount;
+    }
+
+    FuzzyMatchLevel *top = &matcher->Levels[matcher->QueryLength - 1];
+    while (!out_of_time && matcher->RankCursor < top->MatchCount) {
+        RankFuzzyMatch(matcher, index, top->Matches[matcher->RankCursor++]);
+        if (++work % MATCH_BUDGET_CHECK_INTERVAL == 0 && GetMonotonicSeconds() > deadline)
+            out_of_time = true;
+    }
+
+    if (matcher->ResultsDirty) {
+        memcpy(matcher->Results, matcher->Ranked, sizeof(FuzzyRankedMatch) * matcher->RankedCount);
+        matcher->ResultCount = matcher->RankedCount;
+        std::sort(matcher->Results,
+                  matcher->Results + matcher->ResultCount,
+                  [](const FuzzyRankedMatch &a, const FuzzyRankedMatch &b) {
+                      return IsRankedBelow(b, a);
+                  });
+        matcher->ResultsDirty = false;
+    }
+
+    return top->ScannedEntryCount < entry_count || matcher->RankCursor < top->MatchCount;
+}
+
+size_t GetFuzzyMatchCount(const FuzzyMatcher *matcher) {
+    if (matcher->QueryLength == 0)
+        return 0;
+    return matcher->Levels[matcher->QueryLength - 1].MatchCount;
+}
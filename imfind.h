@@ -0,0 +1,111 @@
+// imfind.h
+
+#ifndef IMFIND_H
+#define IMFIND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Parent of the entries directly inside an index's root.
+#define FILE_INDEX_NO_PARENT    UINT32_MAX
+
+// A recursive listing of a directory tree, built on a background thread. Each entry stores only
+// its own name and the index of its parent directory, so paths share their common prefixes.
+// Parents always come before their children.
+struct FileIndex;
+
+typedef void (*FileIndexNotifyFn)(void *data);
+
+// Starts indexing the tree under `root` on a background thread, descending at most `max_depth`
+// levels and skipping dotfiles, symlinked directories and any entry whose name matches one of the
+// `fnmatch` patterns in `ignore_patterns`. `notify` is called from the indexing thread whenever
+// a batch of entries has been published and when indexing finishes.
+FileIndex *StartFileIndex(const char *root,
+                          int max_depth,
+                          const char *const *ignore_patterns,
+                          int ignore_pattern_count,
+                          FileIndexNotifyFn notify,
+                          void *notify_data);
+
+// Gives up the owner's reference to `index`, stopping the indexing thread if it's still running.
+void StopFileIndex(FileIndex *index);
+
+const char *GetFileIndexRoot(const FileIndex *index);
+
+// The number of entries that may be read so far. Only ever grows.
+size_t GetFileIndexEntryCount(const FileIndex *index);
+bool IsFileIndexFinished(const FileIndex *index);
+
+const char *GetFileIndexName(const FileIndex *index, uint32_t entry);
+uint32_t GetFileIndexParent(const FileIndex *index, uint32_t entry);
+bool IsFileIndexDirectory(const FileIndex *index, uint32_t entry);
+
+// Writes the path of `entry` relative to the index's root into `buffer`. Returns false, leaving
+// `buffer` empty, if the path doesn't fit. Nothing is indexed whose full path, root included,
+// wouldn't fit in `PATH_MAX`.
+bool GetFileIndexPath(const FileIndex *index, uint32_t entry, char *buffer, size_t buffer_size);
+
+// One query's worth of matches: the entries whose relative path contains the first `Length`
+// characters of the query as a case-insensitive subsequence, in index order.
+struct FuzzyMatchLevel {
+    uint32_t *Matches;
+    size_t MatchCount;
+    size_t MatchCapacity;
+    // Entries below this index have all been considered.
+    size_t ScannedEntryCount;
+    // How far into the previous level's matches this level has refined.
+    size_t SourceCursor;
+};
+
+#define FUZZY_MATCH_QUERY_SIZE  256
+
+struct FuzzyRankedMatch {
+    int32_t Score;
+    uint32_t Entry;
+};
+
+// Ranks the entries of a `FileIndex` against a query as it's typed. Each character of the query
+// gets a level of matches that is refined from the level below, so typing a character only looks
+// at what the previous characters matched, and deleting one just drops back to the level below.
+// Entries that the index publishes later are matched as they arrive. All work is done in
+// `UpdateFuzzyMatcher` within a time budget, so huge indices never stall a frame.
+struct FuzzyMatcher {
+    char Query[FUZZY_MATCH_QUERY_SIZE];
+    size_t QueryLength;
+    FuzzyMatchLevel *Levels;
+    size_t LevelCapacity;
+
+    // Memoized greedy match counts of the whole query against each directory's path, valid
+    // where `DirectoryStamps` equals `Generation`.
+    uint8_t *DirectoryCounts;
+    uint32_t *DirectoryStamps;
+    size_t DirectoryCapacity;
+    uint32_t Generation;
+
+    // The best `FUZZY_MATCH_RANK_COUNT` matches of the top level ranked so far, kept as a min-heap
+    // on score; `RankCursor` is how many of the top level's matches have been ranked.
+    FuzzyRankedMatch *Ranked;
+    size_t RankedCount;
+    size_t RankCursor;
+
+    // `Ranked` sorted best first, rebuilt when it changes.
+    FuzzyRankedMatch *Results;
+    size_t ResultCount;
+    bool ResultsDirty;
+};
+
+#define FUZZY_MATCH_RANK_COUNT  256
+
+void InitFuzzyMatcher(FuzzyMatcher *matcher);
+void FreeFuzzyMatcher(FuzzyMatcher *matcher);
+
+// Sets the query, keeping whatever levels the old and new queries have in common.
+void SetFuzzyMatcherQuery(FuzzyMatcher *matcher, const char *query);
+
+// Matches and ranks for up to `budget_seconds`. Returns true if there is work left to do.
+bool UpdateFuzzyMatcher(FuzzyMatcher *matcher, const FileIndex *index, double budget_seconds);
+
+// The number of entries the current query matches so far.
+size_t GetFuzzyMatchCount(const FuzzyMatcher *matcher);
+
+#endif
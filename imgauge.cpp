@@ -0,0 +1,248 @@
+// imgauge.cpp
+
+#include "imgauge.h"
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <mutex>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+
+// Size of the buffer a stream reads into. A line longer than this is dropped.
+#define GAUGE_READ_SIZE (64 * 1024)
+
+// How long the reading thread waits after draining its input before reading again, so that a
+// producer writing many small updates has them picked up in batches rather than with a read
+// each.
+#define GAUGE_READ_INTERVAL_US  1000
+
+#define GAUGE_TEXT_MARKER   "XXX"
+
+struct GaugeParser {
+    // Whether the lines are between a pair of `XXX` lines.
+    bool InText;
+    bool AtTextStart;
+    char Text[GAUGE_TEXT_SIZE];
+    size_t TextLength;
+    // Whether the rest of an overlong line is being skipped.
+    bool SkippingLine;
+
+    // The state parsed since it was last published; -1 if the percentage hasn't changed.
+    int Percent;
+    bool HasText;
+    char LatestText[GAUGE_TEXT_SIZE];
+};
+
+struct GaugeStream {
+    int FD;
+    // As in a menu item stream, the flags `FD` came with, put back before it's closed, and a pipe
+    // whose write end is closed to wake the reading thread from waiting on `FD`.
+    int FDFlags;
+    int WakeFDs[2];
+    GaugeParser Parser;
+    GaugeStreamNotifyFn Notify;
+    void *NotifyData;
+
+    std::mutex Mutex;
+    // The latest state; `Percent` is -1 and `HasText` false until an update sets them.
+    int Percent;
+    bool HasText;
+    char Text[GAUGE_TEXT_SIZE];
+    bool Finished;
+
+    std::atomic<bool> Cancelled;
+    // One reference for the owner and one for the reading thread.
+    std::atomic<int> ReferenceCount;
+};
+
+// Returns true and sets `percent`, clamped to 0-100, if the line is a number.
+static bool ParseGaugePercent(const char *line, size_t length, int *percent) {
+    size_t start = 0;
+    while (start < length && (line[start] == ' ' || line[start] == '\t'))
+        start++;
+    while (length > start && (line[length - 1] == ' ' || line[length - 1] == '\t'))
+        length--;
+    if (start == length || length - start > 9)
+        return false;
+
+    int value = 0;
+    for (size_t index = start; index < length; index++) {
+        if (line[index] < '0' || line[index] > '9')
+            return false;
+        value = value * 10 + (line[index] - '0');
+    }
+    *percent = value > 100 ? 100 : value;
+    return true;
+}
+
+static void AppendGaugeText(GaugeParser *parser, const char *line, size_t length) {
+    if (parser->TextLength > 0 && parser->TextLength < GAUGE_TEXT_SIZE - 1)
+        parser->Text[parser->TextLength++] = '\n';
+    size_t space = GAUGE_TEXT_SIZE - 1 - parser->TextLength;
+    if (length > space)
+        length = space;
+    memcpy(&parser->Text[parser->TextLength], line, length);
+    parser->TextLength += length;
+}
+
+static void ParseGaugeLine(GaugeParser *parser, const char *line, size_t length) {
+    if (length > 0 && line[length - 1] == '\r')
+        length--;
+
+    if (length == strlen(GAUGE_TEXT_MARKER) &&
+        memcmp(line, GAUGE_TEXT_MARKER, length) == 0) {
+        if (parser->InText) {
+            memcpy(parser->LatestText, parser->Text, parser->TextLength);
+            parser->LatestText[parser->TextLength] = '\0';
+            parser->HasText = true;
+        }
+        parser->InText = !parser->InText;
+        parser->AtTextStart = true;
+        parser->TextLength = 0;
+        return;
+    }
+
+    if (!parser->InText) {
+        ParseGaugePercent(line, length, &parser->Percent);
+        return;
+    }
+    bool at_text_start = parser->AtTextStart;
+    parser->AtTextStart = false;
+    if (at_text_start && ParseGaugePercent(line, length, &parser->Percent))
+        return;
+    AppendGaugeText(parser, line, length);
+}
+
+// Parses the complete lines in `buffer`, or all of it at the end of the input, and returns how
+// many bytes were used up.
+static size_t ParseGaugeLines(GaugeParser *parser, const char *buffer, size_t size, bool at_end) {
+    size_t parsed = 0;
+    while (parsed < size) {
+        const char *newline = (const char *)memchr(&buffer[parsed], '\n', size - parsed);
+        if (newline == NULL)
+            break;
+        size_t length = newline - &buffer[parsed];
+        if (parser->SkippingLine)
+            parser->SkippingLine = false;
+        else
+            ParseGaugeLine(parser, &buffer[parsed], length);
+        parsed += length + 1;
+    }
+
+    if (parsed < size && at_end) {
+        if (!parser->SkippingLine)
+            ParseGaugeLine(parser, &buffer[parsed], size - parsed);
+        parsed = size;
+    } else if (parsed == 0 && size == GAUGE_READ_SIZE) {
+        parser->SkippingLine = true;
+        parsed = size;
+    }
+    return parsed;
+}
+
+static void ReleaseGaugeStream(GaugeStream *stream) {
+    if (stream->ReferenceCount.fetch_sub(1) != 1)
+        return;
+    delete stream;
+}
+
+static void RunGaugeStream(GaugeStream *stream) {
+    GaugeParser *parser = &stream->Parser;
+    char *buffer = (char *)malloc(GAUGE_READ_SIZE);
+    size_t used = 0;
+
+    while (!stream->Cancelled.load()) {
+        size_t space = GAUGE_READ_SIZE - used;
+        ssize_t read_size = read(stream->FD, &buffer[used], space);
+        if (read_size < 0 && errno == EINTR)
+            continue;
+        if (read_size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd poll_fds[2] = {
+                { stream->FD, POLLIN, 0 }, { stream->WakeFDs[0], POLLIN, 0 }
+            };
+            poll(poll_fds, 2, -1);
+            continue;
+        }
+        bool at_end = read_size <= 0;
+        bool drained = (size_t)read_size < space;
+        if (!at_end)
+            used += read_size;
+
+        // However many updates this read brought, only the last of them gets published.
+        parser->Percent = -1;
+        parser->HasText = false;
+        size_t parsed = ParseGaugeLines(parser, buffer, used, at_end);
+        memmove(buffer, &buffer[parsed], used - parsed);
+        used -= parsed;
+
+        if (parser->Percent >= 0 || parser->HasText || at_end) {
+            {
+                std::lock_guard<std::mutex> lock(stream->Mutex);
+                if (parser->Percent >= 0)
+                    stream->Percent = parser->Percent;
+                if (parser->HasText) {
+                    memcpy(stream->Text, parser->LatestText, strlen(parser->LatestText) + 1);
+                    stream->HasText = true;
+                }
+                stream->Finished = at_end;
+            }
+            if (!stream->Cancelled.load())
+                stream->Notify(stream->NotifyData);
+        }
+        if (at_end)
+            break;
+        if (drained)
+            usleep(GAUGE_READ_INTERVAL_US);
+    }
+
+    free(buffer);
+    fcntl(stream->FD, F_SETFL, stream->FDFlags);
+    close(stream->FD);
+    if (stream->WakeFDs[0] >= 0)
+        close(stream->WakeFDs[0]);
+    ReleaseGaugeStream(stream);
+}
+
+GaugeStream *StartGaugeStream(int fd, GaugeStreamNotifyFn notify, void *notify_data) {
+    GaugeStream *stream = new GaugeStream();
+    stream->FD = fd;
+    stream->FDFlags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, stream->FDFlags | O_NONBLOCK);
+    if (pipe(stream->WakeFDs) == 0) {
+        fcntl(stream->WakeFDs[0], F_SETFD, FD_CLOEXEC);
+        fcntl(stream->WakeFDs[1], F_SETFD, FD_CLOEXEC);
+    } else {
+        stream->WakeFDs[0] = -1;
+        stream->WakeFDs[1] = -1;
+    }
+    memset(&stream->Parser, 0, sizeof(stream->Parser));
+    stream->Notify = notify;
+    stream->NotifyData = notify_data;
+    stream->Percent = -1;
+    stream->HasText = false;
+    stream->Text[0] = '\0';
+    stream->Finished = false;
+    stream->Cancelled.store(false);
+    stream->ReferenceCount.store(2);
+    std::thread(RunGaugeStream, stream).detach();
+    return stream;
+}
+
+bool TakeGaugeStreamState(GaugeStream *stream, int *percent, char *text) {
+    std::lock_guard<std::mutex> lock(stream->Mutex);
+    if (stream->Percent >= 0)
+        *percent = stream->Percent;
+    if (stream->HasText)
+        memcpy(text, stream->Text, strlen(stream->Text) + 1);
+    return !stream->Finished;
+}
+
+void StopGaugeStream(GaugeStream *stream) {
+    stream->Cancelled.store(true);
+    if (stream->WakeFDs[1] >= 0)
+        close(stream->WakeFDs[1]);
+    ReleaseGaugeStream(stream);
+}
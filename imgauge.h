@@ -0,0 +1,34 @@
+// imgauge.h
+
+#ifndef IMGAUGE_H
+#define IMGAUGE_H
+
+#include <stddef.h>
+
+// The longest gauge text kept; longer text is cut off.
+#define GAUGE_TEXT_SIZE 4096
+
+// Progress updates arriving on a file descriptor, such as a pipe on stdin, in the format of
+// dialog's `--gauge`: each line holding a number sets the percentage, and lines between a pair of
+// `XXX` lines replace the text, the first of them setting the percentage if it's a number. The
+// input is read and parsed on a background thread that keeps only the latest state, so however
+// fast updates arrive, the owner just picks up the newest whenever it gets around to it.
+struct GaugeStream;
+
+typedef void (*GaugeStreamNotifyFn)(void *data);
+
+// Starts reading updates from `fd`, which the stream takes over and closes once it's done reading
+// or has been stopped.
+// `notify` is called from the reading thread whenever the state has changed and when the stream
+// ends.
+GaugeStream *StartGaugeStream(int fd, GaugeStreamNotifyFn notify, void *notify_data);
+
+// Copies out the latest percentage and text, leaving each alone if no update has set it yet.
+// `text` must hold `GAUGE_TEXT_SIZE` bytes. Returns true if more updates may follow.
+bool TakeGaugeStreamState(GaugeStream *stream, int *percent, char *text);
+
+// Stops reading, waking the reading thread if it's waiting for input, and frees the stream once
+// the thread is done with it.
+void StopGaugeStream(GaugeStream *stream);
+
+#endif
@@ -9,6 +9,24 @@
 #include <GL/glew.h>
 #endif
 
+// The calling convention of GL entry points, for functions looked up at runtime.
+#ifdef _WIN32
+#define IMGL_APIENTRY   __stdcall
+#else
+#define IMGL_APIENTRY
+#endif
+
+// From `GL_ARB_get_program_binary` and `GL_OES_get_program_binary`, which share their values.
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT  0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH            0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS       0x87FE
+#endif
+
 #if 1
 #define GL(func) \
     do { \
@@ -0,0 +1,78 @@
+// imglyphs.cpp
+
+#include "imglyphs.h"
+#include <stdlib.h>
+
+#define FIRST_PRINTABLE_ASCII   0x20
+#define LAST_PRINTABLE_ASCII    0x7e
+
+void InitGlyphSet(GlyphSet *set) {
+    InitBitset(&set->Codepoints, GLYPH_CODEPOINT_COUNT);
+    SetBitRange(&set->Codepoints, FIRST_PRINTABLE_ASCII, LAST_PRINTABLE_ASCII + 1, true);
+    set->Changed = true;
+}
+
+void FreeGlyphSet(GlyphSet *set) {
+    FreeBitset(&set->Codepoints);
+}
+
+void AddGlyphs(GlyphSet *set, const char *text, const char *text_end) {
+    const unsigned char *ptr = (const unsigned char *)text;
+    const unsigned char *end = (const unsigned char *)text_end;
+    while (end != NULL ? ptr < end : *ptr != '\0') {
+        // ASCII is always in the set, and most text is nothing but.
+        if (*ptr < 0x80) {
+            ptr++;
+            continue;
+        }
+
+        uint32_t codepoint;
+        int length;
+        if ((*ptr & 0xe0) == 0xc0) {
+            codepoint = *ptr & 0x1f;
+            length = 2;
+        } else if ((*ptr & 0xf0) == 0xe0) {
+            codepoint = *ptr & 0x0f;
+            length = 3;
+        } else {
+            // Past the BMP, or not UTF-8 at all.
+            ptr++;
+            continue;
+        }
+        int index = 1;
+        for (; index < length; index++) {
+            if ((end != NULL && ptr + index >= end) || (ptr[index] & 0xc0) != 0x80)
+                break;
+            codepoint = (codepoint << 6) | (ptr[index] & 0x3f);
+        }
+        ptr += index;
+        // Overlong encodings of ASCII, NUL among them, are left out.
+        if (index < length || codepoint < 0x80)
+            continue;
+
+        if (!TestBit(&set->Codepoints, codepoint)) {
+            SetBit(&set->Codepoints, codepoint);
+            set->Changed = true;
+        }
+    }
+}
+
+unsigned short *GetGlyphRanges(const GlyphSet *set) {
+    size_t capacity = 16, count = 0;
+    unsigned short *ranges = (unsigned short *)malloc(sizeof(unsigned short) * capacity);
+    size_t first = FindNextSetBit(&set->Codepoints, 0);
+    while (first < GLYPH_CODEPOINT_COUNT) {
+        size_t last = first;
+        while (last + 1 < GLYPH_CODEPOINT_COUNT && TestBit(&set->Codepoints, last + 1))
+            last++;
+        if (count + 3 > capacity) {
+            capacity *= 2;
+            ranges = (unsigned short *)realloc(ranges, sizeof(unsigned short) * capacity);
+        }
+        ranges[count++] = (unsigned short)first;
+        ranges[count++] = (unsigned short)last;
+        first = FindNextSetBit(&set->Codepoints, last + 1);
+    }
+    ranges[count] = 0;
+    return ranges;
+}
@@ -0,0 +1,30 @@
+// imglyphs.h
+
+#ifndef IMGLYPHS_H
+#define IMGLYPHS_H
+
+#include "imbitset.h"
+
+// ImGui characters are 16 bits wide, so only the Basic Multilingual Plane can be drawn.
+#define GLYPH_CODEPOINT_COUNT   0x10000
+
+// The characters to bake into the font atlas. It starts out with just printable ASCII, and text is
+// run through `AddGlyphs` before it's drawn, so that the atlas only ever holds the characters that
+// have actually been shown and can be rebaked when new ones turn up.
+struct GlyphSet {
+    Bitset Codepoints;
+    // Whether characters have been added since the set was last baked.
+    bool Changed;
+};
+
+void InitGlyphSet(GlyphSet *set);
+void FreeGlyphSet(GlyphSet *set);
+
+// Adds the characters of the UTF-8 `text`, which ends at `text_end` or, if that's NULL, at a NUL.
+void AddGlyphs(GlyphSet *set, const char *text, const char *text_end);
+
+// Returns the set as ImGui glyph ranges: inclusive pairs of codepoints ending with a 0. Free the
+// result with `free`.
+unsigned short *GetGlyphRanges(const GlyphSet *set);
+
+#endif
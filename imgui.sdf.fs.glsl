@@ -0,0 +1,24 @@
+// imgui.sdf.fs.glsl
+//
+// Like `imgui.fs.glsl`, but for the font atlas: an alpha-only texture holding signed distance
+// fields, with glyph edges at 0.5, so that text comes out sharp at whatever scale it's drawn.
+// Everything else in the atlas is fully opaque or fully transparent, which comes out the same as
+// before. The color is all the vertex's.
+
+#ifdef GL_ES
+#extension GL_OES_standard_derivatives : enable
+precision mediump float;
+#endif
+
+uniform sampler2D uTexture;
+
+varying vec2 vTextureUV;
+varying vec4 vColor;
+
+void main(void) {
+    vec4 texel = texture2D(uTexture, vTextureUV);
+    // Antialias over about a pixel on screen, however far apart texels are.
+    float smoothing = max(0.5 * fwidth(texel.a), 0.001);
+    float alpha = smoothstep(0.5 - smoothing, 0.5 + smoothing, texel.a);
+    gl_FragColor = vec4(vColor.rgb, vColor.a * alpha);
+}
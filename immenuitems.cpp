@@ -0,0 +1,344 @@
+// immenuitems.cpp
+
+#include "immenuitems.h"
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <mutex>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Size of the buffers a stream reads into. A record longer than this gets a buffer of its own.
+#define STREAM_CHUNK_SIZE   (1024 * 1024)
+
+struct MenuItemParser {
+    char Delimiter;
+    // In NUL-delimited input, a tag whose text hasn't arrived yet.
+    const char *PendingTag;
+    size_t PendingTagLength;
+    bool HasPendingTag;
+};
+
+void AddMenuItem(MenuItem **items,
+                 size_t *item_count,
+                 size_t *item_capacity,
+                 const char *tag,
+                 size_t tag_length,
+                 const char *item,
+                 size_t item_length) {
+    if (*item_count == *item_capacity) {
+        *item_capacity = *item_capacity == 0 ? 1024 : *item_capacity * 2;
+        *items = (MenuItem *)realloc(*items, sizeof(MenuItem) * *item_capacity);
+    }
+    MenuItem *menu_item = &(*items)[(*item_count)++];
+    menu_item->Tag = tag;
+    menu_item->Item = item;
+    menu_item->TagLength = (uint32_t)tag_length;
+    menu_item->ItemLength = (uint32_t)item_length;
+}
+
+static void ParseMenuRecord(MenuItemParser *parser,
+                            const char *record,
+                            size_t length,
+                            MenuItem **items,
+                            size_t *item_count,
+                            size_t *item_capacity) {
+    if (parser->Delimiter == '\0') {
+        if (!parser->HasPendingTag) {
+            parser->PendingTag = record;
+            parser->PendingTagLength = length;
+            parser->HasPendingTag = true;
+            return;
+        }
+        AddMenuItem(items,
+                    item_count,
+                    item_capacity,
+                    parser->PendingTag,
+                    parser->PendingTagLength,
+                    record,
+                    length);
+        parser->HasPendingTag = false;
+        return;
+    }
+
+    if (length > 0 && record[length - 1] == '\r')
+        length--;
+    if (length == 0)
+        return;
+    const char *tab = (const char *)memchr(record, '\t', length);
+    if (tab == NULL) {
+        AddMenuItem(items, item_count, item_capacity, record, length, record + length, 0);
+        return;
+    }
+    AddMenuItem(items,
+                item_count,
+                item_capacity,
+                record,
+                tab - record,
+                tab + 1,
+                length - (tab + 1 - record));
+}
+
+// Splits the complete records in `data` into items and returns how many bytes they took up.
+// Anything after that is the start of an incomplete record, unless `at_end` is set, in which case
+// it's taken as the last record.
+static size_t ParseMenuItems(MenuItemParser *parser,
+                             const char *data,
+                             size_t size,
+                             bool at_end,
+                             MenuItem **items,
+                             size_t *item_count,
+                             size_t *item_capacity) {
+    const char *start = data, *end = data + size;
+    while (start < end) {
+        const char *delimiter = (const char *)memchr(start, parser->Delimiter, end - start);
+        if (delimiter == NULL)
+            break;
+        ParseMenuRecord(parser, start, delimiter - start, items, item_count, item_capacity);
+        start = delimiter + 1;
+    }
+    if (!at_end)
+        return start - data;
+
+    if (start < end)
+        ParseMenuRecord(parser, start, end - start, items, item_count, item_capacity);
+    if (parser->HasPendingTag) {
+        AddMenuItem(items,
+                    item_count,
+                    item_capacity,
+                    parser->PendingTag,
+                    parser->PendingTagLength,
+                    parser->PendingTag + parser->PendingTagLength,
+                    0);
+        parser->HasPendingTag = false;
+    }
+    return size;
+}
+
+bool ReadMenuItems(const char *path,
+                   char delimiter,
+                   MenuItem **items,
+                   size_t *item_count,
+                   size_t *item_capacity,
+                   MenuItemFile *file) {
+    file->Data = NULL;
+    file->Size = 0;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat stats;
+    if (fstat(fd, &stats) != 0) {
+        close(fd);
+        return false;
+    }
+    if (stats.st_size == 0) {
+        close(fd);
+        return true;
+    }
+
+    // If the file shrinks while it's being read, the items stop where it now ends.
+    char *data = (char *)malloc(stats.st_size);
+    size_t size = 0;
+    ssize_t read_size = 0;
+    while (size < (size_t)stats.st_size) {
+        read_size = read(fd, &data[size], stats.st_size - size);
+        if (read_size < 0 && errno == EINTR)
+            continue;
+        if (read_size <= 0)
+            break;
+        size += read_size;
+    }
+    close(fd);
+    if (read_size < 0) {
+        free(data);
+        return false;
+    }
+    file->Data = data;
+    file->Size = size;
+
+    MenuItemParser parser;
+    memset(&parser, 0, sizeof(parser));
+    parser.Delimiter = delimiter;
+    ParseMenuItems(&parser, data, size, true, items, item_count, item_capacity);
+    return true;
+}
+
+void FreeMenuItemFile(MenuItemFile *file) {
+    free(file->Data);
+    file->Data = NULL;
+    file->Size = 0;
+}
+
+struct MenuItemStream {
+    int FD;
+    // The flags `FD` came with, put back before it's closed, since `O_NONBLOCK` is shared with
+    // whatever else has the file open, such as the client of a `--server`.
+    int FDFlags;
+    // Closing the write end wakes the reading thread from waiting on `FD`, once it's cancelled.
+    int WakeFDs[2];
+    MenuItemParser Parser;
+    MenuItemStreamNotifyFn Notify;
+    void *NotifyData;
+
+    // The buffers the items point into. Only the reading thread touches this until it's done.
+    std::vector<char *> Chunks;
+
+    std::mutex Mutex;
+    // Items parsed but not yet taken by the owner.
+    MenuItem *Items;
+    size_t ItemCount;
+    size_t ItemCapacity;
+    bool Finished;
+
+    std::atomic<bool> Cancelled;
+    // One reference for the owner and one for the reading thread.
+    std::atomic<int> ReferenceCount;
+};
+
+static void ReleaseMenuItemStream(MenuItemStream *stream) {
+    if (stream->ReferenceCount.fetch_sub(1) != 1)
+        return;
+    for (size_t chunk = 0; chunk < stream->Chunks.size(); chunk++)
+        free(stream->Chunks[chunk]);
+    free(stream->Items);
+    delete stream;
+}
+
+static void RunMenuItemStream(MenuItemStream *stream) {
+    size_t chunk_size = STREAM_CHUNK_SIZE;
+    char *chunk = (char *)malloc(chunk_size);
+    stream->Chunks.push_back(chunk);
+    size_t used = 0, parsed = 0;
+    MenuItem *items = NULL;
+    size_t item_count = 0, item_capacity = 0;
+
+    while (!stream->Cancelled.load()) {
+        if (used == chunk_size) {
+            // Carry the incomplete record at the end over into a new chunk. Items already point
+            // into the old one, so it has to stay, unless nothing was parsed out of it at all.
+            size_t partial_size = used - parsed;
+            chunk_size = std::max((size_t)STREAM_CHUNK_SIZE, partial_size * 2);
+            char *new_chunk = (char *)malloc(chunk_size);
+            memcpy(new_chunk, &chunk[parsed], partial_size);
+            if (parsed == 0) {
+                free(chunk);
+                stream->Chunks.pop_back();
+            }
+            chunk = new_chunk;
+            stream->Chunks.push_back(chunk);
+            used = partial_size;
+            parsed = 0;
+        }
+
+        ssize_t read_size = read(stream->FD, &chunk[used], chunk_size - used);
+        if (read_size < 0 && errno == EINTR)
+            continue;
+        if (read_size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd poll_fds[2] = {
+                { stream->FD, POLLIN, 0 }, { stream->WakeFDs[0], POLLIN, 0 }
+            };
+            poll(poll_fds, 2, -1);
+            continue;
+        }
+        bool at_end = read_size <= 0;
+        if (!at_end)
+            used += read_size;
+
+        item_count = 0;
+        parsed += ParseMenuItems(&stream->Parser,
+                                 &chunk[parsed],
+                                 used - parsed,
+                                 at_end,
+                                 &items,
+                                 &item_count,
+                                 &item_capacity);
+        if (item_count > 0 || at_end) {
+            {
+                std::lock_guard<std::mutex> lock(stream->Mutex);
+                for (size_t index = 0; index < item_count; index++) {
+                    AddMenuItem(&stream->Items,
+                                &stream->ItemCount,
+                                &stream->ItemCapacity,
+                                items[index].Tag,
+                                items[index].TagLength,
+                                items[index].Item,
+                                items[index].ItemLength);
+                }
+                stream->Finished = at_end;
+            }
+            if (!stream->Cancelled.load())
+                stream->Notify(stream->NotifyData);
+        }
+        if (at_end)
+            break;
+    }
+
+    free(items);
+    fcntl(stream->FD, F_SETFL, stream->FDFlags);
+    close(stream->FD);
+    if (stream->WakeFDs[0] >= 0)
+        close(stream->WakeFDs[0]);
+    ReleaseMenuItemStream(stream);
+}
+
+MenuItemStream *StartMenuItemStream(int fd,
+                                    char delimiter,
+                                    MenuItemStreamNotifyFn notify,
+                                    void *notify_data) {
+    MenuItemStream *stream = new MenuItemStream();
+    stream->FD = fd;
+    stream->FDFlags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, stream->FDFlags | O_NONBLOCK);
+    if (pipe(stream->WakeFDs) == 0) {
+        fcntl(stream->WakeFDs[0], F_SETFD, FD_CLOEXEC);
+        fcntl(stream->WakeFDs[1], F_SETFD, FD_CLOEXEC);
+    } else {
+        stream->WakeFDs[0] = -1;
+        stream->WakeFDs[1] = -1;
+    }
+    memset(&stream->Parser, 0, sizeof(stream->Parser));
+    stream->Parser.Delimiter = delimiter;
+    stream->Notify = notify;
+    stream->NotifyData = notify_data;
+    stream->Items = NULL;
+    stream->ItemCount = 0;
+    stream->ItemCapacity = 0;
+    stream->Finished = false;
+    stream->Cancelled.store(false);
+    stream->ReferenceCount.store(2);
+    std::thread(RunMenuItemStream, stream).detach();
+    return stream;
+}
+
+bool TakeMenuItemStreamItems(MenuItemStream *stream,
+                             MenuItem **items,
+                             size_t *item_count,
+                             size_t *item_capacity) {
+    std::lock_guard<std::mutex> lock(stream->Mutex);
+    for (size_t index = 0; index < stream->ItemCount; index++) {
+        const MenuItem *item = &stream->Items[index];
+        AddMenuItem(items,
+                    item_count,
+                    item_capacity,
+                    item->Tag,
+                    item->TagLength,
+                    item->Item,
+                    item->ItemLength);
+    }
+    stream->ItemCount = 0;
+    return !stream->Finished;
+}
+
+void StopMenuItemStream(MenuItemStream *stream) {
+    stream->Cancelled.store(true);
+    if (stream->WakeFDs[1] >= 0)
+        close(stream->WakeFDs[1]);
+    ReleaseMenuItemStream(stream);
+}
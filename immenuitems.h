@@ -0,0 +1,73 @@
+// immenuitems.h
+
+#ifndef IMMENUITEMS_H
+#define IMMENUITEMS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A menu entry. The strings aren't necessarily NUL-terminated, since they may point straight
+// into a mapped file or a stream's buffers.
+struct MenuItem {
+    const char *Tag;
+    const char *Item;
+    uint32_t TagLength;
+    uint32_t ItemLength;
+};
+
+// Appends an item to a growable array of items.
+void AddMenuItem(MenuItem **items,
+                 size_t *item_count,
+                 size_t *item_capacity,
+                 const char *tag,
+                 size_t tag_length,
+                 const char *item,
+                 size_t item_length);
+
+// A file read by `ReadMenuItems`.
+struct MenuItemFile {
+    char *Data;
+    size_t Size;
+};
+
+// Reads items from the file at `path` into memory, so the items point into `file`, which stays
+// until `FreeMenuItemFile`. The file is copied rather than mapped, since the items are used for as
+// long as the dialog is shown, and a mapping would fault if the file were truncated meanwhile.
+// With a `delimiter` of '\n', each line is an item whose tag and text are separated by the first
+// tab; with '\0', tags and texts alternate, each NUL-terminated. Returns false if the file couldn't
+// be read.
+bool ReadMenuItems(const char *path,
+                   char delimiter,
+                   MenuItem **items,
+                   size_t *item_count,
+                   size_t *item_capacity,
+                   MenuItemFile *file);
+
+void FreeMenuItemFile(MenuItemFile *file);
+
+// Items arriving on a file descriptor, such as a pipe on stdin, read and split on a background
+// thread.
+struct MenuItemStream;
+
+typedef void (*MenuItemStreamNotifyFn)(void *data);
+
+// Starts reading items from `fd`, in the same format as `ReadMenuItems`. The stream takes `fd` over
+// and closes it once it's done reading or has been stopped. `notify` is called from the reading
+// thread whenever new items are ready and when the stream ends.
+MenuItemStream *StartMenuItemStream(int fd,
+                                    char delimiter,
+                                    MenuItemStreamNotifyFn notify,
+                                    void *notify_data);
+
+// Appends the items read since the last call. The items point into the stream's buffers, which
+// stay valid until `StopMenuItemStream`. Returns true if more items may follow.
+bool TakeMenuItemStreamItems(MenuItemStream *stream,
+                             MenuItem **items,
+                             size_t *item_count,
+                             size_t *item_capacity);
+
+// Stops reading, waking the reading thread if it's waiting for input, and frees the stream's
+// buffers once the thread is done with them.
+void StopMenuItemStream(MenuItemStream *stream);
+
+#endif
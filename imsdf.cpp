@@ -0,0 +1,91 @@
+// imsdf.cpp
+
+#include "imsdf.h"
+#include <math.h>
+#include <stdlib.h>
+
+struct Offset {
+    int X;
+    int Y;
+    float Distance;
+};
+
+static int CompareOffsets(const void *a, const void *b) {
+    float distance_a = ((const Offset *)a)->Distance, distance_b = ((const Offset *)b)->Distance;
+    return distance_a < distance_b ? -1 : distance_a > distance_b ? 1 : 0;
+}
+
+// The field is found by brute force: each pixel looks for the nearest pixel on the other side of
+// the edge within `spread` of it. Pixels are visited nearest first, so the search stops as soon as
+// nothing further away could be nearer the edge, which in glyphs, all strokes and edges, is soon.
+//
+// Coverage says where the edge crosses a pixel: a pixel a quarter covered holds the edge a quarter
+// of the way in, roughly, so the distance to the edge through a pixel on the other side is its
+// distance less however much of it is on this side.
+void MakeDistanceField(uint8_t *pixels,
+                       int width,
+                       int height,
+                       size_t pixel_stride,
+                       size_t row_stride,
+                       int spread) {
+    if (width <= 0 || height <= 0)
+        return;
+
+    float *coverage = (float *)malloc(sizeof(float) * width * height);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++)
+            coverage[y * width + x] = (float)pixels[y * row_stride + x * pixel_stride] / 255.0f;
+    }
+    int offset_count = 0;
+    Offset *offsets = (Offset *)malloc(sizeof(Offset) * (2 * spread + 1) * (2 * spread + 1));
+    for (int dy = -spread; dy <= spread; dy++) {
+        for (int dx = -spread; dx <= spread; dx++) {
+            if (dx == 0 && dy == 0)
+                continue;
+            Offset *offset = &offsets[offset_count++];
+            offset->X = dx;
+            offset->Y = dy;
+            offset->Distance = sqrtf((float)(dx * dx + dy * dy));
+        }
+    }
+    qsort(offsets, offset_count, sizeof(Offset), CompareOffsets);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float own = coverage[y * width + x];
+            bool inside = own >= 0.5f;
+            // The distance to the edge, in pixels, from the inside or the outside.
+            float distance = (float)spread;
+            if (inside && own < 1.0f)
+                distance = own - 0.5f;
+            else if (!inside && own > 0.0f)
+                distance = 0.5f - own;
+            for (int index = 0; index < offset_count; index++) {
+                const Offset *offset = &offsets[index];
+                // Neither side's estimate can come out more than half a pixel short of the offset.
+                if (offset->Distance - 0.5f >= distance)
+                    break;
+                int other_x = x + offset->X, other_y = y + offset->Y;
+                float other = 0.0f;
+                if (other_x >= 0 && other_x < width && other_y >= 0 && other_y < height)
+                    other = coverage[other_y * width + other_x];
+                if ((other >= 0.5f) == inside)
+                    continue;
+                float candidate = inside ?
+                    offset->Distance - 0.5f + other :
+                    offset->Distance - other + 0.5f;
+                if (candidate < distance)
+                    distance = candidate;
+            }
+
+            float value = 0.5f + (inside ? distance : -distance) / (2.0f * (float)spread);
+            if (value < 0.0f)
+                value = 0.0f;
+            else if (value > 1.0f)
+                value = 1.0f;
+            pixels[y * row_stride + x * pixel_stride] = (uint8_t)(value * 255.0f + 0.5f);
+        }
+    }
+    free(offsets);
+    free(coverage);
+}
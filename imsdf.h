@@ -0,0 +1,21 @@
+// imsdf.h
+
+#ifndef IMSDF_H
+#define IMSDF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Replaces the coverage in a `width` by `height` rectangle of 8-bit values with a signed distance
+// field, so that it can be scaled up without blurring. The values are `pixel_stride` bytes apart
+// within a row and `row_stride` bytes apart between rows, so one channel of a wider format can be
+// converted in place. Anything outside the rectangle is taken to be uncovered. In the result, 128
+// lies on an edge, and values fall to 0 outside and rise to 255 inside over `spread` pixels.
+void MakeDistanceField(uint8_t *pixels,
+                       int width,
+                       int height,
+                       size_t pixel_stride,
+                       size_t row_stride,
+                       int spread);
+
+#endif
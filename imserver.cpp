@@ -0,0 +1,268 @@
+// imserver.cpp
+
+#include "imserver.h"
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The longest request accepted, which is mostly arguments, so it's well past any `ARG_MAX`.
+#define MAX_DIALOG_REQUEST_SIZE (64 * 1024 * 1024)
+// A client that stops sending its request for this long is given up on, so that it can't hold up
+// the clients behind it.
+#define DIALOG_REQUEST_TIMEOUT_MS   5000
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL    0
+#endif
+#ifndef MSG_CMSG_CLOEXEC
+#define MSG_CMSG_CLOEXEC    0
+#endif
+
+// A request is a 32-bit size, sent along with the client's file descriptors, followed by that many
+// bytes of NUL-terminated strings: the working directory, then the arguments. The reply is a 32-bit
+// exit code.
+union DialogRequestControl {
+    struct cmsghdr Header;
+    char Buffer[CMSG_SPACE(sizeof(int) * DIALOG_REQUEST_FD_COUNT)];
+};
+
+static bool GetSocketAddress(const char *path, struct sockaddr_un *address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    strcpy(address->sun_path, path);
+    return true;
+}
+
+static bool WriteAll(int fd, const void *data, size_t size) {
+    const char *ptr = (const char *)data;
+    while (size > 0) {
+        ssize_t written = send(fd, ptr, size, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        ptr += written;
+        size -= written;
+    }
+    return true;
+}
+
+static bool ReadAll(int fd, void *data, size_t size) {
+    char *ptr = (char *)data;
+    while (size > 0) {
+        ssize_t read_size = read(fd, ptr, size);
+        if (read_size < 0 && errno == EINTR)
+            continue;
+        if (read_size <= 0)
+            return false;
+        ptr += read_size;
+        size -= read_size;
+    }
+    return true;
+}
+
+int ListenForDialogRequests(const char *path) {
+    struct sockaddr_un address;
+    if (!GetSocketAddress(path, &address))
+        return -1;
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+        return -1;
+    fcntl(listen_fd, F_SETFD, FD_CLOEXEC);
+    fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+    unlink(path);
+    if (bind(listen_fd, (const struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(listen_fd, 16) != 0) {
+        close(listen_fd);
+        return -1;
+    }
+    return listen_fd;
+}
+
+static bool ReadDialogRequest(int connection, DialogRequest *request) {
+    uint32_t size = 0;
+    struct iovec iov = { &size, sizeof(size) };
+    DialogRequestControl control;
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.Buffer;
+    message.msg_controllen = sizeof(control.Buffer);
+    ssize_t received;
+    do {
+        received = recvmsg(connection, &message, MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+    if (received < 0)
+        return false;
+
+    for (struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+         header != NULL;
+         header = CMSG_NXTHDR(&message, header)) {
+        if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+            continue;
+        size_t fd_count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int *fds = (int *)CMSG_DATA(header);
+        for (size_t index = 0; index < fd_count; index++) {
+            if (index < DIALOG_REQUEST_FD_COUNT && request->FDs[index] < 0) {
+                request->FDs[index] = fds[index];
+                fcntl(fds[index], F_SETFD, FD_CLOEXEC);
+            } else {
+                close(fds[index]);
+            }
+        }
+    }
+
+    if (received != sizeof(size) || (message.msg_flags & MSG_CTRUNC) != 0)
+        return false;
+    for (int index = 0; index < DIALOG_REQUEST_FD_COUNT; index++) {
+        if (request->FDs[index] < 0)
+            return false;
+    }
+    if (size == 0 || size > MAX_DIALOG_REQUEST_SIZE)
+        return false;
+
+    request->Buffer = (char *)malloc(size);
+    if (!ReadAll(connection, request->Buffer, size) || request->Buffer[size - 1] != '\0')
+        return false;
+
+    int string_count = 0;
+    for (uint32_t offset = 0; offset < size; offset++) {
+        if (request->Buffer[offset] == '\0')
+            string_count++;
+    }
+    // Past the working directory, there has to be at least a program name and a widget.
+    if (string_count < 3)
+        return false;
+    request->WorkingDirectory = request->Buffer;
+    request->ArgumentCount = string_count - 1;
+    request->Arguments = (const char **)malloc(sizeof(const char *) * string_count);
+    const char *string = request->Buffer + strlen(request->Buffer) + 1;
+    for (int index = 0; index < request->ArgumentCount; index++) {
+        request->Arguments[index] = string;
+        string += strlen(string) + 1;
+    }
+    return true;
+}
+
+int AcceptDialogRequest(int listen_fd, DialogRequest *request) {
+    while (true) {
+        memset(request, 0, sizeof(*request));
+        for (int index = 0; index < DIALOG_REQUEST_FD_COUNT; index++)
+            request->FDs[index] = -1;
+
+        int connection = accept(listen_fd, NULL, NULL);
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            return -1;
+        }
+        fcntl(connection, F_SETFD, FD_CLOEXEC);
+        // Some systems pass the listening socket's `O_NONBLOCK` on to its connections. Reads of
+        // the request block, but only for so long.
+        fcntl(connection, F_SETFL, fcntl(connection, F_GETFL) & ~O_NONBLOCK);
+        struct timeval timeout = {
+            DIALOG_REQUEST_TIMEOUT_MS / 1000, (DIALOG_REQUEST_TIMEOUT_MS % 1000) * 1000
+        };
+        setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (ReadDialogRequest(connection, request))
+            return connection;
+        FreeDialogRequest(request);
+        close(connection);
+    }
+}
+
+void FreeDialogRequest(DialogRequest *request) {
+    free(request->Buffer);
+    free(request->Arguments);
+    for (int index = 0; index < DIALOG_REQUEST_FD_COUNT; index++) {
+        if (request->FDs[index] >= 0)
+            close(request->FDs[index]);
+    }
+    memset(request, 0, sizeof(*request));
+    for (int index = 0; index < DIALOG_REQUEST_FD_COUNT; index++)
+        request->FDs[index] = -1;
+}
+
+bool SendDialogExitCode(int connection, int exit_code) {
+    int32_t code = exit_code;
+    return WriteAll(connection, &code, sizeof(code));
+}
+
+int SendDialogRequest(const char *path, int argc, const char **argv) {
+    struct sockaddr_un address;
+    if (!GetSocketAddress(path, &address))
+        return -1;
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0)
+        return -1;
+    fcntl(connection, F_SETFD, FD_CLOEXEC);
+    if (connect(connection, (const struct sockaddr *)&address, sizeof(address)) != 0) {
+        close(connection);
+        return -1;
+    }
+
+    // A missing working directory is sent as an empty one, which the server leaves alone.
+    char *working_directory = getcwd(NULL, 0);
+    const char *directory = working_directory != NULL ? working_directory : "";
+    size_t size = strlen(directory) + 1;
+    for (int index = 0; index < argc; index++)
+        size += strlen(argv[index]) + 1;
+    char *buffer = (char *)malloc(size);
+    size_t used = strlen(directory) + 1;
+    memcpy(buffer, directory, used);
+    for (int index = 0; index < argc; index++) {
+        size_t length = strlen(argv[index]) + 1;
+        memcpy(&buffer[used], argv[index], length);
+        used += length;
+    }
+    free(working_directory);
+
+    uint32_t header = (uint32_t)size;
+    struct iovec iov = { &header, sizeof(header) };
+    DialogRequestControl control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.Buffer;
+    message.msg_controllen = sizeof(control.Buffer);
+    struct cmsghdr *control_header = CMSG_FIRSTHDR(&message);
+    control_header->cmsg_level = SOL_SOCKET;
+    control_header->cmsg_type = SCM_RIGHTS;
+    control_header->cmsg_len = CMSG_LEN(sizeof(int) * DIALOG_REQUEST_FD_COUNT);
+    int fds[DIALOG_REQUEST_FD_COUNT] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    memcpy(CMSG_DATA(control_header), fds, sizeof(fds));
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(connection, &message, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    bool ok = sent == sizeof(header) && WriteAll(connection, buffer, size);
+    free(buffer);
+    if (!ok) {
+        close(connection);
+        return -1;
+    }
+    return connection;
+}
+
+bool ReceiveDialogExitCode(int connection, int *exit_code) {
+    int32_t code = 0;
+    if (!ReadAll(connection, &code, sizeof(code)))
+        return false;
+    *exit_code = code;
+    return true;
+}
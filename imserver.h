@@ -0,0 +1,48 @@
+// imserver.h
+
+#ifndef IMSERVER_H
+#define IMSERVER_H
+
+#include <stddef.h>
+
+// Dialogs shown by a long-running `imdialog --server` on behalf of clients that connect to its
+// Unix domain socket, which saves each dialog the cost of setting up SDL, GL and the fonts. A
+// request carries the client's arguments and working directory along with its stdin, stdout and
+// stderr, so the dialog reads and writes them just as if it ran in the client. The reply is the
+// dialog's exit code.
+
+#define DIALOG_REQUEST_FD_COUNT 3
+
+struct DialogRequest {
+    // Holds the strings below.
+    char *Buffer;
+    const char *WorkingDirectory;
+    const char **Arguments;
+    int ArgumentCount;
+    // The client's stdin, stdout and stderr.
+    int FDs[DIALOG_REQUEST_FD_COUNT];
+};
+
+// Creates the socket at `path`, replacing whatever is there, and listens on it. Returns the
+// listening socket, which is non-blocking, so poll it for connections, or -1 on error.
+int ListenForDialogRequests(const char *path);
+
+// Accepts a waiting connection and reads its request, skipping connections whose requests can't be
+// read, including those that don't arrive in time. Returns the connection, or -1 with `errno` set
+// to `EAGAIN` or `EWOULDBLOCK` once no more are waiting, or to something else on error.
+int AcceptDialogRequest(int listen_fd, DialogRequest *request);
+
+// Frees a request's strings and closes its file descriptors.
+void FreeDialogRequest(DialogRequest *request);
+
+bool SendDialogExitCode(int connection, int exit_code);
+
+// Connects to the server at `path` and sends it a request to show the dialog described by `argv`,
+// along with the current directory and stdin, stdout and stderr. Returns the connection, or -1 if
+// the server couldn't be reached.
+int SendDialogRequest(const char *path, int argc, const char **argv);
+
+// Waits for the dialog to finish. Returns false if the connection was lost first.
+bool ReceiveDialogExitCode(int connection, int *exit_code);
+
+#endif
@@ -0,0 +1,117 @@
+// imstreambuffer.cpp
+
+#include "imstreambuffer.h"
+#include <stdlib.h>
+#include <string.h>
+
+// The smallest buffer made, which is plenty for a dialog's frame.
+#define MIN_STREAM_BUFFER_CAPACITY  (64 * 1024)
+
+static size_t GetStreamBufferCapacity(size_t size) {
+    size_t capacity = MIN_STREAM_BUFFER_CAPACITY;
+    while (capacity < size)
+        capacity *= 2;
+    return capacity;
+}
+
+#if !defined(HAVE_OPENGLES2) && !defined(__APPLE__)
+static bool CanMapPersistently() {
+    return GLEW_ARB_buffer_storage && GLEW_ARB_map_buffer_range && GLEW_ARB_sync;
+}
+
+static void WaitForRegion(StreamBuffer *buffer, int region) {
+    GLsync fence = buffer->Fences[region];
+    if (fence == NULL)
+        return;
+    GLenum result;
+    do {
+        result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    } while (result == GL_TIMEOUT_EXPIRED);
+    glDeleteSync(fence);
+    buffer->Fences[region] = NULL;
+}
+
+// Replaces the buffer with one whose regions each hold `capacity` bytes.
+static void MapStreamBuffer(StreamBuffer *buffer, size_t capacity) {
+    for (int region = 0; region < STREAM_BUFFER_REGION_COUNT; region++)
+        WaitForRegion(buffer, region);
+    if (buffer->Buffer != 0) {
+        GL(glBindBuffer(buffer->Target, buffer->Buffer));
+        GL(glUnmapBuffer(buffer->Target));
+        GL(glDeleteBuffers(1, &buffer->Buffer));
+    }
+
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    GLsizeiptr size = (GLsizeiptr)(capacity * STREAM_BUFFER_REGION_COUNT);
+    GL(glGenBuffers(1, &buffer->Buffer));
+    GL(glBindBuffer(buffer->Target, buffer->Buffer));
+    GL(glBufferStorage(buffer->Target, size, NULL, flags));
+    buffer->Mapping = (char *)glMapBufferRange(buffer->Target, 0, size, flags);
+    if (buffer->Mapping == NULL) {
+        fprintf(stderr, "error: couldn't map a stream buffer\n");
+        abort();
+    }
+    buffer->Capacity = capacity;
+}
+#endif
+
+void InitStreamBuffer(StreamBuffer *buffer, GLenum target) {
+    memset(buffer, 0, sizeof(*buffer));
+    buffer->Target = target;
+#if !defined(HAVE_OPENGLES2) && !defined(__APPLE__)
+    if (CanMapPersistently()) {
+        buffer->Persistent = true;
+        MapStreamBuffer(buffer, MIN_STREAM_BUFFER_CAPACITY);
+        return;
+    }
+#endif
+    GL(glGenBuffers(1, &buffer->Buffer));
+}
+
+void *BeginStreamBufferWrite(StreamBuffer *buffer, size_t size) {
+    buffer->PendingSize = size;
+#if !defined(HAVE_OPENGLES2) && !defined(__APPLE__)
+    if (buffer->Persistent) {
+        if (size > buffer->Capacity)
+            MapStreamBuffer(buffer, GetStreamBufferCapacity(size));
+        buffer->Region = (buffer->Region + 1) % STREAM_BUFFER_REGION_COUNT;
+        WaitForRegion(buffer, buffer->Region);
+        return &buffer->Mapping[buffer->Region * buffer->Capacity];
+    }
+#endif
+    if (size > buffer->StagingCapacity) {
+        buffer->StagingCapacity = GetStreamBufferCapacity(size);
+        buffer->Staging = (char *)realloc(buffer->Staging, buffer->StagingCapacity);
+    }
+    return buffer->Staging;
+}
+
+size_t EndStreamBufferWrite(StreamBuffer *buffer) {
+    GL(glBindBuffer(buffer->Target, buffer->Buffer));
+    if (buffer->Persistent)
+        return buffer->Region * buffer->Capacity;
+
+    size_t size = buffer->PendingSize;
+    if (buffer->Head + size > buffer->Capacity) {
+        // Orphaning the storage lets the driver hand out fresh storage while the GPU finishes
+        // with the old.
+        if (size > buffer->Capacity)
+            buffer->Capacity = GetStreamBufferCapacity(size);
+        GL(glBufferData(buffer->Target, (GLsizeiptr)buffer->Capacity, NULL, GL_STREAM_DRAW));
+        buffer->Head = 0;
+    }
+    size_t offset = buffer->Head;
+    GL(glBufferSubData(buffer->Target, (GLintptr)offset, (GLsizeiptr)size, buffer->Staging));
+    // Keeps every frame's data aligned for any type.
+    buffer->Head += (size + 15) & ~(size_t)15;
+    return offset;
+}
+
+void FinishStreamBufferFrame(StreamBuffer *buffer) {
+#if !defined(HAVE_OPENGLES2) && !defined(__APPLE__)
+    if (buffer->Persistent)
+        buffer->Fences[buffer->Region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+#else
+    (void)buffer;
+#endif
+}
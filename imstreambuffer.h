@@ -0,0 +1,54 @@
+// imstreambuffer.h
+
+#ifndef IMSTREAMBUFFER_H
+#define IMSTREAMBUFFER_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "imgl.h"
+
+// How many frames a persistently mapped buffer holds, so that the GPU can still be reading one
+// frame's data while the next is written.
+#define STREAM_BUFFER_REGION_COUNT  3
+
+// A GL buffer that's filled anew every frame, with all of a frame's data going in in one write.
+//
+// Each frame's data is written after the last, and when the buffer fills up it's orphaned and
+// writing starts over at the front, so the driver never has to wait on the GPU to take new data or
+// reallocate storage every frame. Where desktop GL has `GL_ARB_buffer_storage`, the buffer is
+// mapped once, for good, and written straight into instead, one region per frame, with fences
+// keeping writes off any region the GPU may still be reading.
+struct StreamBuffer {
+    GLenum Target;
+    GLuint Buffer;
+    // The size of the buffer or, if it's mapped, of each of its regions.
+    size_t Capacity;
+    // Where the next frame's data goes, if the buffer isn't mapped.
+    size_t Head;
+    // Where data is put before it's uploaded, if the buffer isn't mapped.
+    char *Staging;
+    size_t StagingCapacity;
+    size_t PendingSize;
+
+    bool Persistent;
+    char *Mapping;
+    int Region;
+#if !defined(HAVE_OPENGLES2) && !defined(__APPLE__)
+    GLsync Fences[STREAM_BUFFER_REGION_COUNT];
+#endif
+};
+
+// Sets `buffer` up for `target`, mapping it persistently if the GL allows.
+void InitStreamBuffer(StreamBuffer *buffer, GLenum target);
+
+// Returns where to put the `size` bytes of this frame's data.
+void *BeginStreamBufferWrite(StreamBuffer *buffer, size_t size);
+
+// Hands the data over to the GL, and leaves the buffer bound to its target. Returns the offset of
+// the data in the buffer.
+size_t EndStreamBufferWrite(StreamBuffer *buffer);
+
+// Called once everything drawn from the frame's data has been submitted.
+void FinishStreamBufferFrame(StreamBuffer *buffer);
+
+#endif
@@ -0,0 +1,126 @@
+// imtest.cpp
+//
+// Tests of the parts of imdialog that need no window, built and run by `make test`. Each test
+// writes its input under `$TMPDIR` and removes it afterwards.
+
+#include "imtextfile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_TEXT_FILE_COUNT    64
+
+static int g_FailureCount;
+
+static void Fail(const char *test, const char *message, uint64_t offset) {
+    fprintf(stderr, "%s: %s at %llu\n", test, message, (unsigned long long)offset);
+    g_FailureCount++;
+}
+
+// Writes `length` bytes of `data` to a new scratch file, returning its path.
+static char *MakeTestFile(const char *data, size_t length) {
+    const char *tmpdir = getenv("TMPDIR");
+    if (tmpdir == NULL || tmpdir[0] == '\0')
+        tmpdir = "/tmp";
+    char *path = (char *)malloc(strlen(tmpdir) + 32);
+    sprintf(path, "%s/imtest.XXXXXX", tmpdir);
+    int fd = mkstemp(path);
+    if (fd < 0 || write(fd, data, length) != (ssize_t)length) {
+        perror("imtest: couldn't write a scratch file");
+        exit(1);
+    }
+    close(fd);
+    return path;
+}
+
+// Walks the lines of `data` the way `--textbox` draws its rows, and checks that the rows are no
+// longer than a row can show and that together they hold every byte, in order. Also checks that
+// every offset finds the start of its own line, and that stepping back finds the line before.
+static void CheckTextFileRows(const char *test, const char *data, size_t length) {
+    char *path = MakeTestFile(data, length);
+    TextFile file;
+    if (!OpenTextFile(&file, path)) {
+        Fail(test, "couldn't open", 0);
+        return;
+    }
+
+    char line[TEXT_FILE_MAX_LINE_LENGTH];
+    uint64_t line_start = 0, previous_line_start = 0;
+    while (line_start < file.Size) {
+        uint64_t next_line_start = FindNextTextLine(&file, line_start);
+        if (next_line_start <= line_start ||
+            next_line_start - line_start > TEXT_FILE_MAX_LINE_LENGTH) {
+            Fail(test, "line too long for a row", line_start);
+            break;
+        }
+        size_t line_length = (size_t)(next_line_start - line_start);
+        if (!ReadTextFile(&file, line_start, line_length, line) ||
+            memcmp(line, &data[line_start], line_length) != 0) {
+            Fail(test, "row doesn't hold its line", line_start);
+        }
+        for (uint64_t offset = line_start; offset < next_line_start; offset++) {
+            if (FindTextLineStart(&file, offset) != line_start) {
+                Fail(test, "offset doesn't find its line's start", offset);
+                break;
+            }
+        }
+        if (line_start > 0 && FindPreviousTextLine(&file, line_start) != previous_line_start)
+            Fail(test, "previous line isn't the one before", line_start);
+        previous_line_start = line_start;
+        line_start = next_line_start;
+    }
+
+    CloseTextFile(&file);
+    unlink(path);
+    free(path);
+}
+
+// Appends a line of `length` bytes, newline included, to `data`.
+static void AppendTestLine(char *data, size_t *data_length, size_t length) {
+    for (size_t index = 0; index + 1 < length; index++, (*data_length)++)
+        data[*data_length] = 'a' + (char)(*data_length % 26);
+    data[(*data_length)++] = '\n';
+}
+
+static void TestTextFileWrapping() {
+    size_t capacity = 64 * 1024;
+    char *data = (char *)malloc(capacity);
+
+    // A line ending just before a wrap point leaves the next one running to the wrap point after.
+    size_t length = 0;
+    AppendTestLine(data, &length, 400);
+    AppendTestLine(data, &length, 700);
+    CheckTextFileRows("short line then long line", data, length);
+
+    length = 0;
+    while (length < 5000)
+        data[length++] = 'x';
+    CheckTextFileRows("no newlines", data, length);
+
+    srand(1);
+    for (int file_index = 0; file_index < TEST_TEXT_FILE_COUNT; file_index++) {
+        length = 0;
+        while (length < capacity - 4 * TEXT_FILE_LINE_WRAP_LENGTH) {
+            // Mostly short lines, with some around and well past the wrap length.
+            size_t line_length = 1 + (size_t)(rand() % 80);
+            if (rand() % 4 == 0)
+                line_length = 1 + (size_t)(rand() % (3 * TEXT_FILE_LINE_WRAP_LENGTH));
+            AppendTestLine(data, &length, line_length);
+        }
+        if (file_index % 2 == 1)
+            length--;
+        CheckTextFileRows("mixed line lengths", data, length);
+    }
+    free(data);
+}
+
+int main() {
+    TestTextFileWrapping();
+    if (g_FailureCount != 0) {
+        fprintf(stderr, "imtest: %d failures\n", g_FailureCount);
+        return 1;
+    }
+    printf("imtest: all passed\n");
+    return 0;
+}
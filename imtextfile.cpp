@@ -0,0 +1,383 @@
+// imtextfile.cpp
+
+#include "imtextfile.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Windows are twice the longest range and start at a multiple of it, so that any range fits in
+// the window that contains its start.
+#define WINDOW_SIZE (2 * (size_t)TEXT_FILE_MAX_RANGE)
+
+// How much the indexer reads between checks of its time budget.
+#define INDEX_CHUNK_SIZE    (1024 * 1024)
+
+// Does something with `length` bytes of the mapped file at `data`, putting what it finds in
+// `result`.
+typedef void (*MappedReadFn)(TextFile *file, const char *data, size_t length, void *result);
+
+// Touching a page of a mapping past the end of a file that's been truncated raises `SIGBUS`. A
+// read that's in progress on this thread has its way back out here.
+static thread_local sigjmp_buf *g_MappedReadFault;
+
+static void HandleBusError(int signal_number) {
+    if (g_MappedReadFault != NULL)
+        siglongjmp(*g_MappedReadFault, 1);
+    // Not a read of ours, so it's left to kill the process as it would have.
+    signal(SIGBUS, SIG_DFL);
+}
+
+static void InstallBusErrorHandler() {
+    static bool installed = false;
+    if (installed)
+        return;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = HandleBusError;
+    // The handler jumps out rather than returning, so it mustn't leave `SIGBUS` blocked.
+    action.sa_flags = SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGBUS, &action, NULL);
+    installed = true;
+}
+
+static double GetMonotonicSeconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+// Returns a mask with a bit set for each newline in the 16 bytes at `data`, along with how many
+// bits each byte takes up in the mask.
+static inline uint64_t GetNewlineMask(const char *data, int *bits_per_byte) {
+#if defined(__SSE2__)
+    *bits_per_byte = 1;
+    __m128i chars = _mm_loadu_si128((const __m128i *)data);
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_set1_epi8('\n')));
+#elif defined(__ARM_NEON)
+    // NEON has no movemask, so narrow each byte of the comparison to a nibble instead.
+    *bits_per_byte = 4;
+    uint8x16_t equal = vceqq_u8(vld1q_u8((const uint8_t *)data), vdupq_n_u8('\n'));
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(equal), 4)), 0);
+#else
+    *bits_per_byte = 1;
+    uint64_t mask = 0;
+    for (int position = 0; position < 16; position++)
+        mask |= (uint64_t)(data[position] == '\n') << position;
+    return mask;
+#endif
+}
+
+// Like `memrchr`, which not every platform has.
+static const char *FindLastNewline(const char *data, size_t length) {
+    size_t end = length;
+    int bits_per_byte;
+    for (; end >= 16; end -= 16) {
+        uint64_t mask = GetNewlineMask(&data[end - 16], &bits_per_byte);
+        if (mask != 0)
+            return &data[end - 16 + (63 - __builtin_clzll(mask)) / bits_per_byte];
+    }
+    while (end > 0) {
+        if (data[--end] == '\n')
+            return &data[end];
+    }
+    return NULL;
+}
+
+static size_t CountNewlines(const char *data, size_t length) {
+    size_t count = 0, position = 0;
+    int bits_per_byte = 1;
+    for (; position + 16 <= length; position += 16)
+        count += __builtin_popcountll(GetNewlineMask(&data[position], &bits_per_byte));
+    count /= bits_per_byte;
+    for (; position < length; position++)
+        count += data[position] == '\n';
+    return count;
+}
+
+bool OpenTextFile(TextFile *file, const char *path) {
+    memset(file, 0, sizeof(*file));
+    file->FD = open(path, O_RDONLY | O_CLOEXEC);
+    if (file->FD < 0)
+        return false;
+    InstallBusErrorHandler();
+    file->CheckpointCapacity = 64;
+    file->Checkpoints = (uint64_t *)malloc(sizeof(uint64_t) * file->CheckpointCapacity);
+    file->Checkpoints[0] = 0;
+    file->CheckpointCount = 1;
+    RefreshTextFileSize(file);
+    return true;
+}
+
+static void UnmapTextFileWindow(TextFile *file) {
+    if (file->Window != NULL)
+        munmap((void *)file->Window, file->WindowSize);
+    file->Window = NULL;
+    file->WindowSize = 0;
+}
+
+void CloseTextFile(TextFile *file) {
+    UnmapTextFileWindow(file);
+    if (file->FD >= 0)
+        close(file->FD);
+    free(file->Checkpoints);
+    memset(file, 0, sizeof(*file));
+    file->FD = -1;
+}
+
+static void ResetTextFileIndex(TextFile *file) {
+    file->CheckpointCount = 1;
+    file->IndexedSize = 0;
+    file->IndexedLineCount = 0;
+}
+
+bool RefreshTextFileSize(TextFile *file) {
+    file->Error = 0;
+    struct stat stats;
+    if (fstat(file->FD, &stats) != 0 || (uint64_t)stats.st_size == file->Size)
+        return false;
+    if ((uint64_t)stats.st_size < file->Size) {
+        // Truncated, probably to be written again from the start.
+        ResetTextFileIndex(file);
+    }
+    // The window may have been cut short by the old end of the file.
+    UnmapTextFileWindow(file);
+    file->Size = stats.st_size;
+    return true;
+}
+
+// Returns `length` bytes of the file from `offset`, which stay valid until the next call, or NULL
+// if they couldn't be mapped.
+static const char *GetTextFileRange(TextFile *file, uint64_t offset, size_t length) {
+    if (file->Error != 0)
+        return NULL;
+    if (length == 0)
+        return "";
+    if (file->Window == NULL ||
+        offset < file->WindowOffset ||
+        offset + length > file->WindowOffset + file->WindowSize) {
+        UnmapTextFileWindow(file);
+        uint64_t window_offset = offset - offset % TEXT_FILE_MAX_RANGE;
+        size_t window_size = (size_t)std::min((uint64_t)WINDOW_SIZE, file->Size - window_offset);
+        void *window = mmap(NULL,
+                            window_size,
+                            PROT_READ,
+                            MAP_SHARED,
+                            file->FD,
+                            (off_t)window_offset);
+        if (window == MAP_FAILED) {
+            file->Error = errno;
+            return NULL;
+        }
+        file->Window = (const char *)window;
+        file->WindowOffset = window_offset;
+        file->WindowSize = window_size;
+    }
+    return &file->Window[offset - file->WindowOffset];
+}
+
+// Calls `read` on `length` bytes of the file from `offset`. Returns false if they couldn't be
+// mapped, or if the file was truncated under them, which leaves `read` stopped partway.
+static bool ReadMappedRange(TextFile *file,
+                            uint64_t offset,
+                            size_t length,
+                            MappedReadFn read,
+                            void *result) {
+    const char *data = GetTextFileRange(file, offset, length);
+    if (data == NULL)
+        return false;
+    sigjmp_buf fault;
+    if (sigsetjmp(fault, 0) != 0) {
+        g_MappedReadFault = NULL;
+        // What was mapped is no longer all there, and whatever was indexed may be gone too.
+        UnmapTextFileWindow(file);
+        ResetTextFileIndex(file);
+        file->Error = EIO;
+        return false;
+    }
+    g_MappedReadFault = &fault;
+    read(file, data, length, result);
+    g_MappedReadFault = NULL;
+    return true;
+}
+
+static void CopyMappedRange(TextFile *file, const char *data, size_t length, void *result) {
+    memcpy(result, data, length);
+}
+
+static void FindFirstMappedNewline(TextFile *file, const char *data, size_t length, void *result) {
+    const char *newline = (const char *)memchr(data, '\n', length);
+    *(int64_t *)result = newline != NULL ? newline - data : -1;
+}
+
+static void FindLastMappedNewline(TextFile *file, const char *data, size_t length, void *result) {
+    const char *newline = FindLastNewline(data, length);
+    *(int64_t *)result = newline != NULL ? newline - data : -1;
+}
+
+static void CountMappedNewlines(TextFile *file, const char *data, size_t length, void *result) {
+    *(uint64_t *)result += CountNewlines(data, length);
+}
+
+bool ReadTextFile(TextFile *file, uint64_t offset, size_t length, char *buffer) {
+    return ReadMappedRange(file, offset, length, CopyMappedRange, buffer);
+}
+
+// Returns the offset of the first newline from `start` up to `end`, or -1 if there's none.
+static int64_t FindFirstNewlineBetween(TextFile *file, uint64_t start, uint64_t end) {
+    int64_t newline = -1;
+    if (start >= end ||
+        !ReadMappedRange(file, start, (size_t)(end - start), FindFirstMappedNewline, &newline) ||
+        newline < 0) {
+        return -1;
+    }
+    return (int64_t)start + newline;
+}
+
+// Returns the offset of the last newline from `start` up to `end`, or -1 if there's none.
+static int64_t FindLastNewlineBetween(TextFile *file, uint64_t start, uint64_t end) {
+    int64_t newline = -1;
+    if (start >= end ||
+        !ReadMappedRange(file, start, (size_t)(end - start), FindLastMappedNewline, &newline) ||
+        newline < 0) {
+        return -1;
+    }
+    return (int64_t)start + newline;
+}
+
+uint64_t FindTextLineStart(TextFile *file, uint64_t offset) {
+    // The line starts after the last newline before `offset`, unless the last wrap point comes
+    // after that newline. That's the multiple of the wrap length at or before `offset`, if the
+    // wrap length before it has no newline.
+    uint64_t wrap = offset - offset % TEXT_FILE_LINE_WRAP_LENGTH;
+    int64_t newline = FindLastNewlineBetween(file, wrap, offset);
+    if (newline >= 0)
+        return (uint64_t)newline + 1;
+    if (wrap == 0)
+        return 0;
+    newline = FindLastNewlineBetween(file, wrap - TEXT_FILE_LINE_WRAP_LENGTH, wrap);
+    return newline >= 0 ? (uint64_t)newline + 1 : wrap;
+}
+
+uint64_t FindNextTextLine(TextFile *file, uint64_t line_start) {
+    if (line_start >= file->Size)
+        return file->Size;
+    // The line ends after the first newline, unless a wrap point comes first. The first
+    // multiple of the wrap length past `line_start` is one if there's no newline in the wrap
+    // length before it, and if it isn't, the next one after it is.
+    uint64_t wrap = line_start + TEXT_FILE_LINE_WRAP_LENGTH - line_start % TEXT_FILE_LINE_WRAP_LENGTH;
+    int64_t newline = FindFirstNewlineBetween(file, line_start, std::min(wrap, file->Size));
+    if (newline >= 0)
+        return (uint64_t)newline + 1;
+    if (wrap >= file->Size)
+        return file->Size;
+    if (FindLastNewlineBetween(file, wrap - TEXT_FILE_LINE_WRAP_LENGTH, line_start) < 0)
+        return wrap;
+    uint64_t next_wrap = std::min(wrap + TEXT_FILE_LINE_WRAP_LENGTH, file->Size);
+    newline = FindFirstNewlineBetween(file, wrap, next_wrap);
+    return newline >= 0 ? (uint64_t)newline + 1 : next_wrap;
+}
+
+uint64_t FindPreviousTextLine(TextFile *file, uint64_t line_start) {
+    if (line_start == 0)
+        return 0;
+    return FindTextLineStart(file, line_start - 1);
+}
+
+uint64_t FindLastTextLine(TextFile *file) {
+    if (file->Size == 0)
+        return 0;
+    uint64_t line_start = FindTextLineStart(file, file->Size);
+    if (line_start == file->Size)
+        line_start = FindPreviousTextLine(file, line_start);
+    return line_start;
+}
+
+static void AddTextFileCheckpoint(TextFile *file, uint64_t offset) {
+    if (file->CheckpointCount == file->CheckpointCapacity) {
+        file->CheckpointCapacity *= 2;
+        file->Checkpoints = (uint64_t *)realloc(file->Checkpoints,
+                                                sizeof(uint64_t) * file->CheckpointCapacity);
+    }
+    file->Checkpoints[file->CheckpointCount++] = offset;
+}
+
+// Counts the newlines in a chunk of the file that starts where the index left off, noting where
+// each checkpoint line starts on the way.
+static void IndexTextFileChunk(TextFile *file, const char *data, size_t length, void *result) {
+    uint64_t next_checkpoint_line = (uint64_t)file->CheckpointCount * TEXT_LINE_INDEX_INTERVAL;
+    size_t position = 0;
+    int bits_per_byte;
+    for (; position + 16 <= length; position += 16) {
+        uint64_t mask = GetNewlineMask(&data[position], &bits_per_byte);
+        if (mask == 0)
+            continue;
+        uint64_t count = __builtin_popcountll(mask) / bits_per_byte;
+        if (file->IndexedLineCount + count < next_checkpoint_line) {
+            file->IndexedLineCount += count;
+            continue;
+        }
+        while (mask != 0) {
+            size_t newline = position + __builtin_ctzll(mask) / bits_per_byte;
+            mask &= ~((((uint64_t)1 << bits_per_byte) - 1) << ((newline - position) * bits_per_byte));
+            if (++file->IndexedLineCount == next_checkpoint_line) {
+                AddTextFileCheckpoint(file, file->IndexedSize + newline + 1);
+                next_checkpoint_line += TEXT_LINE_INDEX_INTERVAL;
+            }
+        }
+    }
+    for (; position < length; position++) {
+        if (data[position] != '\n')
+            continue;
+        if (++file->IndexedLineCount == next_checkpoint_line) {
+            AddTextFileCheckpoint(file, file->IndexedSize + position + 1);
+            next_checkpoint_line += TEXT_LINE_INDEX_INTERVAL;
+        }
+    }
+    file->IndexedSize += length;
+}
+
+bool UpdateTextFileIndex(TextFile *file, uint64_t offset, double budget_seconds) {
+    offset = std::min(offset, file->Size);
+    double deadline = GetMonotonicSeconds() + budget_seconds;
+    while (file->IndexedSize < offset) {
+        size_t length = (size_t)std::min((uint64_t)INDEX_CHUNK_SIZE, file->Size - file->IndexedSize);
+        if (!ReadMappedRange(file, file->IndexedSize, length, IndexTextFileChunk, NULL))
+            return false;
+        if (GetMonotonicSeconds() > deadline)
+            break;
+    }
+    return file->IndexedSize < offset;
+}
+
+bool GetTextFileLineNumber(TextFile *file, uint64_t line_start, uint64_t *line_number) {
+    if (line_start > file->IndexedSize)
+        return false;
+    size_t checkpoint = std::upper_bound(file->Checkpoints,
+                                         file->Checkpoints + file->CheckpointCount,
+                                         line_start) - file->Checkpoints - 1;
+    uint64_t line = (uint64_t)checkpoint * TEXT_LINE_INDEX_INTERVAL;
+    uint64_t offset = file->Checkpoints[checkpoint];
+    while (offset < line_start) {
+        size_t length = (size_t)std::min((uint64_t)TEXT_FILE_MAX_RANGE, line_start - offset);
+        if (!ReadMappedRange(file, offset, length, CountMappedNewlines, &line))
+            return false;
+        offset += length;
+    }
+    *line_number = line;
+    return true;
+}
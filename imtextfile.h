@@ -0,0 +1,86 @@
+// imtextfile.h
+
+#ifndef IMTEXTFILE_H
+#define IMTEXTFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The line index records where every `TEXT_LINE_INDEX_INTERVAL`th line starts, so it takes up a
+// few bytes per thousand lines, and finding any line's number means counting at most this many
+// newlines.
+#define TEXT_LINE_INDEX_INTERVAL    4096
+
+// Lines that run longer than this without a newline are wrapped, so that finding where a line
+// starts or ends never reads more than twice this much of the file, even in a file with no
+// newlines at all.
+#define TEXT_FILE_LINE_WRAP_LENGTH  512
+
+// No line, wrapped or not, is longer than this, newline included. A wrap point only counts where
+// the wrap length before it holds no newline, so a line that starts just after one can run on
+// to the wrap point after next.
+#define TEXT_FILE_MAX_LINE_LENGTH   (2 * TEXT_FILE_LINE_WRAP_LENGTH - 1)
+
+// The longest range read out of the file at once.
+#define TEXT_FILE_MAX_RANGE         (32 * 1024 * 1024)
+
+// A read-only view of a file of any size, seen through one mapped window at a time so that even
+// files bigger than the address space can be shown. Lines are indexed lazily, only as far as
+// someone has asked about.
+//
+// Reads of the file can fail, if a window can't be mapped or the file is truncated while it's
+// being read, in which case `Error` is set and every read fails until the next
+// `RefreshTextFileSize`. What the lookups below return while `Error` is set means nothing.
+struct TextFile {
+    int FD;
+    uint64_t Size;
+    // The `errno` of the read that failed, or 0. A truncation under a read shows up as `EIO`.
+    int Error;
+
+    const char *Window;
+    uint64_t WindowOffset;
+    size_t WindowSize;
+
+    // `Checkpoints[i]` is the offset of the start of line `i * TEXT_LINE_INDEX_INTERVAL`.
+    uint64_t *Checkpoints;
+    size_t CheckpointCount;
+    size_t CheckpointCapacity;
+    // How much of the file has been indexed, and how many newlines that part holds.
+    uint64_t IndexedSize;
+    uint64_t IndexedLineCount;
+};
+
+bool OpenTextFile(TextFile *file, const char *path);
+void CloseTextFile(TextFile *file);
+
+// Picks up a change in the file's size, as when it's appended to, and clears `Error`. If the file
+// shrank, the line index is started over. Returns true if the size changed.
+bool RefreshTextFileSize(TextFile *file);
+
+// Copies `length` bytes of the file from `offset` into `buffer`. `length` must be at most
+// `TEXT_FILE_MAX_RANGE` and the range must lie within the file. Returns false if it couldn't be
+// read.
+bool ReadTextFile(TextFile *file, uint64_t offset, size_t length, char *buffer);
+
+// A line ends after a newline, or at an offset that's a multiple of `TEXT_FILE_LINE_WRAP_LENGTH`
+// if the `TEXT_FILE_LINE_WRAP_LENGTH` bytes before it hold no newline. Short lines are never
+// wrapped, and the wrap points of a long one can be found from anywhere near them.
+
+// Returns the start of the line containing `offset`. An `offset` of `Size` is in the last line.
+uint64_t FindTextLineStart(TextFile *file, uint64_t offset);
+// Returns the start of the line after the one starting at `line_start`, or `Size` at the end.
+uint64_t FindNextTextLine(TextFile *file, uint64_t line_start);
+// Returns the start of the line before the one starting at `line_start`, or 0 at the start.
+uint64_t FindPreviousTextLine(TextFile *file, uint64_t line_start);
+// Returns the start of the last line, not counting the empty "line" after a final newline.
+uint64_t FindLastTextLine(TextFile *file);
+
+// Extends the line index to cover at least the first `offset` bytes, for up to `budget_seconds`.
+// Returns true if there's more to do.
+bool UpdateTextFileIndex(TextFile *file, uint64_t offset, double budget_seconds);
+
+// Gets the zero-based number of the line starting at `line_start`, counting newlines, so that the
+// pieces of a wrapped line share a number. Returns false if the index doesn't reach that far yet.
+bool GetTextFileLineNumber(TextFile *file, uint64_t line_start, uint64_t *line_number);
+
+#endif